@@ -0,0 +1,69 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+/* A small in-tree benchmark harness, so the client can be measured offline without extra dependencies.
+    A benchmark is a function that loops on state.keepRunning(), and may report extra counters per iteration.
+    The harness replaces operator new to count the heap allocations of each thread, see allocationCount().
+
+    EXAMPLE
+    static BenchRegistrar example([]{
+        registerBenchmark("example/copy_1KB", [](BenchState& state){
+            std::string src(1024,'a');
+            while (state.keepRunning()){
+                std::string dst = src;
+                state.addCounter("bytes_copied", dst.size());
+            }
+            state.setBytesPerIteration(1024);
+        });
+    });
+*/
+
+class BenchState {
+    public:
+        explicit BenchState(std::chrono::milliseconds minTime);
+        bool keepRunning();                                                         // True as long as the benchmark should do another iteration
+        void addCounter(const std::string& name, double value);                     // Adds to a counter, reported as an average per iteration
+        void setBytesPerIteration(uint64_t bytes);                                  // Enables the MB/s column
+        void pauseTiming();                                                         // Excludes setup work inside the loop from the timing
+        void resumeTiming();
+
+        uint64_t getIterations() const;
+        double getNanosPerIteration() const;
+        uint64_t getBytesPerIteration() const;
+        const std::map<std::string, double>& getCounters() const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+        std::chrono::nanoseconds minTime;                                           // Minimum time measured before stopping
+        Clock::time_point started;                                                  // Start of the current timed section
+        std::chrono::nanoseconds elapsed{0};                                        // Total timed duration
+        uint64_t iterations = 0;                                                    // Iterations done
+        uint64_t bytesPerIteration = 0;                                             // Bytes processed per iteration (0 if not relevant)
+        bool running = false;                                                       // Is the clock running?
+        std::map<std::string, double> counters;                                     // Counter totals
+};
+
+using BenchFunction = std::function<void(BenchState&)>;
+
+void registerBenchmark(const std::string& name, BenchFunction function);            // Adds a benchmark to the suite
+uint64_t allocationCount();                                                         // Heap allocations made so far by the calling thread
+const std::vector<std::pair<std::string, BenchFunction>>& getBenchmarks();          // Returns all registered benchmarks
+
+/* Runs a registration function during static initialization */
+struct BenchRegistrar {
+    explicit BenchRegistrar(const std::function<void()>& registration) { registration(); }
+};
+
+/* Keeps the compiler from optimizing a value away */
+template <typename T>
+inline void doNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif
@@ -0,0 +1,157 @@
+#include "Bench.h"
+#include "../include/AESWrapper.h"
+#include "../include/ProtocolManager.h"
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+/* AES benchmark: messages per second for one key, like decrypting a backlog of messages from the same member.
+    legacy builds the key schedule, CBC mode and filter on every call (what AESWrapper did before),
+    string uses the cached contexts, into uses the cached contexts and a caller buffer (no allocation).
+    aes/bulk compares decrypting a big received file: decrypt() on one thread, decryptBulk on 1 / every thread,
+    and the StreamDecryptor with the update sizes of a socket read and of the file handler. */
+
+namespace {
+
+constexpr size_t STREAM_UPDATE_SMALL = STREAM_BLOCK_SIZE;                   // A receive window worth of ciphertext
+constexpr size_t STREAM_UPDATE_BIG = FILE_DECRYPT_BLOCK;                    // What the file handler decrypts at once
+
+std::string legacyEncrypt(const std::string& key, const std::string& plain) {
+    CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = {0};
+    CryptoPP::AES::Encryption aesEncryption(reinterpret_cast<const CryptoPP::byte*>(key.data()), AESWrapper::DEFAULT_KEYLENGTH);
+    CryptoPP::CBC_Mode_ExternalCipher::Encryption cbcEncryption(aesEncryption, iv);
+
+    std::string cipher;
+    CryptoPP::StreamTransformationFilter stfEncryptor(cbcEncryption, new CryptoPP::StringSink(cipher));
+    stfEncryptor.Put(reinterpret_cast<const CryptoPP::byte*>(plain.data()), plain.size());
+    stfEncryptor.MessageEnd();
+    return cipher;
+}
+
+std::string legacyDecrypt(const std::string& key, const std::string& cipher) {
+    CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = {0};
+    CryptoPP::AES::Decryption aesDecryption(reinterpret_cast<const CryptoPP::byte*>(key.data()), AESWrapper::DEFAULT_KEYLENGTH);
+    CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption, iv);
+
+    std::string decrypted;
+    CryptoPP::StreamTransformationFilter stfDecryptor(cbcDecryption, new CryptoPP::StringSink(decrypted));
+    stfDecryptor.Put(reinterpret_cast<const CryptoPP::byte*>(cipher.data()), cipher.size());
+    stfDecryptor.MessageEnd();
+    return decrypted;
+}
+
+/* The bulk path must give exactly what decrypt() gives, a benchmark of a wrong result is worthless */
+void checkBulk(const AESWrapper& aes, const std::string& cipher, unsigned threads) {
+    std::string expected = aes.decrypt(cipher);
+    std::vector<unsigned char> out(cipher.size());
+    size_t size = aes.decryptBulk(reinterpret_cast<const unsigned char*>(cipher.data()), cipher.size(), out.data(), threads);
+    if (size != expected.size() || std::memcmp(out.data(), expected.data(), size) != 0)
+        throw std::runtime_error("decryptBulk does not match decrypt with " + std::to_string(threads) + " threads");
+
+    std::string streamed;
+    AESWrapper::StreamDecryptor decryptor(aes, threads);
+    for (size_t offset = 0; offset < cipher.size(); offset += 1000003)
+        streamed += decryptor.update(cipher.data() + offset, std::min<size_t>(1000003, cipher.size() - offset));
+    streamed += decryptor.final();
+    if (streamed != expected)
+        throw std::runtime_error("StreamDecryptor does not match decrypt with " + std::to_string(threads) + " threads");
+}
+
+std::string label(size_t size) {
+    if (size >= 1024 * 1024)    return std::to_string(size / (1024 * 1024)) + "MB";
+    if (size >= 1024)           return std::to_string(size / 1024) + "KB";
+    return std::to_string(size) + "B";
+}
+
+}
+
+static BenchRegistrar aesBenchmarks([]{
+    for (size_t size : {size_t(64), size_t(1024), size_t(1024 * 1024)}) {
+        registerBenchmark("aes/encrypt/legacy/" + label(size), [size](BenchState& state){
+            AESWrapper aes;
+            std::string plain(size, 'p');
+            while (state.keepRunning())
+                doNotOptimize(legacyEncrypt(aes.getKey(), plain));
+            state.setBytesPerIteration(size);
+        });
+
+        registerBenchmark("aes/encrypt/string/" + label(size), [size](BenchState& state){
+            AESWrapper aes;
+            std::string plain(size, 'p');
+            while (state.keepRunning())
+                doNotOptimize(aes.encrypt(plain));
+            state.setBytesPerIteration(size);
+        });
+
+        registerBenchmark("aes/encrypt/into/" + label(size), [size](BenchState& state){
+            AESWrapper aes;
+            std::vector<unsigned char> plain(size, 'p');
+            std::vector<unsigned char> out(AESWrapper::cipherSize(size));
+            while (state.keepRunning())
+                doNotOptimize(aes.encrypt(plain.data(), plain.size(), out.data()));
+            state.setBytesPerIteration(size);
+        });
+
+        registerBenchmark("aes/decrypt/legacy/" + label(size), [size](BenchState& state){
+            AESWrapper aes;
+            std::string cipher = aes.encrypt(std::string(size, 'p'));
+            while (state.keepRunning())
+                doNotOptimize(legacyDecrypt(aes.getKey(), cipher));
+            state.setBytesPerIteration(size);
+        });
+
+        registerBenchmark("aes/decrypt/string/" + label(size), [size](BenchState& state){
+            AESWrapper aes;
+            std::string cipher = aes.encrypt(std::string(size, 'p'));
+            while (state.keepRunning())
+                doNotOptimize(aes.decrypt(cipher));
+            state.setBytesPerIteration(size);
+        });
+
+        registerBenchmark("aes/decrypt/into/" + label(size), [size](BenchState& state){
+            AESWrapper aes;
+            std::string cipher = aes.encrypt(std::string(size, 'p'));
+            std::vector<unsigned char> out(cipher.size());
+            while (state.keepRunning())
+                doNotOptimize(aes.decrypt(reinterpret_cast<const unsigned char*>(cipher.data()), cipher.size(), out.data()));
+            state.setBytesPerIteration(size);
+        });
+    }
+
+    const size_t bulkSize = 64 * 1024 * 1024;
+    registerBenchmark("aes/bulk/decrypt/" + label(bulkSize), [bulkSize](BenchState& state){
+        AESWrapper aes;
+        std::string cipher = aes.encrypt(std::string(bulkSize, 'f'));
+        std::vector<unsigned char> out(cipher.size());
+        while (state.keepRunning())
+            doNotOptimize(aes.decrypt(reinterpret_cast<const unsigned char*>(cipher.data()), cipher.size(), out.data()));
+        state.setBytesPerIteration(bulkSize);
+    });
+
+    for (unsigned threads : {1u, 0u}) {
+        std::string name = threads ? "1_thread" : "all_threads";
+        registerBenchmark("aes/bulk/decrypt_bulk/" + name + "/" + label(bulkSize), [bulkSize, threads](BenchState& state){
+            AESWrapper aes;
+            std::string cipher = aes.encrypt(std::string(bulkSize, 'f'));
+            checkBulk(aes, cipher, threads);
+            std::vector<unsigned char> out(cipher.size());
+            while (state.keepRunning())
+                doNotOptimize(aes.decryptBulk(reinterpret_cast<const unsigned char*>(cipher.data()), cipher.size(), out.data(), threads));
+            state.setBytesPerIteration(bulkSize);
+        });
+    }
+
+    for (size_t update : {size_t(STREAM_UPDATE_SMALL), size_t(STREAM_UPDATE_BIG)}) {
+        registerBenchmark("aes/bulk/stream_decrypt/" + label(update) + "_updates/" + label(bulkSize), [bulkSize, update](BenchState& state){
+            AESWrapper aes;
+            std::string cipher = aes.encrypt(std::string(bulkSize, 'f'));
+            while (state.keepRunning()) {
+                AESWrapper::StreamDecryptor decryptor(aes);
+                for (size_t offset = 0; offset < cipher.size(); offset += update)
+                    doNotOptimize(decryptor.update(cipher.data() + offset, std::min(update, cipher.size() - offset)));
+                doNotOptimize(decryptor.final());
+            }
+            state.setBytesPerIteration(bulkSize);
+        });
+    }
+});
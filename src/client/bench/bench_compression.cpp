@@ -0,0 +1,125 @@
+#include "Bench.h"
+#include "../include/Compression.h"
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+/* Compression benchmark: MB/s of deflate / inflate, and the ratio (plain bytes per compressed byte) of every kind of content.
+    json is a log of JSON lines (what most transfers are), text a short chat message, random an already compressed file.
+    compression/heuristic is the cost of the entropy check that decides to skip random content, and compression/send
+    is the whole decision a text goes through (heuristic, deflate, size check). The throughput is in plain bytes. */
+
+namespace {
+
+constexpr size_t CONTENT_SIZE = 4 * 1024 * 1024;                            // A big file worth of content
+constexpr size_t STREAM_UPDATE = 1024 * 1024;                               // Block handed to the stream compressor
+
+std::string jsonLog(size_t size) {
+    static const char* levels[] = {"info", "debug", "warning", "error"};
+    std::mt19937 random(7);
+    std::string log;
+    for (size_t i = 0; log.size() < size; i++) {
+        log += "{\"id\":" + std::to_string(i) + ",\"time\":\"2024-03-" + std::to_string(10 + random() % 20) + "T12:" + std::to_string(random() % 60) +
+               "\",\"level\":\"" + levels[random() % 4] + "\",\"user\":\"user" + std::to_string(random() % 500) +
+               "\",\"msg\":\"request served\",\"ms\":" + std::to_string(random() % 2000) + "}\n";
+    }
+    log.resize(size);
+    return log;
+}
+
+std::string randomContent(size_t size) {
+    std::mt19937 random(11);
+    std::string content(size, '\0');
+    for (char& byte : content)  byte = static_cast<char>(random());
+    return content;
+}
+
+std::string chatText() {
+    return "Hi, the build on the release branch failed again, the log says the linker can not find the crypto library. "
+           "Can you check if the path in the makefile is right on your machine? On mine the build works, the build on the "
+           "release branch uses the same makefile as the main branch so it should work on yours too.";
+}
+
+/* Compressing and inflating back must give the content, a benchmark of a wrong result is worthless */
+void checkRoundTrip(const std::string& plain) {
+    if (Compression::decompress(Compression::compress(plain), plain.size()) != plain)
+        throw std::runtime_error("compression does not round trip a content of " + std::to_string(plain.size()) + " bytes");
+}
+
+}
+
+static BenchRegistrar compressionBenchmarks([]{
+    struct Content { const char* name; std::string (*make)(); };
+    static const Content contents[] = {
+        {"json", []{ return jsonLog(CONTENT_SIZE); }},
+        {"text", []{ return chatText(); }},
+        {"random", []{ return randomContent(CONTENT_SIZE); }},
+    };
+
+    for (const Content& content : contents) {
+        std::string name = content.name;
+        auto make = content.make;
+
+        registerBenchmark("compression/deflate/" + name, [make](BenchState& state){
+            std::string plain = make();
+            checkRoundTrip(plain);
+            size_t compressedSize = 0;
+            while (state.keepRunning()) {
+                std::string compressed = Compression::compress(plain);
+                compressedSize = compressed.size();
+                doNotOptimize(compressed.data());
+            }
+            state.addCounter("ratio", static_cast<double>(plain.size()) / compressedSize * state.getIterations());
+            state.setBytesPerIteration(plain.size());
+        });
+
+        registerBenchmark("compression/inflate/" + name, [make](BenchState& state){
+            std::string plain = make();
+            std::string compressed = Compression::compress(plain);
+            while (state.keepRunning())
+                doNotOptimize(Compression::decompress(compressed, plain.size()).data());
+            state.addCounter("ratio", static_cast<double>(plain.size()) / compressed.size() * state.getIterations());
+            state.setBytesPerIteration(plain.size());
+        });
+
+        registerBenchmark("compression/heuristic/" + name, [make](BenchState& state){
+            std::string plain = make();
+            bool worth = false;
+            while (state.keepRunning()) {
+                worth = Compression::worthCompressing(plain.data(), plain.size());
+                doNotOptimize(worth);
+            }
+            state.addCounter("compressed", worth ? state.getIterations() : 0);
+            state.setBytesPerIteration(plain.size());
+        });
+
+        registerBenchmark("compression/send/" + name, [make](BenchState& state){
+            std::string plain = make();
+            std::string content;
+            while (state.keepRunning()) {
+                state.pauseTiming();
+                content = plain;
+                state.resumeTiming();
+                doNotOptimize(Compression::compressInPlace(content));
+            }
+            state.addCounter("ratio", static_cast<double>(plain.size()) / content.size() * state.getIterations());
+            state.setBytesPerIteration(plain.size());
+        });
+    }
+
+    /* A file deflated block by block into a stream, like openFile does before sending */
+    registerBenchmark("compression/stream/json", [](BenchState& state){
+        std::string plain = jsonLog(CONTENT_SIZE);
+        uint64_t compressedSize = 0;
+        while (state.keepRunning()) {
+            Compression::StreamCompressor compressor;
+            compressedSize = 0;
+            for (size_t offset = 0; offset < plain.size(); offset += STREAM_UPDATE)
+                compressedSize += compressor.update(plain.data() + offset, std::min(STREAM_UPDATE, plain.size() - offset)).size();
+            compressedSize += compressor.final().size();
+        }
+        state.addCounter("ratio", static_cast<double>(plain.size()) / compressedSize * state.getIterations());
+        state.setBytesPerIteration(plain.size());
+    });
+});
@@ -0,0 +1,102 @@
+#include "Bench.h"
+#include "../include/Helpers.h"
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Helper benchmark: the encodings and member accessors the client runs for every user and key.
+    base64 is a private key (me.info) and a 4KB blob, binaryToStr a UUID and a 1KB hex dump,
+    uuid is the hex of a UUID both ways (me.info, the key cache, printing) and its hash (the member index),
+    client_data is a member: made from a member list entry, and its UUID read back. */
+
+namespace {
+
+std::string label(size_t size) {
+    if (size >= 1024)   return std::to_string(size / 1024) + "KB";
+    return std::to_string(size) + "B";
+}
+
+std::string bytesOf(size_t size) {
+    std::string bytes(size, '\0');
+    for (size_t i = 0; i < size; i++)   bytes[i] = static_cast<char>(i * 131 + 7);
+    return bytes;
+}
+
+Uuid uuidOf(size_t i) {
+    std::array<uint8_t, Uuid::SIZE> uuid{};
+    for (size_t b = 0; b < uuid.size(); b++)    uuid[b] = static_cast<uint8_t>(i * 31 + b * 7);
+    return Uuid(uuid);
+}
+
+}
+
+static BenchRegistrar helperBenchmarks([]{
+    for (size_t size : {size_t(16), size_t(640), size_t(4096)}) {
+        registerBenchmark("base64/encode/" + label(size), [size](BenchState& state){
+            std::string plain = bytesOf(size);
+            if (Base64Wrapper::decode(Base64Wrapper::encode(plain)) != plain)
+                throw std::runtime_error("base64 does not round trip " + label(size));
+            while (state.keepRunning())
+                doNotOptimize(Base64Wrapper::encode(plain));
+            state.setBytesPerIteration(size);
+        });
+
+        registerBenchmark("base64/decode/" + label(size), [size](BenchState& state){
+            std::string encoded = Base64Wrapper::encode(bytesOf(size));
+            while (state.keepRunning())
+                doNotOptimize(Base64Wrapper::decode(encoded));
+            state.setBytesPerIteration(size);
+        });
+    }
+
+    for (size_t size : {size_t(16), size_t(1024)}) {
+        registerBenchmark("hex/binaryToStr/" + label(size), [size](BenchState& state){
+            std::string bytes = bytesOf(size);
+            std::vector<unsigned char> data(bytes.begin(), bytes.end());
+            while (state.keepRunning())
+                doNotOptimize(binaryToStr(data));
+            state.setBytesPerIteration(size);
+        });
+    }
+
+    registerBenchmark("uuid/hex", [](BenchState& state){
+        Uuid uuid = uuidOf(1);
+        while (state.keepRunning())
+            doNotOptimize(uuid.hex());
+    });
+
+    registerBenchmark("uuid/hexDigits", [](BenchState& state){
+        Uuid uuid = uuidOf(1);
+        while (state.keepRunning())
+            doNotOptimize(uuid.hexDigits());
+    });
+
+    registerBenchmark("uuid/fromHex", [](BenchState& state){
+        std::string hex = uuidOf(1).hex();
+        if (Uuid::fromHex(hex) != uuidOf(1))    throw std::runtime_error("uuid hex does not round trip");
+        while (state.keepRunning())
+            doNotOptimize(Uuid::fromHex(hex));
+    });
+
+    registerBenchmark("uuid/hash", [](BenchState& state){
+        Uuid uuid = uuidOf(1);
+        std::hash<Uuid> hash;
+        while (state.keepRunning())
+            doNotOptimize(hash(uuid));
+    });
+
+    registerBenchmark("client_data/construct", [](BenchState& state){
+        Uuid uuid = uuidOf(1);
+        std::string name = "user1_name";
+        while (state.keepRunning()) {
+            ClientData member(uuid, name);
+            doNotOptimize(member.getUUID());
+        }
+    });
+
+    registerBenchmark("client_data/getUUID", [](BenchState& state){
+        ClientData member(uuidOf(1), "user1_name");
+        while (state.keepRunning())
+            doNotOptimize(member.getUUID());
+    });
+});
@@ -0,0 +1,66 @@
+#include "Bench.h"
+#include "../include/Hex.h"
+#include "../include/Logger.h"
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+/* Logger benchmark: what logging a received payload costs the receive path.
+    disabled is a hex dump below the level (the default), trace a dump capped at LOG_HEX_LIMIT bytes queued for the writer,
+    iostream the hex dump of the whole payload the client used to print with std::hex / setw for every receive.
+    The logger writes to a stream that drops everything, lines past the queue or the rate are counted as dropped. */
+
+namespace {
+
+constexpr size_t PAYLOAD_SIZE = 1024 * 1024;                                   // A big pull of waiting messages
+
+/* Accepts every character and keeps none */
+class NullBuffer : public std::streambuf {
+    protected:
+        int overflow(int c) override { return c; }
+        std::streamsize xsputn(const char*, std::streamsize size) override { return size; }
+};
+
+}
+
+static BenchRegistrar loggerBenchmarks([]{
+    registerBenchmark("log/hexdump/disabled", [](BenchState& state){
+        NullBuffer buffer;
+        std::ostream sink(&buffer);
+        Logger log(sink, LogLevel::INFO);
+        std::vector<unsigned char> payload(PAYLOAD_SIZE, 0x5A);
+        while (state.keepRunning())
+            log.hexDump(LogLevel::TRACE, "[RECEIVED]", payload.data(), payload.size());
+        state.setBytesPerIteration(payload.size());
+    });
+
+    registerBenchmark("log/hexdump/trace", [](BenchState& state){
+        NullBuffer buffer;
+        std::ostream sink(&buffer);
+        Logger log(sink, LogLevel::TRACE);
+        std::vector<unsigned char> payload(PAYLOAD_SIZE, 0x5A);
+        while (state.keepRunning())
+            log.hexDump(LogLevel::TRACE, "[RECEIVED]", payload.data(), payload.size());
+        log.flush();
+        state.addCounter("drop_rate", static_cast<double>(log.dropped()));
+        state.setBytesPerIteration(payload.size());
+    });
+
+    registerBenchmark("log/hexdump/iostream", [](BenchState& state){
+        std::vector<unsigned char> payload(PAYLOAD_SIZE, 0x5A);
+        while (state.keepRunning()) {
+            std::ostringstream out;
+            for (size_t i = 0; i < payload.size(); i++)
+                out << std::hex << std::setfill('0') << std::setw(2) << (int)payload[i] << " ";
+            doNotOptimize(out.str().size());
+        }
+        state.setBytesPerIteration(payload.size());
+    });
+
+    registerBenchmark("hex/encode/" + std::to_string(PAYLOAD_SIZE / 1024) + "KB", [](BenchState& state){
+        std::vector<unsigned char> payload(PAYLOAD_SIZE, 0x5A);
+        while (state.keepRunning())
+            doNotOptimize(Hex::encode(payload.data(), payload.size()).size());
+        state.setBytesPerIteration(payload.size());
+    });
+});
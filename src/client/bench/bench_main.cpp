@@ -0,0 +1,129 @@
+#include "Bench.h"
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+/* Every allocation of the program goes through here, and is counted for its thread only (a plain counter, no contention) */
+static thread_local uint64_t allocations = 0;
+
+void* operator new(std::size_t size) {
+    allocations++;
+    if (void* memory = std::malloc(size == 0 ? 1 : size))   return memory;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+
+uint64_t allocationCount() {
+    return allocations;
+}
+
+/* Starts the timing of the benchmark */
+BenchState::BenchState(std::chrono::milliseconds minTime) : minTime(minTime) {}
+
+/* Counts an iteration, and checks if we measured long enough */
+bool BenchState::keepRunning() {
+    if (!running) {
+        if (iterations == 0) {
+            running = true;
+            started = Clock::now();
+            return true;
+        }
+        resumeTiming();
+    }
+    iterations++;
+    auto now = Clock::now();
+    if (elapsed + (now - started) >= minTime) {
+        elapsed += now - started;
+        running = false;
+        return false;
+    }
+    return true;
+}
+
+/* Adds a value to a counter */
+void BenchState::addCounter(const std::string& name, double value) {
+    counters[name] += value;
+}
+
+/* Sets the amount of bytes one iteration handles */
+void BenchState::setBytesPerIteration(uint64_t bytes) {
+    bytesPerIteration = bytes;
+}
+
+/* Stops the clock (for setup inside the loop) */
+void BenchState::pauseTiming() {
+    if (running) {
+        elapsed += Clock::now() - started;
+        running = false;
+    }
+}
+
+/* Restarts the clock */
+void BenchState::resumeTiming() {
+    if (!running) {
+        running = true;
+        started = Clock::now();
+    }
+}
+
+uint64_t BenchState::getIterations() const { return iterations; }
+uint64_t BenchState::getBytesPerIteration() const { return bytesPerIteration; }
+const std::map<std::string, double>& BenchState::getCounters() const { return counters; }
+
+/* Returns the average time per iteration */
+double BenchState::getNanosPerIteration() const {
+    return iterations ? static_cast<double>(elapsed.count()) / iterations : 0;
+}
+
+/* The registered benchmarks, in registration order */
+static std::vector<std::pair<std::string, BenchFunction>>& benchmarks() {
+    static std::vector<std::pair<std::string, BenchFunction>> all;
+    return all;
+}
+
+void registerBenchmark(const std::string& name, BenchFunction function) {
+    benchmarks().emplace_back(name, std::move(function));
+}
+
+const std::vector<std::pair<std::string, BenchFunction>>& getBenchmarks() {
+    return benchmarks();
+}
+
+/* Runs every benchmark whose name contains the filter (first argument) */
+int main(int argc, char* argv[]) {
+    std::string filter = argc > 1 ? argv[1] : "";
+
+    std::cout << std::left << std::setw(48) << "BENCHMARK" << std::right << std::setw(12) << "ITERATIONS"
+              << std::setw(16) << "NS/ITER" << std::setw(14) << "ITER/S" << std::setw(12) << "MB/S" << "  COUNTERS/ITER" << std::endl;
+
+    for (const auto& [name, function] : getBenchmarks()) {
+        if (name.find(filter) == std::string::npos) continue;
+
+        BenchState state(std::chrono::milliseconds(500));
+        function(state);
+
+        double nanos = state.getNanosPerIteration();
+        std::cout << std::left << std::setw(48) << name << std::right << std::setw(12) << state.getIterations()
+                  << std::setw(16) << std::fixed << std::setprecision(1) << nanos
+                  << std::setw(14) << (nanos > 0 ? 1e9 / nanos : 0);
+        if (state.getBytesPerIteration() && nanos > 0)
+            std::cout << std::setw(12) << (state.getBytesPerIteration() / (1024.0 * 1024.0)) / (nanos / 1e9);
+        else
+            std::cout << std::setw(12) << "-";
+
+        std::cout << " ";
+        for (const auto& [counter, total] : state.getCounters())
+            std::cout << " " << counter << "=" << std::setprecision(1) << total / state.getIterations();
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include "Bench.h"
+#include "../include/Metrics.h"
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+/* Metrics benchmark: what the instrumentation adds to the hot path. span is an empty stage timed and recorded,
+    count a counter update, and threads/span the same span on every core at once (each thread writes to its own slot,
+    so it should cost about the same as on one). write is a merge of every slot into the Prometheus text.
+    Built with make METRICS=0, span and count should cost nothing. */
+
+static BenchRegistrar metricsBenchmarks([]{
+    registerBenchmark("metrics/span", [](BenchState& state){
+        while (state.keepRunning()) {
+            Metrics::Span span(Metrics::Stage::SEND, 603);
+        }
+    });
+
+    registerBenchmark("metrics/count", [](BenchState& state){
+        while (state.keepRunning())
+            Metrics::count(Metrics::Counter::BYTES_SENT, 64);
+    });
+
+    registerBenchmark("metrics/threads/span", [](BenchState& state){
+        constexpr size_t SPANS = 100000;                                        // Spans per thread per iteration
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        while (state.keepRunning()) {
+            std::vector<std::thread> workers;
+            for (unsigned i = 0; i < threads; i++)
+                workers.emplace_back([]{
+                    for (size_t span = 0; span < SPANS; span++)
+                        Metrics::Span timed(Metrics::Stage::DECRYPT, 604);
+                });
+            for (std::thread& worker : workers)     worker.join();
+        }
+        state.addCounter("spans", static_cast<double>(SPANS) * threads * state.getIterations());
+    });
+
+    registerBenchmark("metrics/write/prometheus", [](BenchState& state){
+        Metrics::Span(Metrics::Stage::PARSE, 601).stop();
+        while (state.keepRunning()) {
+            std::ostringstream out;
+            Metrics::write(out, Metrics::Format::PROMETHEUS);
+            doNotOptimize(out.str().size());
+        }
+    });
+});
@@ -0,0 +1,194 @@
+#include "Bench.h"
+#include "../include/Client.h"
+#include "../include/MessageReader.h"
+#include "../include/ProtocolManager.h"
+#include <boost/asio/connect.hpp>
+#include <boost/asio/write.hpp>
+#include <stdexcept>
+#include <streambuf>
+#include <thread>
+
+/* Protocol benchmark: building a text message request, and reading a page of waiting messages (RESP_AWAITING_MESSAGES).
+    create_message is what request 150 does once the text is encrypted: the headers, the content (moved in) and the gathered buffers.
+    awaiting_messages reads a payload of records with MessageReader from a loopback connection that a local thread keeps filling
+    (no server involved), parse only takes the contents, decrypt also decrypts every text like handleMessage does.
+    steady_state checks that a connection that is warmed up makes no heap allocation: building text requests,
+    and handling a whole waiting messages response (responseHandler, texts decrypted and printed to a discarding stream).
+    It stops if an iteration allocates, allocs is the count per iteration. */
+
+namespace {
+
+constexpr size_t RECORDS = 1000;                                                // Messages in a payload
+constexpr size_t TEXT_SIZE = 48;                                                // A short text before encryption
+
+std::string label(size_t size) {
+    if (size >= 1024 * 1024)    return std::to_string(size / (1024 * 1024)) + "MB";
+    if (size >= 1024)           return std::to_string(size / 1024) + "KB";
+    return std::to_string(size) + "B";
+}
+
+/* A RESP_AWAITING_MESSAGES payload of RECORDS texts from one member */
+std::vector<unsigned char> awaitingPayload(uint8_t version, const Uuid& from, const std::string& cipher) {
+    std::vector<unsigned char> payload(RECORDS * (WIRE_MAX_RECORD_HEADER + cipher.size()));
+    WireWriter writer(payload.data(), version);
+    for (size_t i = 0; i < RECORDS; i++) {
+        writer.uuid(from);
+        writer.u32(static_cast<uint32_t>(1000000 + i));
+        writer.u8(static_cast<uint8_t>(MessageType::SEND_TEXT_MSG));
+        writer.u32(static_cast<uint32_t>(cipher.size()));
+        writer.bytes(cipher.data(), cipher.size());
+    }
+    payload.resize(writer.size());
+    return payload;
+}
+
+/* A client connected over loopback to a thread that writes the payload again and again, until the client disconnects */
+class LoopbackFeed {
+    public:
+        LoopbackFeed(Client& client, const std::vector<unsigned char>& payload)
+            : client(client), acceptor(context, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)), peer(context) {
+            client.getSocket().connect(acceptor.local_endpoint());
+            acceptor.accept(peer);
+            writer = std::thread([this, &payload]{
+                boost::system::error_code error;
+                while (!error)  boost::asio::write(peer, boost::asio::buffer(payload), error);
+            });
+        }
+
+        /* Closing the client makes the next write of the thread fail */
+        ~LoopbackFeed() {
+            client.getSocket().close();
+            writer.join();
+        }
+
+    private:
+        Client& client;
+        boost::asio::io_context context;
+        boost::asio::ip::tcp::acceptor acceptor;
+        boost::asio::ip::tcp::socket peer;
+        std::thread writer;
+};
+
+/* A stream buffer that drops what is written, so printed messages cost their formatting but reach no terminal */
+class DiscardBuffer : public std::streambuf {
+    protected:
+        int overflow(int c) override { return c; }
+        std::streamsize xsputn(const char*, std::streamsize size) override { return size; }
+};
+
+/* Sends std::cout to a DiscardBuffer while it lives */
+class DiscardCout {
+    public:
+        DiscardCout() : previous(std::cout.rdbuf(&discard)) {}
+        ~DiscardCout() { std::cout.rdbuf(previous); }
+
+    private:
+        DiscardBuffer discard;
+        std::streambuf* previous;
+};
+
+/* Runs an iteration until it stops allocating, then counts the allocations of the timed ones and stops if there were any */
+template <typename Iteration>
+void expectNoAllocations(BenchState& state, const std::string& name, Iteration iteration) {
+    for (int warmup = 0; warmup < 3; warmup++)  iteration();
+    uint64_t before = allocationCount();
+    while (state.keepRunning())     iteration();
+    uint64_t allocated = allocationCount() - before;
+    state.addCounter("allocs", static_cast<double>(allocated));
+    if (allocated > 0)
+        throw std::runtime_error(name + " allocated " + std::to_string(allocated) + " times in " + std::to_string(state.getIterations()) + " iterations");
+}
+
+/* Reads one payload like handleMessages does, returns the content bytes read (or decrypted) */
+size_t readPayload(Client& client, uint32_t size, uint8_t version, const AESWrapper* aes) {
+    MessageReader reader(&client, size, version);
+    MessageRecord record;
+    size_t contents = 0;
+    while (reader.next(record)) {
+        std::span<const unsigned char> content = reader.content();
+        if (aes)    contents += aes -> decrypt(std::string(content.begin(), content.end())).size();
+        else        contents += content.size();
+    }
+    return contents;
+}
+
+}
+
+static BenchRegistrar protocolBenchmarks([]{
+    for (size_t size : {size_t(64), size_t(1024), size_t(16 * 1024)}) {
+        registerBenchmark("protocol/create_message/text/" + label(size), [size](BenchState& state){
+            AESWrapper aes;
+            std::string cipher = aes.encrypt(std::string(size, 't'));
+            Uuid sender(std::array<uint8_t, Uuid::SIZE>{1}), target(std::array<uint8_t, Uuid::SIZE>{2});
+            ProtocolManager request;
+            while (state.keepRunning()) {
+                state.pauseTiming();
+                std::string content = cipher;
+                state.resumeTiming();
+                request.setRequestHeader(sender, PROTOCOL_VERSION, static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR));
+                request.setMessageHeader(target, static_cast<uint8_t>(MessageType::SEND_TEXT_MSG), static_cast<uint32_t>(cipher.size()));
+                request.setContent(std::move(content));
+                request.setPayloadSize(static_cast<uint32_t>(request.getPayload().size() + cipher.size()));
+                doNotOptimize(request.createMessage());
+            }
+            state.setBytesPerIteration(cipher.size());
+        });
+    }
+
+    for (uint8_t version : {uint8_t(PROTOCOL_VERSION_FIXED), uint8_t(PROTOCOL_VERSION_COMPACT)}) {
+        for (bool decrypt : {false, true}) {
+            std::string name = std::string("protocol/awaiting_messages/") + (decrypt ? "decrypt" : "parse") + "/v" + std::to_string(version);
+            registerBenchmark(name, [version, decrypt](BenchState& state){
+                AESWrapper aes;
+                std::vector<unsigned char> payload = awaitingPayload(version, Uuid(std::array<uint8_t, Uuid::SIZE>{7}), aes.encrypt(std::string(TEXT_SIZE, 't')));
+                size_t expected = RECORDS * (decrypt ? TEXT_SIZE : AESWrapper::cipherSize(TEXT_SIZE));
+
+                Client client("127.0.0.1", 0);
+                {
+                    LoopbackFeed feed(client, payload);
+                    if (readPayload(client, static_cast<uint32_t>(payload.size()), version, decrypt ? &aes : nullptr) != expected)
+                        throw std::runtime_error("awaiting messages do not parse back in v" + std::to_string(version));
+                    while (state.keepRunning())
+                        doNotOptimize(readPayload(client, static_cast<uint32_t>(payload.size()), version, decrypt ? &aes : nullptr));
+                }
+                state.addCounter("messages", static_cast<double>(RECORDS) * state.getIterations());
+                state.setBytesPerIteration(payload.size());
+            });
+        }
+    }
+
+    registerBenchmark("protocol/steady_state/create_message", [](BenchState& state){
+        AESWrapper aes;
+        std::string cipher = aes.encrypt(std::string(TEXT_SIZE, 't'));
+        Uuid sender(std::array<uint8_t, Uuid::SIZE>{1}), target(std::array<uint8_t, Uuid::SIZE>{2});
+        ProtocolManager request;
+        request.setContent(cipher);
+        expectNoAllocations(state, "create_message", [&]{
+            request.setRequestHeader(sender, PROTOCOL_VERSION, static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR));
+            request.setMessageHeader(target, static_cast<uint8_t>(MessageType::SEND_TEXT_MSG), static_cast<uint32_t>(cipher.size()));
+            request.setPayloadSize(static_cast<uint32_t>(request.getPayload().size() + cipher.size()));
+            doNotOptimize(request.createMessage());
+        });
+    });
+
+    registerBenchmark("protocol/steady_state/awaiting_messages", [](BenchState& state){
+        AESWrapper aes;
+        Uuid sender(std::array<uint8_t, Uuid::SIZE>{7});
+        std::vector<unsigned char> payload = awaitingPayload(PROTOCOL_VERSION, sender, aes.encrypt(std::string(TEXT_SIZE, 't')));
+        ResponseHeader header{PROTOCOL_VERSION, static_cast<uint16_t>(ResponseOp::RESP_AWAITING_MESSAGES), static_cast<uint32_t>(payload.size())};
+        std::vector<unsigned char> frame(reinterpret_cast<const unsigned char*>(&header), reinterpret_cast<const unsigned char*>(&header) + sizeof(header));
+        frame.insert(frame.end(), payload.begin(), payload.end());
+
+        Client client("127.0.0.1", 0);
+        client.setMembers(sender, "steady_state_sender");
+        client.findUser(sender).setSymmetric(aes.getKey());
+        ProtocolManager response;
+        {
+            LoopbackFeed feed(client, frame);
+            DiscardCout discard;
+            expectNoAllocations(state, "awaiting_messages", [&]{ response.responseHandler(&client); });
+        }
+        state.addCounter("messages", static_cast<double>(RECORDS) * state.getIterations());
+        state.setBytesPerIteration(frame.size());
+    });
+});
@@ -0,0 +1,64 @@
+#include "Bench.h"
+#include "../include/RSAWrapper.h"
+#include "../include/AESWrapper.h"
+#include <stdexcept>
+
+/* RSA benchmark: the public key operations of a key exchange, in the sizes the client uses them.
+    encrypt is sending a symmetric key (16 bytes) to a member, decrypt is receiving one with our private key,
+    keygen is a new key pair (a sign up), load_private reading me.info, load_public a key received for a member (602). */
+
+namespace {
+
+/* Decrypting what we encrypted must give the key back, a benchmark of a wrong result is worthless */
+void checkRoundTrip(RSAPrivateWrapper& privateKey, RSAPublicWrapper& publicKey) {
+    std::string key = AESWrapper::GenerateKey();
+    if (privateKey.decrypt(publicKey.encrypt(key)) != key)
+        throw std::runtime_error("RSA does not round trip a symmetric key");
+}
+
+}
+
+static BenchRegistrar rsaBenchmarks([]{
+    registerBenchmark("rsa/keygen/" + std::to_string(RSAPrivateWrapper::BITS), [](BenchState& state){
+        while (state.keepRunning()) {
+            RSAPrivateWrapper key;
+            doNotOptimize(key);
+        }
+    });
+
+    registerBenchmark("rsa/encrypt/symmetric_key", [](BenchState& state){
+        RSAPrivateWrapper privateKey;
+        RSAPublicWrapper publicKey(privateKey.getPublicKey());
+        checkRoundTrip(privateKey, publicKey);
+        std::string key = AESWrapper::GenerateKey();
+        while (state.keepRunning())
+            doNotOptimize(publicKey.encrypt(key));
+        state.setBytesPerIteration(key.size());
+    });
+
+    registerBenchmark("rsa/decrypt/symmetric_key", [](BenchState& state){
+        RSAPrivateWrapper privateKey;
+        RSAPublicWrapper publicKey(privateKey.getPublicKey());
+        checkRoundTrip(privateKey, publicKey);
+        std::string cipher = publicKey.encrypt(AESWrapper::GenerateKey());
+        while (state.keepRunning())
+            doNotOptimize(privateKey.decrypt(cipher));
+        state.setBytesPerIteration(cipher.size());
+    });
+
+    registerBenchmark("rsa/load_private", [](BenchState& state){
+        std::string saved = RSAPrivateWrapper().getPrivateKey();
+        while (state.keepRunning()) {
+            RSAPrivateWrapper key(saved);
+            doNotOptimize(key);
+        }
+    });
+
+    registerBenchmark("rsa/load_public", [](BenchState& state){
+        std::string received = RSAPrivateWrapper().getPublicKey();
+        while (state.keepRunning()) {
+            RSAPublicWrapper key(received);
+            doNotOptimize(key);
+        }
+    });
+});
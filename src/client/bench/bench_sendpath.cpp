@@ -0,0 +1,100 @@
+#include "Bench.h"
+#include "../include/ProtocolManager.h"
+#include <boost/asio/write.hpp>
+#include <algorithm>
+
+/* Send path benchmark: the old 4096 byte chunk vectors against the gathered buffer sequence.
+    Writes go to a counting stream instead of a socket, every write_some call stands for one send syscall. */
+
+namespace {
+
+/* A SyncWriteStream that accepts everything it is given, like a writev that never writes partially */
+class CountingStream {
+    public:
+        template <typename ConstBufferSequence>
+        size_t write_some(const ConstBufferSequence& buffers) {
+            boost::system::error_code ec;
+            return write_some(buffers, ec);
+        }
+
+        template <typename ConstBufferSequence>
+        size_t write_some(const ConstBufferSequence& buffers, boost::system::error_code& ec) {
+            ec = {};
+            size_t size = boost::asio::buffer_size(buffers);
+            calls++;
+            bytes += size;
+            return size;
+        }
+
+        size_t calls = 0;                                   // Amount of write calls (syscalls on a socket)
+        size_t bytes = 0;                                   // Amount of bytes written
+};
+
+/* The chunking the client used before: the ciphertext is copied into the payload, and the payload into chunks */
+std::vector<std::vector<unsigned char>> legacyChunks(const RequestHeader& header, const std::vector<unsigned char>& messageHeader,
+                                                     const std::string& cipher, size_t& copied) {
+    std::vector<unsigned char> payload(messageHeader);
+    payload.insert(payload.end(), cipher.begin(), cipher.end());
+    copied += payload.size();
+
+    std::vector<std::vector<unsigned char>> chunks;
+    size_t availableSize = MAX_BUFFER - sizeof(RequestHeader);
+    std::vector<unsigned char> firstChunk(sizeof(RequestHeader));
+    std::memcpy(firstChunk.data(), &header, sizeof(RequestHeader));
+
+    size_t first = std::min(availableSize, payload.size());
+    firstChunk.insert(firstChunk.end(), payload.begin(), payload.begin() + first);
+    chunks.push_back(firstChunk);
+    copied += firstChunk.size() * 2;                        // Built once, copied again by push_back
+
+    for (size_t offset = first; offset < payload.size(); offset += MAX_BUFFER) {
+        size_t chunkSize = std::min(payload.size() - offset, static_cast<size_t>(MAX_BUFFER));
+        std::vector<unsigned char> chunk(payload.begin() + offset, payload.begin() + offset + chunkSize);
+        chunks.push_back(chunk);
+        copied += chunkSize * 2;
+    }
+    return chunks;
+}
+
+std::string label(size_t size) {
+    return size >= 1024 * 1024 ? std::to_string(size / (1024 * 1024)) + "MB" : std::to_string(size / 1024) + "KB";
+}
+
+}
+
+static BenchRegistrar sendPathBenchmarks([]{
+    for (size_t size : {size_t(4 * 1024), size_t(1024 * 1024), size_t(64 * 1024 * 1024)}) {
+        registerBenchmark("sendpath/legacy_chunks/" + label(size), [size](BenchState& state){
+            std::string cipher(size, 'x');
+            ProtocolManager protocol;
+            protocol.setRequestHeader({}, 2, static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR));
+            std::vector<unsigned char> messageHeader(21, 0);
+
+            while (state.keepRunning()) {
+                size_t copied = 0;
+                CountingStream stream;
+                for (const auto& chunk : legacyChunks(protocol.getRequestHeader(), messageHeader, cipher, copied))
+                    boost::asio::write(stream, boost::asio::buffer(chunk));
+                state.addCounter("bytes_copied", copied);
+                state.addCounter("syscalls", stream.calls);
+            }
+            state.setBytesPerIteration(size);
+        });
+
+        registerBenchmark("sendpath/gathered/" + label(size), [size](BenchState& state){
+            ProtocolManager protocol;
+            protocol.setRequestHeader({}, 2, static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR));
+            protocol.setMessageHeader({}, static_cast<uint8_t>(MessageType::SEND_FILE), static_cast<uint32_t>(size));
+            protocol.setContent(std::string(size, 'x'));
+            protocol.setPayloadSize(static_cast<uint32_t>(21 + size));
+
+            while (state.keepRunning()) {
+                CountingStream stream;
+                boost::asio::write(stream, protocol.createMessage());
+                state.addCounter("bytes_copied", 0);
+                state.addCounter("syscalls", stream.calls);
+            }
+            state.setBytesPerIteration(size);
+        });
+    }
+});
@@ -0,0 +1,168 @@
+#include "Bench.h"
+#include "../include/WireCodec.h"
+#include <array>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Wire encoding benchmark: version 2 (fixed fields, padded names) against version 3 (varints, length prefixed names).
+    Every payload is encoded and parsed with WireWriter / WireReader into buffers made once, wire_bytes is the payload size.
+    records is a page of waiting messages (604 / 606) with short text contents, members a member list (601).
+    message_header is the header of a message (603), checked to fit WIRE_MAX_MESSAGE_HEADER for the longest sizes first. */
+
+namespace {
+
+constexpr size_t RECORDS = 1000;                                                // Messages in a page
+constexpr size_t CONTENT_SIZE = 48;                                             // A short encrypted text
+constexpr size_t MEMBERS = 1000;                                                // Users in a member list
+
+Uuid uuidOf(size_t i) {
+    std::array<uint8_t, Uuid::SIZE> uuid{};
+    for (size_t b = 0; b < uuid.size(); b++)    uuid[b] = static_cast<uint8_t>(i * 31 + b * 7);
+    return Uuid(uuid);
+}
+
+std::string nameOf(size_t i) {
+    return "user" + std::to_string(i) + "_name";
+}
+
+size_t encodeRecords(unsigned char* out, uint8_t version, const std::string& content) {
+    WireWriter writer(out, version);
+    for (size_t i = 0; i < RECORDS; i++) {
+        writer.uuid(uuidOf(i));
+        writer.u32(static_cast<uint32_t>(1000000 + i));
+        writer.u8(3);
+        writer.u32(static_cast<uint32_t>(content.size()));
+        writer.bytes(content.data(), content.size());
+    }
+    return writer.size();
+}
+
+size_t parseRecords(const unsigned char* in, size_t size, uint8_t version) {
+    WireReader reader(std::span<const unsigned char>(in, size), version);
+    Uuid fromID;
+    size_t contents = 0;
+    while (reader.remaining() > 0) {
+        reader.uuid(fromID);
+        doNotOptimize(reader.u32());
+        doNotOptimize(reader.u8());
+        contents += reader.view(reader.u32()).size();
+    }
+    return contents;
+}
+
+size_t encodeMembers(unsigned char* out, uint8_t version, const std::vector<std::string>& names) {
+    WireWriter writer(out, version);
+    for (size_t i = 0; i < names.size(); i++) {
+        writer.uuid(uuidOf(i));
+        writer.name(names[i], '0');
+    }
+    return writer.size();
+}
+
+size_t parseMembers(const unsigned char* in, size_t size, uint8_t version) {
+    WireReader reader(std::span<const unsigned char>(in, size), version);
+    Uuid uuid;
+    size_t members = 0;
+    while (reader.remaining() > 0) {
+        reader.uuid(uuid);
+        doNotOptimize(reader.name('0'));
+        members++;
+    }
+    return members;
+}
+
+size_t encodeMessageHeader(unsigned char* out, uint8_t version, uint32_t contentSize) {
+    WireWriter writer(out, version);
+    writer.uuid(uuidOf(1));
+    writer.u8(4);
+    writer.u32(contentSize);
+    return writer.size();
+}
+
+std::string label(uint8_t version) {
+    return "v" + std::to_string(version);
+}
+
+}
+
+static BenchRegistrar wireBenchmarks([]{
+    for (uint8_t version : {uint8_t(PROTOCOL_VERSION_FIXED), uint8_t(PROTOCOL_VERSION_COMPACT)}) {
+        registerBenchmark("wire/records/encode/" + label(version), [version](BenchState& state){
+            std::string content(CONTENT_SIZE, 'c');
+            std::vector<unsigned char> out(RECORDS * (WIRE_MAX_RECORD_HEADER + CONTENT_SIZE));
+            size_t size = 0;
+            while (state.keepRunning()) {
+                size = encodeRecords(out.data(), version, content);
+                doNotOptimize(out.data());
+            }
+            state.addCounter("wire_bytes", static_cast<double>(size) * state.getIterations());
+            state.setBytesPerIteration(size);
+        });
+
+        registerBenchmark("wire/records/parse/" + label(version), [version](BenchState& state){
+            std::string content(CONTENT_SIZE, 'c');
+            std::vector<unsigned char> in(RECORDS * (WIRE_MAX_RECORD_HEADER + CONTENT_SIZE));
+            size_t size = encodeRecords(in.data(), version, content);
+            if (parseRecords(in.data(), size, version) != RECORDS * CONTENT_SIZE)
+                throw std::runtime_error("wire records do not parse back in " + label(version));
+
+            while (state.keepRunning())
+                doNotOptimize(parseRecords(in.data(), size, version));
+            state.addCounter("wire_bytes", static_cast<double>(size) * state.getIterations());
+            state.setBytesPerIteration(size);
+        });
+
+        registerBenchmark("wire/message_header/encode/" + label(version), [version](BenchState& state){
+            /* Contents of 2^28 bytes and more take a 5 byte varint in version 3, nothing may be written past the buffer */
+            constexpr unsigned char GUARD = 0xA5;
+            std::array<unsigned char, WIRE_MAX_MESSAGE_HEADER + 1> out;
+            for (uint32_t contentSize : {uint32_t(1) << 28, std::numeric_limits<uint32_t>::max()}) {
+                out.back() = GUARD;
+                size_t size = encodeMessageHeader(out.data(), version, contentSize);
+                WireReader reader(std::span<const unsigned char>(out.data(), size), version);
+                Uuid target;
+                reader.uuid(target);
+                reader.u8();
+                if (size > WIRE_MAX_MESSAGE_HEADER || out.back() != GUARD || reader.u32() != contentSize || reader.remaining() != 0)
+                    throw std::runtime_error("message header of " + std::to_string(contentSize) + " bytes does not fit in " + label(version));
+            }
+
+            size_t size = 0;
+            while (state.keepRunning()) {
+                size = encodeMessageHeader(out.data(), version, uint32_t(1) << 28);
+                doNotOptimize(out.data());
+            }
+            state.addCounter("wire_bytes", static_cast<double>(size) * state.getIterations());
+            state.setBytesPerIteration(size);
+        });
+
+        registerBenchmark("wire/members/encode/" + label(version), [version](BenchState& state){
+            std::vector<std::string> names;
+            for (size_t i = 0; i < MEMBERS; i++)    names.push_back(nameOf(i));
+            std::vector<unsigned char> out(MEMBERS * (16 + WIRE_MAX_VARINT32 + WIRE_NAME_SIZE));
+            size_t size = 0;
+            while (state.keepRunning()) {
+                size = encodeMembers(out.data(), version, names);
+                doNotOptimize(out.data());
+            }
+            state.addCounter("wire_bytes", static_cast<double>(size) * state.getIterations());
+            state.setBytesPerIteration(size);
+        });
+
+        registerBenchmark("wire/members/parse/" + label(version), [version](BenchState& state){
+            std::vector<std::string> names;
+            for (size_t i = 0; i < MEMBERS; i++)    names.push_back(nameOf(i));
+            std::vector<unsigned char> in(MEMBERS * (16 + WIRE_MAX_VARINT32 + WIRE_NAME_SIZE));
+            size_t size = encodeMembers(in.data(), version, names);
+            if (parseMembers(in.data(), size, version) != MEMBERS)
+                throw std::runtime_error("wire members do not parse back in " + label(version));
+
+            while (state.keepRunning())
+                doNotOptimize(parseMembers(in.data(), size, version));
+            state.addCounter("wire_bytes", static_cast<double>(size) * state.getIterations());
+            state.setBytesPerIteration(size);
+        });
+    }
+});
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <string>
+#include <memory>
+#include <modes.h>
+#include <aes.h>
+#include <filters.h>
  /* SYMMETRICAL ENCODING 
             generate an aes object with a new key 
             AESWrapper aes(AESWrapper::GenerateKey());
@@ -23,20 +27,81 @@
             
 			decrypted message
             std::cout << "Decrypted again: " << std::endl << aes.decrypt(data) << std::endl;
+
+			encrypt into a buffer we own, no allocation (out may be the input itself, it needs room for the padding)
+            std::vector<unsigned char> buffer(AESWrapper::cipherSize(size));
+            size_t cipherLength = aes.encrypt(plain, size, buffer.data());
+
+ The key schedule is expanded once per key and shared by the copies of a wrapper. Every copy has CBC modes of its own,
+ so copies can be used on different threads, while one wrapper is used by one thread at a time.
 */
 
 class AESWrapper{
 	public:
+		class StreamEncryptor;														// Incremental encryption (for files)
+		class StreamDecryptor;														// Incremental decryption (for files)
+
 		static const unsigned int DEFAULT_KEYLENGTH = 16;							// 128-bit AES key
+		static const size_t BULK_THREAD_MIN = 1024 * 1024;							// Least ciphertext bytes worth a decryption thread of their own
 		AESWrapper();																// Constructor with new key
 		AESWrapper(const std::string& key);											// Constructor with existing key
+		AESWrapper(const AESWrapper& other);										// Shares the key schedule of other, with CBC modes of its own
+		AESWrapper& operator=(const AESWrapper& other);
 
 		static std::string GenerateKey();											// Generates a random AES key of specified length and stores it in buffer
 		const std::string& getKey() const;											// Retrieves the AES key
 
 		std::string encrypt(const std::string& plain) const;						// Encrypts plaintext and returns the ciphertext
 		std::string decrypt(const std::string& cipher) const;						// Decrypts ciphertext and returns the plaintext
+		size_t encrypt(const unsigned char* plain, size_t size, unsigned char* out) const;	// Encrypts into out (cipherSize(size) bytes, may be plain), returns the ciphertext size
+		size_t decrypt(const unsigned char* cipher, size_t size, unsigned char* out) const;	// Decrypts into out (size bytes, may be cipher), returns the plaintext size
+		size_t decryptBulk(const unsigned char* cipher, size_t size, unsigned char* out, unsigned threads = 0) const;	// Decrypts big contents on many blocks / threads at once, out can not be cipher
+		static size_t cipherSize(size_t plainSize);									// Size of the ciphertext for a plaintext of plainSize bytes (PKCS padded)
 		
 	private:
+		struct KeySchedule;															// Expanded key schedules of the key, only read once built
+		void bindModes();															// Points the CBC modes at the key schedule
+
 		std::string _key;															// AES key storage
-};
\ No newline at end of file
+		std::shared_ptr<KeySchedule> _schedule;										// Built once per key, shared by copies of the wrapper
+		mutable CryptoPP::CBC_Mode_ExternalCipher::Encryption _cbcEncryption;		// Chaining state of this copy only, resynchronized for every message
+		mutable CryptoPP::CBC_Mode_ExternalCipher::Decryption _cbcDecryption;
+};
+
+/* Encrypts a message block by block, the CBC state is kept between the calls so the output
+	is identical to a single encrypt() of the whole message. 
+	
+	AESWrapper::StreamEncryptor encryptor(aes);
+	while (more data)	send(encryptor.update(block, blockSize));
+	send(encryptor.final());
+*/
+class AESWrapper::StreamEncryptor{
+	public:
+		StreamEncryptor(const AESWrapper& aes);
+		const std::string& update(const char* plain, size_t size);					// Encrypts the next block, returns the ciphertext available so far
+		const std::string& final();													// Pads and encrypts the remainder
+
+	private:
+		std::shared_ptr<KeySchedule> _schedule;										// Keeps the key schedule alive
+		CryptoPP::CBC_Mode_ExternalCipher::Encryption _cbc;
+		std::string _out;															// Output of the last call
+		std::unique_ptr<CryptoPP::StreamTransformationFilter> _filter;
+};
+
+/* Decrypts a message block by block, the last block is held back until final() to remove the padding.
+	Whole blocks are decrypted straight from the input, many at once (AES-NI when the CPU has it),
+	and big updates are split across threads like decryptBulk. */
+class AESWrapper::StreamDecryptor{
+	public:
+		StreamDecryptor(const AESWrapper& aes, unsigned threads = 0);
+		const std::string& update(const char* cipher, size_t size);					// Decrypts the next block, returns the plaintext available so far
+		const std::string& final();													// Decrypts the remainder and removes the padding
+
+	private:
+		std::shared_ptr<KeySchedule> _schedule;										// Keeps the key schedule alive
+		unsigned _threads;															// Threads for big updates (0 for every core)
+		CryptoPP::byte _previous[CryptoPP::AES::BLOCKSIZE];							// Last ciphertext block decrypted (CBC chaining)
+		CryptoPP::byte _pending[CryptoPP::AES::BLOCKSIZE];							// Ciphertext not decrypted yet (a partial block, or the held back last block)
+		size_t _pendingSize = 0;
+		std::string _out;															// Output of the last call
+};
@@ -2,31 +2,32 @@
 #define CLIENT_H
 
 #include "ProtocolManager.h"
+#include "KeyPool.h"
+#include "FramePool.h"
 #include <User.h>
 #include <Helpers.h>
+#include "Uuid.h"
 #include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <unordered_map>
 #include <optional>
 
 #define MAX_USERNAME_SIZE 254                                                                   // Max username length, minus null terminator.
+#define PROVISION_CHUNK 64                                                                      // Users registered per pipeline run when provisioning
+#define PUBLIC_KEY_CACHE "publickeys.bin"                                                       // Public keys of members we already asked for
 
 /* This class is for the users that are received in the client list from the server. */
 class ClientData {
     public:
 
-        ClientData(std::string uid, std::string uname) 
-            : uuid(std::move(uid)), username(std::move(uname)), requestedSymmetric(false){}                             // Basic constructor 
+        ClientData(const Uuid& uid, std::string uname)                                                                  // Basic constructor
+            : uuid(uid), username(std::move(uname)), requestedSymmetric(false){}
 
-        ClientData(ClientData&& other) noexcept                                                                         // After reserving room we need a move constructor
-            : uuid(std::move(other.uuid)), username(std::move(other.username)),requestedSymmetric(false) {}
-
-        ClientData& operator=(ClientData&& other) noexcept {                                                            // Copy constructor for move (deep copy)
-            if (this != &other) {
-                uuid = std::move(other.uuid);
-                username = std::move(other.username);
-                requestedSymmetric = std::move(other.requestedSymmetric);
-            }
-            return *this;
-        }
+        ClientData(const ClientData&) = delete;                                                                         // The RSA key can not be copied or moved,
+        ClientData& operator=(const ClientData&) = delete;                                                              // members stay where they were made (a deque)
 
         /* Sets a new symmetric key for a specific user */
         void setNewSymmetric(){                                                                                         
@@ -43,23 +44,19 @@ class ClientData {
             public_key.emplace(key);
         }
 
-        /* Returns the UUID of a user in an array */
-        std::array<uint8_t, 16> getUUID() const{
-            std::array<uint8_t, 16> uuidBytes;
-            for (size_t i = 0; i < 16; i++) {
-                uuidBytes[i] = std::stoul(uuid.substr(i * 2, 2), nullptr, 16);
-            }
-            return uuidBytes;
+        /* Returns the UUID of a user (hex it with getUUID().hex() to print it) */
+        const Uuid& getUUID() const{
+            return uuid;
         }
 
-        /* Returns the specific client member UUID */
-        std::string getUUIDString() const {
-            return uuid; 
+        /* Returns the members username */
+        const std::string& getUsername() const{
+            return username;
         }
 
-        /* Returns a string of the members username */
-        std::string getUsername() const{
-            return username;
+        /* Sets a new username (the member was renamed on the server) */
+        void setUsername(std::string name){
+            username = std::move(name);
         }
 
         /* Returns the symmetric encrypter */
@@ -83,7 +80,7 @@ class ClientData {
         }
 
     private:
-        std::string uuid;                                   // Member UUID
+        Uuid uuid;                                          // Member UUID
         std::string username;                               // Member username
         std::optional<AESWrapper> symmetric_key;            // Member symmetric key
         std::optional<RSAPublicWrapper> public_key;         // Member public key
@@ -93,34 +90,61 @@ class ClientData {
 class Client {
     public:
         Client(const std::string& server_ip, int server_port);                                          // Constructor for client connection
+        Client(boost::asio::io_context& context, const std::string& server_ip, int server_port,
+               const std::string& keyCache);                                                            // A connection on a shared context, with its own public key cache
         /* User related */
         void setUser(const std::string& name, const std::string& UUID, const std::string& key);         // Sets a user according to file
         void setUser(const std::string& name);                                                          // Sets a new user after username input 
         const std::optional<User>& getUser() const;                                                     // Returns user object
-        void setUserUUID(const std::array<uint8_t, 16>& newUUID);
+        void setUserUUID(const Uuid& newUUID);
         void clearUser();                                                                               // Clears the user object (for error on req 110)
         
 
         /* Member list related */
-        void setMembers(const std::string& uuid, const std::string& username);                          // Sets the members list (req 120) after response from server
-        std::vector<ClientData>& getMembers();                                                          // Returns the members list (req 120)
+        void setMembers(const Uuid& uuid, const std::string& username);                                 // Sets the members list (req 120) after response from server
+        void clearMembers(size_t expected = 0);                                                         // Empties the members list, makes room in the indexes for expected members
+        bool mergeMember(const Uuid& uuid, const std::string& username);                                // Adds a member or renames a known one (608 sync), true if he is new
+        uint64_t getMemberVersion() const;                                                              // Returns the member list version we are synced to
+        void setMemberVersion(uint64_t version);                                                        // Sets the member list version after a sync
+        std::deque<ClientData>& getMembers();                                                           // Returns the members list (req 120)
         ClientData& getMember();                                                                        // Returns a specific member from the list
-        ClientData& findUser(std::string& useruid);
+        ClientData& findUser(const Uuid& uuid);                                                         // Finds a member by his UUID
+        ClientData* findMember(const std::string& username);                                            // Finds a member by his username, nullptr if he is not in the list
+        void cachePublicKey(ClientData& member, const std::string& key);                                // Sets a member public key and saves it for the next runs
         
         /* Connection related */
         void clientService();                                                                           // The client request/response handler
         bool isConnected();                                                                             // Checks for active connection
         void connectToServer();                                                                         // Connects to the server 
         void closeConnection();                                                                         // Closes the connection
-        void sendMessage(const std::vector<std::vector<unsigned char>>& message);                       // Sends a message to the server
-        std::vector<unsigned char> receiveMessage(size_t size);                                         // Receives a message from the server
+        void sendMessage(const std::vector<boost::asio::const_buffer>& message);                        // Sends a gathered message to the server in a single write
+        void receiveMessage(unsigned char* data, size_t size);                                          // Receives exactly size bytes from the server into data
+        std::vector<uint32_t> sendBatch(const std::vector<BatchEntry>& entries);                        // Sends many messages in one request, returns their message IDs
+        size_t receiveSome(unsigned char* data, size_t size);                                           // Receives whatever arrived, up to size bytes
+        boost::asio::io_context& getContext();                                                          // Returns the io_context (for async operations)
+        FramePool& getFramePool();                                                                      // Returns the buffers reused by the frames of this connection
+        boost::asio::ip::tcp::socket& getSocket();                                                      // Returns the connection socket (for async operations)
+        void listen(std::chrono::seconds duration);                                                     // Handles messages pushed by the server for a while (after subscribing)
+        void receivePushed(const ResponseHeader& header);                                               // Handles a frame pushed by the server, after its header was read
+        void setMessageHandler(ProtocolManager::MessageHandler handler);                                // Received messages go to handler instead of std::cout
+        std::vector<std::string> provisionUsers(const std::vector<std::string>& names,
+                                                const std::string& directory, KeyPool& pool);           // Registers many users at once, saves them to directory
 
     private:    
+        boost::asio::awaitable<void> pushReader();                                                      // Reads pushed frames until the socket is cancelled
+
         std::optional<User> user;                                                   // Client-user information
+        FramePool framePool;                                                        // Frame buffers, declared first so it outlives their users
         ProtocolManager protocolManager;                                            // Handles the protocol
-        boost::asio::io_context io_context;                                         // Connection context
+        std::unique_ptr<boost::asio::io_context> ownContext;                        // The context of a client that runs alone
+        boost::asio::io_context& io_context;                                        // Connection context (ownContext, or a shared one)
         boost::asio::ip::tcp::socket socket;                                        // Connection socket
-        std::vector<ClientData> members;                                            // Members on the server
+        std::deque<ClientData> members;                                             // Members on the server, a deque so they never move (keys included)
+        std::unordered_map<Uuid, size_t> membersByUUID;                             // Index in members by UUID
+        std::unordered_map<std::string, size_t> membersByName;                      // Index in members by username
+        uint64_t memberVersion = 0;                                                 // Server member list version we have (0 = nothing yet)
+        std::string keyCache;                                                       // Public key cache file
+        std::unordered_map<Uuid, std::string> knownKeys;                            // Cached public keys by member UUID
         std::string server_ip;                                                      // Server IP
         int server_port;                                                            // Server PORT
 };
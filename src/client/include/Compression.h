@@ -0,0 +1,73 @@
+#pragma once
+
+#include <zdeflate.h>
+#include <zinflate.h>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+
+/* PAYLOAD COMPRESSION (message types 3, 4 and 5)
+	Text and file contents can be deflated before they are encrypted. The sender sets MESSAGE_COMPRESSED in the message type,
+	the receiver decrypts as usual and inflates the plaintext after it. The server stores and forwards the type as is.
+
+	Contents shorter than MIN_SIZE are never compressed, and neither are contents whose sample looks random
+	(compressed or encrypted files, media): their byte entropy is above MAX_ENTROPY bits per byte, so deflate would only cost time.
+	The sender also falls back to the plain content when the compressed one is not smaller.
+
+	Text:
+	if (Compression::compressInPlace(text))		type |= MESSAGE_COMPRESSED;
+	text = Compression::decompress(compressed, maxSize);
+
+	Files (one block at a time):
+	Compression::StreamCompressor compressor;
+	while (read a block)	write(compressor.update(block, size));
+	write(compressor.final());
+*/
+class Compression{
+	public:
+		class StreamCompressor;														// Incremental compression (for files)
+		class StreamDecompressor;													// Incremental decompression (for files)
+
+		static constexpr size_t MIN_SIZE = 256;										// Shorter contents are sent as they are
+		static constexpr size_t SAMPLE_SIZE = 64 * 1024;							// Bytes looked at by the heuristic
+		static constexpr double MAX_ENTROPY = 7.2;									// Bits per byte above which a sample is treated as incompressible
+		static constexpr unsigned LEVEL = 1;										// Deflate level, the fastest one that still finds matches
+		static constexpr size_t MAX_TEXT_SIZE = 64 * 1024 * 1024;					// Largest text we inflate from a sender
+
+		static double entropy(const void* data, size_t size);						// Shannon entropy of the bytes, in bits per byte
+		static bool worthCompressing(const void* sample, size_t size);				// Heuristic on (a sample of) the content
+		static std::string compress(const std::string& plain);
+		static bool compressInPlace(std::string& content);							// Compresses content if the heuristic allows it and it gets smaller
+		static std::string decompress(const std::string& compressed, uint64_t maxSize = MAX_TEXT_SIZE);	// Throws if the content is corrupt or inflates past maxSize
+		static uint64_t compressStream(std::istream& in, std::ostream& out);		// Deflates in to out block by block, returns the bytes written
+};
+
+/* Deflates a content block by block, the output of every block is returned as soon as deflate emits it */
+class Compression::StreamCompressor{
+	public:
+		StreamCompressor();
+		const std::string& update(const char* plain, size_t size);					// Compresses the next block, returns the output available so far
+		const std::string& final();													// Flushes the rest of the content
+
+	private:
+		std::string _out;															// Output of the last call (the sink of the deflator)
+		CryptoPP::Deflator _deflator;
+};
+
+/* Inflates a content block by block. The input is fed in small pieces so a content that inflates
+	past maxSize is stopped after at most one piece of extra output. */
+class Compression::StreamDecompressor{
+	public:
+		explicit StreamDecompressor(uint64_t maxSize = UINT64_MAX);
+		const std::string& update(const char* compressed, size_t size);			// Inflates the next block, returns the plaintext available so far
+		const std::string& final();													// Checks that the content ended, returns the rest
+
+	private:
+		void check();
+
+		std::string _out;															// Output of the last call (the sink of the inflator)
+		CryptoPP::Inflator _inflator;
+		uint64_t _produced = 0;														// Plaintext bytes so far
+		uint64_t _maxSize;
+};
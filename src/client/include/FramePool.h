@@ -0,0 +1,62 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define FRAME_POOL_IDLE 8                                                       // Buffers kept for reuse, more are freed when they come back
+#define FRAME_POOL_KEEP_BYTES (16 * 1024 * 1024)                                // Capacity kept for reuse, past it a returned buffer is freed
+
+/* Byte buffers of the frames a connection receives and sends (message windows, decrypted texts, file blocks), reused between requests.
+    A buffer is borrowed as a Lease and goes back to the pool with its capacity when the lease ends,
+    so once the buffers grew to what the traffic needs, handling messages makes no heap allocation.
+    At most FRAME_POOL_IDLE buffers and FRAME_POOL_KEEP_BYTES are kept, so one big file does not stay in memory after it was sent.
+    A pool belongs to one connection and is used by one thread at a time (the bytes of a lease may be filled by any thread).
+
+    FramePool::Lease window = client -> getFramePool().take(STREAM_BLOCK_SIZE);
+    size_t size = client -> receiveSome(window.data(), window.size());
+*/
+class FramePool {
+    public:
+        class Lease;
+
+        FramePool();
+        FramePool(const FramePool&) = delete;
+        FramePool& operator=(const FramePool&) = delete;
+
+        Lease take(size_t size);                                                // A buffer of size bytes, what they hold is left from an earlier use
+        size_t idle() const;                                                    // Buffers waiting to be reused
+        uint64_t allocations() const;                                           // Buffers made or grown so far (a reused buffer is not one)
+
+    private:
+        void give(std::vector<unsigned char>&& buffer);                         // Keeps a returned buffer, or frees it past the limits
+
+        std::vector<std::vector<unsigned char>> idleBuffers;
+        size_t idleBytes = 0;                                                   // Capacity of the idle buffers
+        uint64_t made = 0;
+};
+
+/* A borrowed buffer, returned to its pool when the lease ends (or another lease is moved into it) */
+class FramePool::Lease {
+    public:
+        Lease() = default;                                                      // Holds nothing
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        ~Lease();
+
+        unsigned char* data() { return buffer.data(); }
+        const unsigned char* data() const { return buffer.data(); }
+        size_t size() const { return buffer.size(); }
+        std::vector<unsigned char>& operator*() { return buffer; }             // The buffer itself, it may be resized while borrowed
+        std::vector<unsigned char>* operator->() { return &buffer; }
+
+    private:
+        friend class FramePool;
+        Lease(FramePool* pool, std::vector<unsigned char>&& buffer);
+        void release();                                                         // Gives the buffer back
+
+        FramePool* pool = nullptr;
+        std::vector<unsigned char> buffer;
+};
+
+#endif
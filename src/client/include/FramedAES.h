@@ -0,0 +1,60 @@
+#pragma once
+
+#include "AESWrapper.h"
+#include <gcm.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* FRAMED FILE ENCRYPTION (message type 5)
+	The content is a header, followed by frames that are encrypted and authenticated on their own with AES-GCM:
+
+		| frame size (4 bytes) | nonce prefix (8 bytes) | frame 0 + tag | frame 1 + tag | ... | last frame + tag |
+
+	Every frame holds frame size bytes of the file, the last one holds the rest and is always shorter (it can be empty),
+	so the receiver knows where the file ends from the content size alone. The nonce of frame i is the random
+	prefix of the file followed by i, and the header plus a 'last frame' byte are authenticated with every frame.
+	Frames do not depend on each other, so a batch of frames (one per thread) is encrypted / decrypted at once.
+
+	Sending:
+	FramedAES frames(aes);
+	send(frames.newHeader());
+	while (read a batch of batchFrames() * getFrameSize() bytes)	send(out, frames.encryptFrames(plain, size, firstFrame, last, out));
+
+	Receiving:
+	frames.readHeader(header);
+	while (read a batch of batchFrames() frames)	write(out, frames.decryptFrames(cipher, size, firstFrame, last, out));
+*/
+class FramedAES{
+	public:
+		static const size_t FRAME_SIZE = 1024 * 1024;								// Default plaintext bytes per frame
+		static const size_t MAX_FRAME_SIZE = 16 * 1024 * 1024;						// Largest frame size we accept from a sender
+		static const size_t BATCH_BUDGET = 16 * 1024 * 1024;						// Most plaintext bytes in a batch, whatever frame size the sender picked
+		static const size_t TAG_SIZE = 16;											// GCM tag after every frame
+		static const size_t NONCE_PREFIX_SIZE = 8;									// Random part of the nonces, the frame index is the rest
+		static const size_t HEADER_SIZE = sizeof(uint32_t) + NONCE_PREFIX_SIZE;		// Frame size and nonce prefix
+
+		FramedAES(const AESWrapper& aes, unsigned threads = 0);						// Frames under the key of aes, threads 0 for every core
+
+		static uint64_t contentSize(uint64_t plainSize, size_t frameSize = FRAME_SIZE);	// Size of the content for a file of plainSize bytes
+		size_t batchFrames() const;													// Frames handled at once (one per thread, within BATCH_BUDGET)
+		size_t getFrameSize() const;												// Plaintext bytes per frame
+
+		std::string newHeader(size_t frameSize = FRAME_SIZE);						// Picks a new nonce prefix, returns the content header
+		void readHeader(const unsigned char* header);								// Reads the header of received content (HEADER_SIZE bytes)
+
+		size_t encryptFrames(const unsigned char* plain, size_t size, uint32_t firstFrame, bool last, unsigned char* out);	// Returns the bytes written to out
+		size_t decryptFrames(const unsigned char* cipher, size_t size, uint32_t firstFrame, bool last, unsigned char* out);	// Returns the plaintext size, throws if a frame was changed
+
+	private:
+		void nonce(uint32_t frame, unsigned char* out) const;						// Nonce of a frame
+		void aad(bool lastFrame, unsigned char* out) const;						// Authenticated data of a frame
+
+		std::string _key;															// AES key
+		unsigned _threads;															// Worker threads
+		uint32_t _frameSize = FRAME_SIZE;
+		unsigned char _noncePrefix[NONCE_PREFIX_SIZE] = {0};
+		std::vector<std::unique_ptr<CryptoPP::GCM<CryptoPP::AES>::Encryption>> _encryptors;	// One per worker, keyed once
+		std::vector<std::unique_ptr<CryptoPP::GCM<CryptoPP::AES>::Decryption>> _decryptors;
+};
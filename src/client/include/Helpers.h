@@ -1,6 +1,7 @@
 #ifndef HELPERS_H
 #define HELPERS_H
 #include "User.h"
+#include "Uuid.h"
 #include "Client.h"
 #include <vector>
 #include <iostream>
@@ -10,6 +11,8 @@
 #include <iomanip>
 #include <string>
 #include <optional>
+#include <span>
+#include <unordered_map>
 
 /* Defines just for cool text color */
 #define RESET   "\033[0m"
@@ -17,11 +20,16 @@
 #define YELLOW  "\033[33m" 
 
 std::pair<std::string, int> getServerInfo();                                                    // Gets server infro from file
-std::vector<std::string> getUserInfo();                                                         // Gets user info from file
+std::vector<std::string> getUserInfo(const std::string& path = "me.info");                      // Gets user info from a me.info file
+void writeUserInfo(const std::string& path, const std::string& name,
+                   const Uuid& uuid, const std::string& privateKey);                            // Writes user info in the me.info format
+std::unordered_map<Uuid, std::string> readPublicKeys(const std::string& path);                  // Reads the cached public keys (UUID -> key)
+void appendPublicKey(const std::string& path, const std::string& uuid, const std::string& key); // Adds a public key to the cache file
 int openingMessage(Client* client);                                                             // Opening message for the user
 std::string receiveUsername();                                                                  // Receives username from client input
-std::string binaryToStr(std::vector<unsigned char> data, const size_t size);                    // Turns binary vectors to string
-std::string saveToTemp(std::string data);                                                       // Saves a string of data to a random temp file in %temp%
+int receiveSeconds();                                                                           // Receives an amount of seconds from client input
+std::string binaryToStr(std::span<const unsigned char> data);                                   // Turns binary data to a hex string
+std::string createTempFile();                                                                   // Creates a random empty temp file in %temp% and returns its path
 
 
 #endif
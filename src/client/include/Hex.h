@@ -0,0 +1,79 @@
+#ifndef HEX_H
+#define HEX_H
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/* Hex encoding from a table of the two characters of every byte, so a byte is one lookup and a copy,
+    instead of the iostream manipulators (std::hex, setw, setfill) per byte. Decoding is a table of the value of every character.
+    Both are constexpr, so fixed values (UUIDs) can be converted at compile time.
+
+    std::string text = Hex::encode(data, size);                            // "0a1bff"
+    std::string dump = Hex::dump(data, size, 64);                          // "0a 1b ff ... (+4032 bytes)"
+    bool valid = Hex::decode(text.data(), text.size(), out);               // Upper or lower case, false on anything else
+*/
+class Hex {
+    public:
+        /* Writes the 2 * size characters of data to out, returns the end of them */
+        static constexpr char* encode(const unsigned char* data, size_t size, char* out) {
+            for (size_t i = 0; i < size; i++) {
+                const char* pair = &TABLE[data[i] * 2];
+                *out++ = pair[0];
+                *out++ = pair[1];
+            }
+            return out;
+        }
+
+        static std::string encode(const void* data, size_t size) {
+            std::string text(size * 2, '\0');
+            encode(static_cast<const unsigned char*>(data), size, text.data());
+            return text;
+        }
+
+        /* The first limit bytes of data as space separated pairs, and how many were left out */
+        static std::string dump(const void* data, size_t size, size_t limit) {
+            size_t shown = size < limit ? size : limit;
+            std::string text(shown * 3, ' ');
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < shown; i++)
+                encode(bytes + i, 1, &text[i * 3]);
+            if (shown > 0)  text.pop_back();
+            if (shown < size)   text += " ... (+" + std::to_string(size - shown) + " bytes)";
+            return text;
+        }
+
+        /* Writes the size / 2 bytes of text to out. False if size is odd or a character is not a hex digit (out is then partly written). */
+        static constexpr bool decode(const char* text, size_t size, unsigned char* out) {
+            if (size % 2 != 0)  return false;
+            for (size_t i = 0; i < size; i += 2) {
+                uint8_t high = VALUES[static_cast<unsigned char>(text[i])], low = VALUES[static_cast<unsigned char>(text[i + 1])];
+                if ((high | low) & INVALID)     return false;
+                *out++ = static_cast<unsigned char>(high << 4 | low);
+            }
+            return true;
+        }
+
+    private:
+        static constexpr uint8_t INVALID = 0xF0;                                // Value of a character that is not a hex digit, no nibble has these bits
+
+        static constexpr std::array<uint8_t, 256> VALUES = []{
+            std::array<uint8_t, 256> values{};
+            values.fill(INVALID);
+            for (uint8_t digit = 0; digit < 10; digit++)    values['0' + digit] = digit;
+            for (uint8_t digit = 0; digit < 6; digit++)     values['a' + digit] = values['A' + digit] = 10 + digit;
+            return values;
+        }();
+
+        static constexpr std::array<char, 512> TABLE = []{
+            constexpr char digits[] = "0123456789abcdef";
+            std::array<char, 512> table{};
+            for (size_t byte = 0; byte < 256; byte++) {
+                table[byte * 2] = digits[byte >> 4];
+                table[byte * 2 + 1] = digits[byte & 0x0F];
+            }
+            return table;
+        }();
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef KEY_POOL_H
+#define KEY_POOL_H
+#include "RSAWrapper.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define KEY_POOL_SIZE 2                                                         // Keys kept ready by the shared pool (interactive registration)
+#define PROVISION_POOL_SIZE 64                                                  // Keys kept ready while provisioning many users
+
+/* Generates RSA key pairs in the background, so nobody waits for a key generation on the interactive path.
+    Worker threads (one per core, at most one per key of the pool) keep up to capacity keys ready, and sleep while it is full.
+
+    RSAPrivateWrapper key(KeyPool::shared().take());       // Blocks only if no key is ready yet
+*/
+class KeyPool {
+    public:
+        KeyPool(size_t capacity = KEY_POOL_SIZE, unsigned threads = 0);          // Starts the workers, threads 0 for every core
+        ~KeyPool();                                                             // Stops the workers (a key being generated is finished first)
+        KeyPool(const KeyPool&) = delete;
+        KeyPool& operator=(const KeyPool&) = delete;
+
+        static KeyPool& shared();                                               // The pool of the client, started on first use
+        CryptoPP::RSA::PrivateKey take();                                       // Takes a ready key, waits for one if the pool is empty
+        size_t ready() const;                                                   // Amount of keys ready
+
+    private:
+        void generate();                                                        // Worker loop
+
+        size_t capacity;                                                        // Max keys ready (or being generated) at once
+        std::deque<CryptoPP::RSA::PrivateKey> keys;                             // Ready keys
+        size_t generating = 0;                                                  // Keys being generated right now
+        bool stopping = false;                                                  // Set by the destructor
+        mutable std::mutex mutex;                                               // Guards everything above
+        std::condition_variable keyReady;                                       // A key was added
+        std::condition_variable roomFreed;                                      // A key was taken (or we are stopping)
+        std::vector<std::thread> workers;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#define LOG_QUEUE_SIZE 4096                                                     // Lines waiting for the writer, lines past it are dropped (and counted)
+#define LOG_RATE_LIMIT 500                                                      // Lines per second below WARN, in bursts of up to as many
+#define LOG_HEX_LIMIT 64                                                        // Bytes shown by a hex dump, the rest is only counted
+#define LOG_LEVEL_ENV "CLIENT_LOG_LEVEL"                                        // trace, debug, info, warn, error or off (info if not set)
+#define LOG_FILE_ENV "CLIENT_LOG_FILE"                                          // File the log is appended to (stderr if not set)
+
+enum class LogLevel : uint8_t { TRACE, DEBUG, INFO, WARN, ERR, OFF };         // ERR, ERROR is a macro of windows.h
+
+/* Diagnostics of the client, written by a background thread so the caller only formats its line and queues it.
+    A line below the level is not even formatted (check enabled() first, or use hexDump which does).
+    The queue is bounded and lines below WARN are rate limited, so a flood of lines can not slow the client down or grow without end.
+    The dropped lines are counted and reported in the log once the writer catches up.
+    What the user asked for (menus, member lists, received messages) is not a log, it stays on std::cout.
+
+    Logger& log = Logger::shared();
+    if (log.enabled(LogLevel::DEBUG))     log.write(LogLevel::DEBUG, "Received " + std::to_string(size) + " bytes");
+    log.hexDump(LogLevel::TRACE, "Payload", data, size);                   // At most LOG_HEX_LIMIT bytes
+*/
+class Logger {
+    public:
+        Logger(std::ostream& out, LogLevel level);                              // Logs to out (it must outlive the logger)
+        Logger(const std::string& path, LogLevel level);                        // Appends to the file at path
+        ~Logger();                                                              // Writes what is queued and stops the writer
+        Logger(const Logger&) = delete;
+        Logger& operator=(const Logger&) = delete;
+
+        static Logger& shared();                                                // The log of the client, set up from LOG_LEVEL_ENV / LOG_FILE_ENV
+        static LogLevel parseLevel(const std::string& name, LogLevel otherwise); // A level from its name
+
+        /* True if a line of level would be logged, the only cost of a disabled line */
+        bool enabled(LogLevel level) const {
+            return level >= this -> level.load(std::memory_order_relaxed);
+        }
+
+        void setLevel(LogLevel newLevel);
+        void write(LogLevel level, std::string line);                           // Queues a line (dropped if the queue is full or past the rate)
+        void flush();                                                           // Waits until every queued line was written
+        uint64_t dropped() const;                                               // Lines dropped so far
+
+        /* Logs what, its size and its first LOG_HEX_LIMIT bytes in hex, if level is enabled */
+        void hexDump(LogLevel level, const char* what, const void* data, size_t size) {
+            if (enabled(level))     writeHex(level, what, data, size);
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Line {
+            LogLevel level;
+            std::chrono::system_clock::time_point time;
+            std::string text;
+        };
+
+        void writeHex(LogLevel level, const char* what, const void* data, size_t size);
+        bool allowed(LogLevel level, Clock::time_point now);                   // Takes a token of the rate limit (lock held)
+        void run();                                                             // Writer loop
+
+        std::optional<std::ofstream> file;                                      // The log file, when logging to a path
+        std::ostream& out;
+        std::atomic<LogLevel> level;
+        std::deque<Line> queue;                                                 // Lines waiting for the writer
+        uint64_t droppedLines = 0;                                              // Dropped lines not reported yet
+        uint64_t droppedTotal = 0;
+        double tokens = LOG_RATE_LIMIT;                                         // Rate limit bucket, refilled by LOG_RATE_LIMIT per second
+        Clock::time_point refilled = Clock::now();
+        bool writing = false;                                                   // The writer holds lines taken from the queue
+        bool stopping = false;                                                  // Set by the destructor
+        mutable std::mutex mutex;                                               // Guards everything above
+        std::condition_variable lineQueued;
+        std::condition_variable drained;                                        // The queue is empty and written
+        std::thread writer;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef MESSAGE_READER_H
+#define MESSAGE_READER_H
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "Uuid.h"
+#include "FramePool.h"
+
+class Client;
+
+/* The header of every message in a RESP_AWAITING_MESSAGES payload (fixed size in version 2, varints in version 3) */
+struct MessageRecord {
+    Uuid fromID;                                    // Sender UUID
+    uint32_t msgID;                                 // Message ID on the server
+    uint8_t type;                                   // MessageType
+    uint32_t size;                                  // Content size
+};
+
+/* Pulls the messages of a RESP_AWAITING_MESSAGES payload from the socket as they arrive, 
+    instead of receiving the whole payload first. Bytes go through a fixed window that is compacted 
+    when it reaches its end, and only grows if a single (non file) message does not fit in it.
+
+    MessageRecord record;
+    MessageReader reader(client, payloadSize, responseHeader.version);
+    while (reader.next(record)) {
+        std::span<const unsigned char> content = reader.content();              // Whole content
+        // or for big contents:
+        while (!(chunk = reader.contentChunk()).empty())  write(chunk);         // Piece by piece
+        // or into a buffer of our own, in big blocks:
+        while ((size = reader.readContent(block.data(), block.size())))  write(block, size);
+    }
+*/
+class MessageReader {
+    public:
+        MessageReader(Client* client, uint32_t payloadSize, uint8_t version);
+        bool next(MessageRecord& record);                                       // Reads the next message header, false when the payload is done
+        std::span<const unsigned char> content();                               // Returns the whole content of the current message
+        std::span<const unsigned char> contentChunk();                          // Returns the next received piece of content, empty when it was all read
+        size_t readContent(unsigned char* out, size_t size);                    // Reads the next size bytes of content into out, 0 when it was all read
+        uint32_t contentRemaining() const;                                      // Returns the amount of content bytes not read yet
+
+    private:
+        bool fill(size_t needed);                                               // Receives until 'needed' bytes are buffered, false if the payload ended first
+        size_t buffered() const;                                                // Bytes received but not read yet
+
+        Client* client;                                                         // Connection the payload is read from
+        FramePool::Lease window;                                                // Received bytes, borrowed from the connection pool
+        size_t head = 0;                                                        // First unread byte in window
+        size_t tail = 0;                                                        // End of the received bytes in window
+        uint32_t payloadRemaining;                                              // Payload bytes still on the socket
+        uint32_t contentLeft = 0;                                               // Content bytes of the current message not read yet
+        uint8_t version;                                                        // Protocol version of the payload (record encoding)
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#ifndef CLIENT_METRICS
+#define CLIENT_METRICS 1                                                        // make METRICS=0 compiles every span and counter out
+#endif
+
+/* Timings and counters of the client hot path.
+    A Span times one stage of a request on the monotonic clock, and is tagged with the request op (600-608, "none" for the rest).
+    Without an op it takes the request this thread is working on, which createMessage sets.
+    Every thread writes to its own slot and is its only writer, so recording is a couple of relaxed atomic stores, no lock and no RMW.
+    The slots are merged only when the metrics are written. A slot is handed to the next thread when its thread ends.
+
+    {
+        Metrics::Span span(Metrics::Stage::ENCRYPT, static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR));
+        cipher = aes.encrypt(plain);
+    }
+    Metrics::count(Metrics::Counter::BYTES_SENT, size);
+    Metrics::write(std::cout, Metrics::Format::STATS);                         // Or an Exporter, that rewrites a file every interval
+
+    Stages may overlap: a file block is encrypted while the previous one is sent, a receive can be waiting inside a parse.
+    Built with CLIENT_METRICS 0 the spans are empty objects and recording does nothing.
+*/
+class Metrics {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        /* A stage of a request */
+        enum class Stage : uint8_t {
+            CONNECT,                                                            // Resolving and connecting to the server
+            SERIALIZE,                                                          // Building the buffers of a request
+            ENCRYPT,                                                            // Encrypting a content (or a key)
+            SEND,                                                               // Writing to the socket
+            FIRST_BYTE,                                                         // From the end of a request until its response starts arriving
+            RECEIVE,                                                            // Reading the rest of a response
+            PARSE,                                                              // Parsing a response or a message header
+            DECRYPT,                                                            // Decrypting a received content (or a key)
+            COUNT
+        };
+
+        /* Totals kept by every thread */
+        enum class Counter : uint8_t {
+            BYTES_SENT,
+            BYTES_RECEIVED,
+            REQUESTS,                                                           // Requests built (createMessage)
+            RESPONSES,                                                          // Response headers read
+            MESSAGES_SENT,                                                      // Messages set in a request (603) or a batch (605)
+            MESSAGES_RECEIVED,                                                  // Messages read from a waiting / pushed list
+            COUNT
+        };
+
+        enum class Format { STATS, PROMETHEUS };                                // A table for people, or the Prometheus text format
+
+        static constexpr size_t STAGES = static_cast<size_t>(Stage::COUNT);
+        static constexpr size_t COUNTERS = static_cast<size_t>(Counter::COUNT);
+        static constexpr uint16_t FIRST_OP = 600;                               // Ops tagged one by one, the rest are "none"
+        static constexpr size_t OPS = 10;                                       // "none" and 600-608
+        static constexpr std::array<uint64_t, 7> BUCKETS = {                    // Histogram bounds in nanoseconds, 10us to 10s (and +Inf)
+            10'000, 100'000, 1'000'000, 10'000'000, 100'000'000, 1'000'000'000, 10'000'000'000};
+
+        class Span;
+        class Exporter;
+
+        static void setRequest(uint16_t op);                                    // Tags the spans that follow on this thread with op
+        static void count(Counter counter, uint64_t amount = 1);                // Adds to a counter of this thread
+        static void record(Stage stage, uint16_t op, Clock::duration elapsed);  // Adds a timed stage
+        static void requestSent();                                              // A request was written, its first response byte ends a FIRST_BYTE span
+        static bool firstByte();                                                // Records the FIRST_BYTE span if a request is waiting for it, true if so
+        static void write(std::ostream& out, Format format);                    // Writes the merged metrics of every thread
+
+#if CLIENT_METRICS
+    private:
+        static size_t opIndex(uint16_t op);                                     // Slot of an op in a stage
+        static inline thread_local uint16_t currentOp = 0;                      // Request the thread is working on
+        static inline thread_local Clock::time_point sentAt{};                  // When the last request was written
+        static inline thread_local bool awaitingFirstByte = false;              // No response byte arrived since
+#endif
+};
+
+/* Times a stage from its construction until stop() or its end */
+class Metrics::Span {
+    public:
+#if CLIENT_METRICS
+        explicit Span(Stage stage) : Span(stage, currentOp) {}
+        Span(Stage stage, uint16_t op) : stage(stage), op(op), start(Clock::now()) {}
+        ~Span() { stop(); }
+
+        /* Records the stage now, the end of the span then records nothing */
+        void stop() {
+            if (stopped)    return;
+            stopped = true;
+            record(stage, op, Clock::now() - start);
+        }
+
+        /* Starts the timing over (the time so far belongs to another stage) */
+        void restart() {
+            start = Clock::now();
+        }
+#else
+        explicit Span(Stage) {}
+        Span(Stage, uint16_t) {}
+        void stop() {}
+        void restart() {}
+#endif
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+#if CLIENT_METRICS
+    private:
+        Stage stage;
+        uint16_t op;
+        Clock::time_point start;
+        bool stopped = false;
+#endif
+};
+
+/* Writes the metrics to a file every interval, and once more when it is destroyed.
+    The file is written next to its path and renamed over it, so a reader (a Prometheus textfile collector) never sees half of it. */
+class Metrics::Exporter {
+    public:
+        Exporter(std::string path, Format format, std::chrono::seconds interval);
+        ~Exporter();
+        Exporter(const Exporter&) = delete;
+        Exporter& operator=(const Exporter&) = delete;
+
+        void flush();                                                           // Writes the file now
+
+    private:
+        void run();                                                             // Writes every interval until stopping
+
+        std::string path;
+        Format format;
+        std::chrono::seconds interval;
+        bool stopping = false;                                                  // Set by the destructor
+        std::mutex mutex;                                                       // Guards stopping, and one write at a time
+        std::condition_variable stopped;
+        std::thread worker;
+};
+
+#if CLIENT_METRICS
+inline void Metrics::setRequest(uint16_t op) {
+    currentOp = op;
+}
+
+inline void Metrics::requestSent() {
+    sentAt = Clock::now();
+    awaitingFirstByte = true;
+}
+
+inline bool Metrics::firstByte() {
+    if (!awaitingFirstByte)     return false;
+    awaitingFirstByte = false;
+    record(Stage::FIRST_BYTE, currentOp, Clock::now() - sentAt);
+    return true;
+}
+#else
+inline void Metrics::setRequest(uint16_t) {}
+inline void Metrics::count(Counter, uint64_t) {}
+inline void Metrics::record(Stage, uint16_t, Clock::duration) {}
+inline void Metrics::requestSent() {}
+inline bool Metrics::firstByte() { return false; }
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+#include "ProtocolManager.h"
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <deque>
+
+#define PIPELINE_DEPTH 16                                                       // Default amount of requests waiting for a response at once
+
+class Client;
+class ClientData;
+
+/* The response of a pipelined request */
+struct PipelineResult {
+    RequestOp request;                                                          // The request this responds to
+    ResponseHeader header;                                                      // Response header
+    std::vector<unsigned char> payload;                                         // Response payload
+};
+
+/* Sends many requests over the client connection without waiting for each response before sending the next one.
+    A writer and a reader coroutine run on the client io_context, up to maxInFlight requests wait for a response at once.
+    The server answers a connection in order, so responses are matched to the requests by their order.
+    Public keys that arrive (602) are stored in the member list right away.
+
+    Pipeline pipeline(&client);
+    for (ClientData& member : client.getMembers())  pipeline.requestPublicKey(member);
+    std::vector<PipelineResult> results = pipeline.run();
+*/
+class Pipeline {
+    public:
+        Pipeline(Client* client, size_t maxInFlight = PIPELINE_DEPTH);
+
+        void registerUser(const std::string& name, const std::string& publicKey);                               // Queues a sign up (600), does not need a signed in user
+        void requestPublicKey(const ClientData& member);                                                        // Queues a public key request (602)
+        void sendText(ClientData& member, const std::string& text);                                             // Deflates (if worth it), encrypts and queues a text message (603, type 3)
+        void sendMessage(const Uuid& target, MessageType type, std::string content,
+                         bool compressed = false);                                                              // Queues a message with ready content (603), compressed flags deflated content
+        size_t size() const;                                                                                    // Amount of queued requests
+
+        std::vector<PipelineResult> run();                                                                      // Sends the queued requests, returns the responses in request order
+
+    private:
+        ProtocolManager& newRequest(RequestOp op, const Uuid& clientID);                    // Queues a new request with the header set
+        ProtocolManager& newRequest(RequestOp op);                              // Queues a new request from the signed in user
+        boost::asio::awaitable<void> writer();                                  // Writes the requests while there is room in flight
+        boost::asio::awaitable<void> reader();                                  // Reads the responses in order
+
+        Client* client;                                                         // The connection and user the requests are sent with
+        size_t maxInFlight;                                                     // Max requests waiting for a response
+        std::deque<ProtocolManager> requests;                                   // Queued requests, each owns the buffers of its frame
+        std::vector<RequestOp> ops;                                             // Op of every queued request
+        std::vector<PipelineResult> results;                                    // Responses received
+        size_t written = 0;                                                     // Requests written to the socket
+        boost::asio::steady_timer slotFreed;                                    // Wakes the writer when a response arrived
+};
+
+#endif
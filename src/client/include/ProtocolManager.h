@@ -1,6 +1,8 @@
 #ifndef PROTOCOL_MANAGER_H
 #define PROTOCOL_MANAGER_H
 #include "User.h"
+#include "FramedAES.h"
+#include "WireCodec.h"
 #include <cstdint>
 #include <iostream>
 #include <vector>
@@ -9,18 +11,32 @@
 #include <array>
 #include <cstring>
 #include <optional>
+#include <fstream>
+#include <functional>
+#include <span>
+#include <string_view>
+#include <boost/asio/buffer.hpp>
 
 #define MAX_BUFFER 4096
+#define PAGE_MAX_MESSAGES 256                                                   // Max messages in a page of waiting messages (606)
+#define PAGE_MAX_BYTES (4 * 1024 * 1024)                                        // Max bytes in a page of waiting messages (at least one message is always sent)
+#define STREAM_BLOCK_SIZE 65536                                                 // Files are read, encrypted and sent in blocks of this size, also the receive window
+#define FILE_DECRYPT_BLOCK (8 * 1024 * 1024)                                    // Received files are decrypted in blocks of this size (split across threads)
 
 class Client;
+class ClientData;
+class MessageReader;
+struct MessageRecord;
 
 /* Message type deffinitions */
 enum class MessageType : uint8_t {
     REQ_SYMMETRIC_KEY = 1,
     SEND_SYMMETRIC_KEY = 2,
     SEND_TEXT_MSG = 3,
-    SEND_FILE = 4
+    SEND_FILE = 4,
+    SEND_FILE_FRAMED = 5                                                        // File in independently encrypted AES-GCM frames (FramedAES)
 };
+#define MESSAGE_COMPRESSED 0x80                                                 // Set in the message type when the content was deflated before encryption (Compression.h)
 
 /* Request definitions */
 enum class RequestOp : uint16_t {
@@ -28,7 +44,11 @@ enum class RequestOp : uint16_t {
     REQ_USER_LIST = 601,
     REQ_PUBLIC_KEY = 602,
     REQ_SEND_MSG_TO_USR = 603,
-    REQ_AWAITING_MESSAGES = 604
+    REQ_AWAITING_MESSAGES = 604,
+    REQ_SEND_BATCH = 605,
+    REQ_AWAITING_MESSAGES_PAGE = 606,
+    REQ_SUBSCRIBE = 607,
+    REQ_USER_LIST_SINCE = 608
 };
 
 /* Response status definitions */
@@ -38,17 +58,29 @@ enum class ResponseOp : uint16_t {
     RESP_PUBLIC_KEY = 2102,
     RESP_MSG_SENT_TO_USER = 2103,
     RESP_AWAITING_MESSAGES = 2104,    
+    RESP_BATCH_SENT = 2105,
+    RESP_AWAITING_MESSAGES_PAGE = 2106,
+    RESP_SUBSCRIBED = 2107,
+    RESP_PUSHED_MESSAGES = 2108,
+    RESP_USER_LIST_SINCE = 2109,
     RESP_GENERAL_ERROR = 9000
 };
 
 /* A request header */
 struct RequestHeader {
-    std::array<uint8_t, 16> clientID; 
+    Uuid clientID; 
     uint8_t version;                  
     uint16_t requestOp;             
     uint32_t payloadSize;               
 };
 
+/* A single message of a batch (605). Content is sent as is, it should already be encrypted. */
+struct BatchEntry {
+    Uuid target;
+    MessageType type;
+    std::string content;
+};
+
 /* A response header */
 /* Pragma so that it will be true value */
 #pragma pack(1)
@@ -61,26 +93,59 @@ struct ResponseHeader {
 
 class ProtocolManager{
     public: 
+        /* Gets every received message instead of std::cout: the sender, the type (without MESSAGE_COMPRESSED) and what would be printed */
+        using MessageHandler = std::function<void(const ClientData& from, MessageType type, std::string_view content)>;
+
         ProtocolManager() = default;                                                                            // A defualt constructor so that we can initiate without values
         
         
-        void setRequestHeader(std::array<uint8_t,16> clientID, uint8_t version, uint16_t requestOp);            // Sets a new Request header 
-        void setMessageHeader(std::array<uint8_t, 16> target_uuid, uint8_t msg_type, uint32_t content_size);    // Sets a new Message header
+        void setRequestHeader(const Uuid& clientID, uint8_t version, uint16_t requestOp);                       // Sets a new Request header 
+        void setMessageHeader(const Uuid& target_uuid, uint8_t msg_type, uint32_t content_size);                // Sets a new Message header
         void setPayloadSize(uint32_t payloadSize);                                                              // Sets the payload size value
+        void setPayload(const unsigned char* data, size_t size);                                                // Sets the payload to a copy of data
+        void setContent(std::string newContent);                                                                // Sets the message content (sent from its own buffer)
+        void setBatch(const Uuid& clientID, const std::vector<BatchEntry>& entries);          // Sets a batch request (605), entries must outlive the send
+        void setRegister(const std::string& username, const std::string& publicKey);                           // Sets the payload of a sign up (600), after its header
         
         RequestHeader getRequestHeader() const;                                                                 // Returns the request header
         ResponseHeader getResponseHeader() const;                                                               // Returns the response header
+        const std::vector<unsigned char>& getPayload() const;                                                   // Returns the payload (without the content)
+        const std::vector<uint32_t>& getMessageIDs() const;                                                     // Returns the message IDs of the last batch response
 
-        std::vector<std::vector<unsigned char>> createMessage();                                                // Creates messages or parses responses from server according to data
+        const std::vector<boost::asio::const_buffer>& createMessage();                                          // Creates a gathered buffer sequence (header, payload, content) without copying
 
         void messageHandler(int choice,Client* client);                                                         // Controls the messages sent
+        void streamContent(Client* client);                                                                     // Encrypts and sends a pending file block by block (after createMessage)
         void responseHandler(Client* client);                                                                   // Controls the responses received
-        void printResponseHeader();                                                                             // Prints the response header (mainly for debugging)
+        bool nextPage(Client* client);                                                                          // Sets the request for the next page of waiting messages, if there is one
+        void receivePushed(Client* client, const ResponseHeader& header);                                       // Handles a frame the server pushed to us (2108), after its header was read
+        void logResponseHeader();                                                                               // Logs the response header (debug level, raw bytes at trace)
+        void setMessageHandler(MessageHandler handler);                                                         // Received messages go to handler instead of std::cout
+
+        static uint64_t parseMemberSync(std::span<const unsigned char> payload, uint8_t version,
+                                        std::vector<std::pair<Uuid, std::string>>& changed);                    // Parses a member list sync (2109), returns its version
 
     private:
+        void handleMessage(Client* client, const MessageRecord& record, MessageReader& reader);                // Handles one message of the awaiting messages list
+        void handleMessages(Client* client, uint32_t size);                                                     // Handles a list of waiting messages as it arrives
+        void setPageRequest(Client* client);                                                                    // Sets a request for a page of the oldest waiting messages
+        void streamFrames(Client* client);                                                                      // Encrypts and sends a pending file as GCM frames, many frames at once
+        void openFile(Client* client, ClientData& target, MessageType type);                                    // Opens the file to send (153 / 154) and sets the headers
+        void closeFile();                                                                                       // Closes the file sent, removes its deflated copy
+
         RequestHeader requestHeader;                                            // Request header
         ResponseHeader responseHeader;                                          // Response header
-        std::vector<unsigned char> payload;                                     // Holds the payload data
+        std::vector<unsigned char> payload;                                     // Holds the payload data, of requests and responses (keeps its capacity)
+        std::string content;                                                    // Holds the message content (ciphertext), never copied into payload
+        std::optional<std::ifstream> fileStream;                                // File waiting to be streamed after the headers (153)
+        std::optional<AESWrapper> streamCipher;                                 // Symmetric key of the file target
+        std::optional<FramedAES> frameCipher;                                   // Frames of the file target (154), instead of streamCipher
+        std::optional<std::string> compressedFile;                              // Temporary deflated copy of the file, removed once it was sent
+        std::vector<boost::asio::const_buffer> batchContents;                   // Contents of a batch, referenced in place
+        std::vector<boost::asio::const_buffer> message;                         // Buffers of the last createMessage, reused
+        std::vector<uint32_t> messageIDs;                                       // Message IDs received for a batch
+        MessageHandler onMessage;                                               // Gets the received messages, if set
+        bool morePages = false;                                                 // Did the server say more messages are waiting?
         
 };
 
@@ -41,6 +41,7 @@ class RSAPublicWrapper{
 	private:
 		CryptoPP::AutoSeededRandomPool _rng;
 		CryptoPP::RSA::PublicKey _publicKey;
+		CryptoPP::RSAES_OAEP_SHA_Encryptor _encryptor;								// OAEP encryptor over _publicKey, made once per key
 
 };
 
@@ -50,6 +51,7 @@ class RSAPrivateWrapper{
 		static const unsigned int BITS = 1024;
 		RSAPrivateWrapper();														// Generates a new RSA key pair (both private and public keys)
 		RSAPrivateWrapper(const std::string& key);									// Loads an existing private key
+		RSAPrivateWrapper(const CryptoPP::RSA::PrivateKey& key);					// Uses a generated private key (from the KeyPool)
 		std::string getPrivateKey() const;											// Returns the private key as a string (should be encoded in Base64 before storing)
 		std::string getPublicKey() const;											// Extracts the public key from the private key
 		std::string decrypt(std::string cipher) const;								// Decrypts a message encrypted with the corresponding public key
@@ -61,6 +63,7 @@ class RSAPrivateWrapper{
 		mutable CryptoPP::AutoSeededRandomPool _rng;								// Mutable so it can be changed in constant values. 
 																					//Needs to be mutable since the entire chain client -> getUser() getDecryptor() decrypt() is const.
 		CryptoPP::RSA::PrivateKey _privateKey;
+		CryptoPP::RSAES_OAEP_SHA_Decryptor _decryptor;								// OAEP decryptor over _privateKey (CRT), made once per key
 
 };
 
@@ -0,0 +1,82 @@
+#ifndef SESSION_MANAGER_H
+#define SESSION_MANAGER_H
+#include "ProtocolManager.h"
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define SESSION_IDENTITY_EXTENSION ".info"                                      // Identity files of a directory (me.info format, as provisionUsers writes them)
+#define SESSION_KEY_CACHE_EXTENSION ".keys"                                     // Public key cache of an identity, next to its identity file
+
+class ClientData;
+
+/* Runs many signed up users in one process. Every identity is a Client of its own, with its own connection, member list,
+    public keys and symmetric keys, but all of them run on one io_context and its pool of threads.
+    A session connects, syncs its member list (608), subscribes (607) and then handles what the server pushes to it.
+    The work of a session runs on its strand, so its Client is only used by one thread at a time while the sessions run in parallel.
+    Texts to a member are sent after the keys they need: the public key is requested (602) and a symmetric key is sent (type 2) first,
+    and a member that asks us for a symmetric key (type 1) gets one the same way.
+    Once a pushed frame started it is read to its end on the thread of its session (like Client::listen).
+
+    SessionManager sessions("127.0.0.1", 1234);
+    sessions.loadIdentities("users");                                      // users/alice.info, users/bob.info ...
+    sessions.setMessageHandler([](const std::string& identity, const ClientData& from, MessageType type, std::string_view content){ ... });
+    sessions.start();
+    sessions.sendText("alice", "bob", "Hello");                             // From any thread
+*/
+class SessionManager {
+    public:
+        /* Gets the messages received by every identity, called on the threads of the pool (many at once) */
+        using MessageHandler = std::function<void(const std::string& identity, const ClientData& from, MessageType type, std::string_view content)>;
+
+        SessionManager(const std::string& server_ip, int server_port, size_t threads = 0);                     // 0 threads is one per core
+        ~SessionManager();                                                                                      // Stops the sessions
+        SessionManager(const SessionManager&) = delete;
+        SessionManager& operator=(const SessionManager&) = delete;
+
+        size_t loadIdentities(const std::string& directory);                                                    // Adds a session per identity file (before start), returns how many
+        void setMessageHandler(MessageHandler handler);                                                         // Before start, the messages are printed otherwise
+        void start();                                                                                           // Connects every session and starts the threads
+        void sendText(const std::string& identity, const std::string& member, std::string text);               // Queues a text from an identity to a member of its list
+        void stop();                                                                                            // Closes every session and joins the threads
+
+        size_t size() const;                                                                                    // Sessions loaded
+        size_t connected() const;                                                                               // Sessions connected now
+        size_t subscribed() const;                                                                              // Sessions the server pushes to now
+
+    private:
+        struct Session;
+
+        boost::asio::awaitable<void> run(Session& session, boost::asio::ip::tcp::resolver::results_type endpoints); // Connects, sets the session up and reads its responses
+        boost::asio::awaitable<void> writer(Session& session);                                                  // Writes the queued requests of a session
+        void handleResponse(Session& session, RequestOp request, const Uuid& target, const ResponseHeader& header,
+                            std::span<const unsigned char> payload);                                            // Handles the response to a request of a session
+        void received(Session& session, const ClientData& from, MessageType type, std::string_view content);    // A message pushed to a session
+        void close(Session& session);                                                                           // Closes the connection of a session (on its strand)
+
+        boost::asio::io_context io_context;                                     // Shared by every session, declared first so it outlives them
+        boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;  // Keeps the threads running while sessions are idle
+        std::vector<std::unique_ptr<Session>> sessions;
+        std::unordered_map<std::string, Session*> sessionsByName;               // Sessions by the name of their identity
+        MessageHandler onMessage;                                               // Gets the received messages, if set
+        std::mutex printing;                                                    // Keeps the printed messages of sessions apart
+        std::atomic<size_t> connectedSessions{0};
+        std::atomic<size_t> subscribedSessions{0};
+        std::string server_ip;                                                  // Server IP
+        int server_port;                                                        // Server PORT
+        size_t threadCount;                                                     // Threads the pool runs on
+        std::vector<std::thread> threads;                                       // The pool, empty until start
+};
+
+#endif
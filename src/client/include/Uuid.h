@@ -0,0 +1,81 @@
+#ifndef UUID_H
+#define UUID_H
+#include "Hex.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/* The UUID of a user, 16 bytes as the server sends them. It is kept binary everywhere (headers, member list, key cache)
+    and only turned to hex where people or files read it: printing, me.info and publickeys.bin.
+
+    Uuid id = Uuid::fromBytes(payload.data());                             // From the wire
+    std::optional<Uuid> id = Uuid::fromHex(line);                          // From a file, nullopt if it is not 32 hex digits
+    std::cout << id.hex();
+*/
+class Uuid {
+    public:
+        static constexpr size_t SIZE = 16;
+        static constexpr size_t HEX_SIZE = SIZE * 2;
+
+        constexpr Uuid() = default;                                             // The nil UUID (all zero, a guest before sign up)
+        constexpr explicit Uuid(const std::array<uint8_t, SIZE>& bytes) : value(bytes) {}
+
+        /* The SIZE bytes at data */
+        static constexpr Uuid fromBytes(const unsigned char* data) {
+            Uuid uuid;
+            for (size_t i = 0; i < SIZE; i++)   uuid.value[i] = data[i];
+            return uuid;
+        }
+
+        static constexpr std::optional<Uuid> fromHex(std::string_view text) {
+            Uuid uuid;
+            if (text.size() != HEX_SIZE || !Hex::decode(text.data(), text.size(), uuid.value.data()))   return std::nullopt;
+            return uuid;
+        }
+
+        /* The 32 hex digits, without a string */
+        constexpr std::array<char, HEX_SIZE> hexDigits() const {
+            std::array<char, HEX_SIZE> digits{};
+            Hex::encode(value.data(), SIZE, digits.data());
+            return digits;
+        }
+
+        std::string hex() const {
+            std::array<char, HEX_SIZE> digits = hexDigits();
+            return std::string(digits.data(), digits.size());
+        }
+
+        constexpr const std::array<uint8_t, SIZE>& bytes() const { return value; }
+        constexpr const uint8_t* data() const { return value.data(); }
+        uint8_t* data() { return value.data(); }
+        constexpr size_t size() const { return SIZE; }
+        constexpr auto begin() const { return value.begin(); }
+        constexpr auto end() const { return value.end(); }
+        constexpr bool isNil() const { return *this == Uuid(); }
+
+        friend constexpr bool operator==(const Uuid&, const Uuid&) = default;
+
+    private:
+        std::array<uint8_t, SIZE> value{};
+};
+
+/* It is copied into request headers and read from the wire as raw bytes */
+static_assert(sizeof(Uuid) == Uuid::SIZE && alignof(Uuid) == 1 && std::is_trivially_copyable_v<Uuid>);
+
+/* UUIDs are random, so folding the two halves is enough */
+template <>
+struct std::hash<Uuid> {
+    size_t operator()(const Uuid& uuid) const noexcept {
+        uint64_t low, high;
+        std::memcpy(&low, uuid.data(), sizeof(low));
+        std::memcpy(&high, uuid.data() + sizeof(low), sizeof(high));
+        return static_cast<size_t>(low ^ (high * 0x9E3779B97F4A7C15ull));
+    }
+};
+
+#endif
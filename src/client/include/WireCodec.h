@@ -0,0 +1,208 @@
+#ifndef WIRE_CODEC_H
+#define WIRE_CODEC_H
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include "Uuid.h"
+
+#define PROTOCOL_VERSION_FIXED 2                                                // Fixed size fields, names padded to 255 bytes
+#define PROTOCOL_VERSION_COMPACT 3                                              // Varint sizes and IDs, length prefixed names
+#define PROTOCOL_VERSION PROTOCOL_VERSION_COMPACT                               // Version we send, the server answers in the version of the request
+
+#define WIRE_NAME_SIZE 255                                                      // Size of a padded name (version 2), longest name (version 3)
+#define WIRE_MAX_VARINT32 5                                                     // Longest varint of a 32 bit value
+#define WIRE_MAX_VARINT64 10                                                    // Longest varint of a 64 bit value
+#define WIRE_MAX_MESSAGE_HEADER (16 + 1 + WIRE_MAX_VARINT32)                    // Longest message header (UUID, type, content size) in any version
+#define WIRE_MAX_RECORD_HEADER (16 + WIRE_MAX_VARINT32 + 1 + WIRE_MAX_VARINT32) // Longest message record header (UUID, ID, type, size)
+
+/* WIRE FORMAT OF THE PAYLOADS
+    The request / response headers are the same in every version, their version byte tells how the payload is encoded.
+    Sizes, counts and IDs are 4 (or 8) bytes little endian in version 2, and LEB128 varints in version 3 (7 bits per byte,
+    the high bit says another byte follows). Names are padded to 255 bytes in version 2, and a varint length and the name in version 3.
+
+        Field               Version 2                   Version 3
+        Username (600)      255 bytes, '0' padded       length + name
+        Message header      UUID, type, size (4)        UUID, type, size (varint)
+        Message record      UUID, ID (4), type, size (4)    UUID, ID, type, size (varints)
+
+    The writer and reader work on a buffer of the caller and never allocate:
+
+    WireWriter writer(buffer, version);
+    writer.uuid(target);    writer.u8(type);    writer.u32(size);
+    send(buffer, writer.size());
+
+    WireReader reader(payload, version);
+    reader.uuid(record.fromID);     record.msgID = reader.u32();    ...
+*/
+
+/* Writes payload fields in the encoding of a protocol version into a buffer big enough for them */
+class WireWriter {
+    public:
+        WireWriter(unsigned char* out, uint8_t version) : out(out), version(version) {}
+
+        void bytes(const void* data, size_t size){
+            std::memcpy(out + position, data, size);
+            position += size;
+        }
+
+        void u8(uint8_t value){
+            out[position++] = value;
+        }
+
+        void uuid(const Uuid& value){
+            bytes(value.data(), value.size());
+        }
+
+        /* 4 bytes little endian (version 2) or a varint (version 3) */
+        void u32(uint32_t value){
+            if (version < PROTOCOL_VERSION_COMPACT)  fixed(value, sizeof(value));
+            else                                    varint(value);
+        }
+
+        /* 8 bytes little endian (version 2) or a varint (version 3) */
+        void u64(uint64_t value){
+            if (version < PROTOCOL_VERSION_COMPACT)  fixed(value, sizeof(value));
+            else                                    varint(value);
+        }
+
+        /* A name padded with pad to 255 bytes (version 2) or its length and the name (version 3) */
+        void name(std::string_view value, char pad){
+            if (value.size() > WIRE_NAME_SIZE)  throw std::length_error("Name is longer than 255 bytes");
+            if (version >= PROTOCOL_VERSION_COMPACT)     varint(value.size());
+            bytes(value.data(), value.size());
+            if (version < PROTOCOL_VERSION_COMPACT) {
+                std::memset(out + position, pad, WIRE_NAME_SIZE - value.size());
+                position = position + WIRE_NAME_SIZE - value.size();
+            }
+        }
+
+        /* Bytes written so far */
+        size_t size() const{
+            return position;
+        }
+
+        /* Bytes a name takes in a version */
+        static size_t nameSize(size_t length, uint8_t version){
+            return version < PROTOCOL_VERSION_COMPACT ? WIRE_NAME_SIZE : varintSize(length) + length;
+        }
+
+        /* Bytes a varint of value takes */
+        static size_t varintSize(uint64_t value){
+            size_t size = 1;
+            while (value >= 0x80) {
+                value >>= 7;
+                size++;
+            }
+            return size;
+        }
+
+    private:
+        void fixed(uint64_t value, size_t size){
+            for (size_t i = 0; i < size; i++, value >>= 8)
+                out[position++] = static_cast<unsigned char>(value);
+        }
+
+        void varint(uint64_t value){
+            while (value >= 0x80) {
+                out[position++] = static_cast<unsigned char>(value | 0x80);
+                value >>= 7;
+            }
+            out[position++] = static_cast<unsigned char>(value);
+        }
+
+        unsigned char* out;                                                     // Buffer of the caller
+        size_t position = 0;                                                    // Next byte to write
+        uint8_t version;                                                        // Encoding
+};
+
+/* Reads payload fields in the encoding of a protocol version. Throws if the payload ends in the middle of a field. */
+class WireReader {
+    public:
+        WireReader(std::span<const unsigned char> in, uint8_t version) : in(in), version(version) {}
+
+        void bytes(void* out, size_t size){
+            need(size);
+            std::memcpy(out, in.data() + position, size);
+            position += size;
+        }
+
+        uint8_t u8(){
+            need(1);
+            return in[position++];
+        }
+
+        void uuid(Uuid& value){
+            bytes(value.data(), value.size());
+        }
+
+        uint32_t u32(){
+            uint64_t value = version < PROTOCOL_VERSION_COMPACT ? fixed(sizeof(uint32_t)) : varint(WIRE_MAX_VARINT32);
+            if (value > UINT32_MAX)     throw std::runtime_error("Invalid payload field");
+            return static_cast<uint32_t>(value);
+        }
+
+        uint64_t u64(){
+            return version < PROTOCOL_VERSION_COMPACT ? fixed(sizeof(uint64_t)) : varint(WIRE_MAX_VARINT64);
+        }
+
+        /* The next size bytes, the view points into the payload */
+        std::string_view view(size_t size){
+            need(size);
+            std::string_view value(reinterpret_cast<const char*>(in.data() + position), size);
+            position += size;
+            return value;
+        }
+
+        /* A name, without the padding (version 2) or the length (version 3). The view points into the payload. */
+        std::string_view name(char pad){
+            size_t length = version < PROTOCOL_VERSION_COMPACT ? WIRE_NAME_SIZE : static_cast<size_t>(varint(WIRE_MAX_VARINT32));
+            std::string_view value = view(length);
+            if (version < PROTOCOL_VERSION_COMPACT) {
+                size_t end = value.find_last_not_of(pad);
+                value = value.substr(0, end == std::string_view::npos ? 0 : end + 1);
+            }
+            return value;
+        }
+
+        /* Bytes read so far */
+        size_t size() const{
+            return position;
+        }
+
+        /* Bytes not read yet */
+        size_t remaining() const{
+            return in.size() - position;
+        }
+
+    private:
+        void need(size_t size) const{
+            if (in.size() - position < size)    throw std::runtime_error("Incomplete payload");
+        }
+
+        uint64_t fixed(size_t size){
+            need(size);
+            uint64_t value = 0;
+            for (size_t i = 0; i < size; i++)
+                value |= static_cast<uint64_t>(in[position++]) << (8 * i);
+            return value;
+        }
+
+        uint64_t varint(size_t maxSize){
+            uint64_t value = 0;
+            for (size_t i = 0; i < maxSize; i++) {
+                uint8_t byte = u8();
+                value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+                if (!(byte & 0x80))     return value;
+            }
+            throw std::runtime_error("Invalid payload field");
+        }
+
+        std::span<const unsigned char> in;                                      // Payload
+        size_t position = 0;                                                    // Next byte to read
+        uint8_t version;                                                        // Encoding
+};
+
+#endif
@@ -1,9 +1,23 @@
 #include "../../include/Client.h"
+#include "../../include/Pipeline.h"
+#include "../../include/Metrics.h"
+#include "../../include/Logger.h"
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <deque>
+#include <filesystem>
 
 
 /* Guest mode user (Until sign up)*/
 Client::Client(const std::string& server_ip, int server_port)
-    : socket(io_context), server_ip(server_ip), server_port(server_port)  {}
+    : ownContext(std::make_unique<boost::asio::io_context>()), io_context(*ownContext), socket(io_context),
+      keyCache(PUBLIC_KEY_CACHE), knownKeys(readPublicKeys(keyCache)), server_ip(server_ip), server_port(server_port)  {}
+
+/* A connection that runs on a context shared with other clients (SessionManager), the context must outlive it.
+    Every identity keeps the public keys it received in its own cache file. */
+Client::Client(boost::asio::io_context& context, const std::string& server_ip, int server_port, const std::string& keyCache)
+    : io_context(context), socket(io_context), keyCache(keyCache), knownKeys(readPublicKeys(keyCache)), server_ip(server_ip), server_port(server_port)  {}
 
 /* Sets a new user according to an existing file information */
 void Client::setUser(const std::string& name, const std::string& UUID, const std::string& key){
@@ -21,7 +35,7 @@ const std::optional<User>& Client::getUser() const {
 }
 
 /* Sets a users UUID (After registering) */
-void Client::setUserUUID(const std::array<uint8_t, 16>& newUUID){
+void Client::setUserUUID(const Uuid& newUUID){
     user.value().setUUID(newUUID);
 }
 
@@ -31,7 +45,7 @@ void Client::clearUser(){
 }
 
 /* Returns the members in member list received from server */
-std::vector<ClientData>& Client::getMembers() {
+std::deque<ClientData>& Client::getMembers() {
     return members;
 }
 
@@ -42,33 +56,90 @@ ClientData& Client::getMember() {
             
     /* We prompt user for target username from client, and check if it exists in the list. */
     std::string member = receiveUsername();
-    auto it = std::find_if(members.begin(), members.end(),
-                [&](const ClientData& data) { return data.getUsername() == member; });
+    auto it = membersByName.find(member);
 
     /* If no such user exists, we throw an error */
-    if (it == members.end()) 
+    if (it == membersByName.end()) 
         throw std::runtime_error(YELLOW  "No such user! Please choose again or refresh the list (Request again)."  RESET);
     
-
-    return *it;
-            
+    return members[it -> second];
 }
 
-/* Finds a certain user in member list according to UUID */
-ClientData& Client::findUser(std::string& useruid) {
-    auto it = std::find_if(members.begin(), members.end(),
-        [&](const ClientData& data) { 
-            return data.getUUIDString() == useruid;  
-        });
-    if (it == members.end()) 
+/* Finds a certain user in member list according to his UUID */
+ClientData& Client::findUser(const Uuid& uuid) {
+    auto it = membersByUUID.find(uuid);
+    if (it == membersByUUID.end()) 
         throw std::runtime_error(RED  "User not found"  RESET);  
     
-    return *it; 
+    return members[it -> second]; 
+}
+
+/* Finds a member in the member list by his username, without asking the user */
+ClientData* Client::findMember(const std::string& username) {
+    auto it = membersByName.find(username);
+    return it == membersByName.end() ? nullptr : &members[it -> second];
+}
+
+/* Empties the member list and its indexes, and makes room in the indexes for the expected amount of members */
+void Client::clearMembers(size_t expected){
+    members.clear();
+    membersByUUID.clear();
+    membersByName.clear();
+    membersByUUID.reserve(expected);
+    membersByName.reserve(expected);
 }
 
-/* Inserts a member to the member list */
-void Client::setMembers(const std::string& uuid, const std::string& username){
-    members.emplace_back(uuid, username); 
+/* Inserts a member to the member list. If we already have his public key from an earlier run, it is set right away (no 130 needed). */
+void Client::setMembers(const Uuid& uuid, const std::string& username){
+    size_t index = members.size();
+    ClientData& member = members.emplace_back(uuid, username); 
+    membersByUUID[uuid] = index;
+    membersByName[username] = index;
+
+    auto known = knownKeys.find(uuid);
+    if (known != knownKeys.end())
+        member.setPublic(known -> second);
+}
+
+/* Merges a member from a member list sync. A known UUID only gets his new username, so his keys stay.
+    Names are unique on the server, so a member still holding the name was renamed as well (his change may come later
+    in the sync): the name is indexed to this member, and a rename only erases the name entry that is still his own.
+    Returns true if the member is new. */
+bool Client::mergeMember(const Uuid& uuid, const std::string& username){
+    auto known = membersByUUID.find(uuid);
+    if (known == membersByUUID.end()){
+        setMembers(uuid, username);
+        return true;
+    }
+
+    ClientData& member = members[known -> second];
+    if (member.getUsername() != username){
+        auto old = membersByName.find(member.getUsername());
+        if (old != membersByName.end() && old -> second == known -> second)
+            membersByName.erase(old);
+        membersByName[username] = known -> second;
+        member.setUsername(username);
+    }
+    return false;
+}
+
+/* Returns the member list version we are synced to */
+uint64_t Client::getMemberVersion() const {
+    return memberVersion;
+}
+
+/* Sets the member list version after a sync */
+void Client::setMemberVersion(uint64_t version){
+    memberVersion = version;
+}
+
+/* Sets the public key of a member, and saves it to the cache file if it is new or changed */
+void Client::cachePublicKey(ClientData& member, const std::string& key){
+    member.setPublic(key);
+    std::string& known = knownKeys[member.getUUID()];
+    if (known == key) return;
+    known = key;
+    appendPublicKey(keyCache, member.getUUID().hex(), key);
 }
 
 /* Checks if server is connected */
@@ -78,43 +149,160 @@ bool Client::isConnected() {
 
 /* Connects to the server */
 void Client::connectToServer() {
+    Metrics::Span span(Metrics::Stage::CONNECT, 0);
     boost::asio::ip::tcp::resolver resolver(io_context);
     boost::asio::ip::tcp::resolver::results_type endpoints = resolver.resolve(server_ip, std::to_string(server_port));
 
     boost::asio::connect(socket, endpoints);
+    span.stop();
     std::cout << RED  "[CONNECTED] "  RESET "to " << server_ip << ":" << server_port << std::endl; 
 }
 
-/* Sends a message to the server */
-void Client::sendMessage(const std::vector<std::vector<unsigned char>>& messages) {
-    for (const auto& message : messages)    
-        boost::asio::write(socket, boost::asio::buffer(message.data(), message.size()));
+/* Sends a message to the server. The buffers are gathered into one write (writev / WSASend), 
+    asio only issues another call if the kernel accepted a partial write. */
+void Client::sendMessage(const std::vector<boost::asio::const_buffer>& message) {
+    Metrics::Span span(Metrics::Stage::SEND);
+    size_t size = boost::asio::write(socket, message);
+    Metrics::count(Metrics::Counter::BYTES_SENT, size);
+    Metrics::requestSent();
 }
 
-/* Receives a message from the server */
-std::vector<unsigned char> Client::receiveMessage(size_t size) {
-    /* Create a buffer of size size*/
-    std::vector<unsigned char> buffer(size);
+/* Receives a message of size bytes from the server into data (a buffer of the caller, reused between responses) */
+void Client::receiveMessage(unsigned char* data, size_t size) {
     size_t total_bytes_read = 0;
 
     /* Set the total bytes read to check */
     /* As long as we dont receive the bytes of amount size, we keep going.
         If we don't read anything, we return a runtime error since the connection probably disconnected. */
+    Metrics::Span receive(Metrics::Stage::RECEIVE);
     while (total_bytes_read < size) {
         
-        size_t bytes_read = socket.read_some(boost::asio::buffer(buffer.data() + total_bytes_read, size - total_bytes_read));
+        size_t bytes_read = socket.read_some(boost::asio::buffer(data + total_bytes_read, size - total_bytes_read));
 
         if (bytes_read == 0) 
             throw std::runtime_error(RED "Server disconnected. Exiting client." RESET);
+        /* The wait for the server to answer is its own stage */
+        if (total_bytes_read == 0 && Metrics::firstByte())    receive.restart();
         total_bytes_read += bytes_read;
     }
+    receive.stop();
+    Metrics::count(Metrics::Counter::BYTES_RECEIVED, total_bytes_read);
+
+    /* The size is logged at debug level, with the first bytes in hex at trace level (never formatted below it) */
+    Logger& log = Logger::shared();
+    if (log.enabled(LogLevel::TRACE))       log.hexDump(LogLevel::TRACE, "[RECEIVED]", data, total_bytes_read);
+    else if (log.enabled(LogLevel::DEBUG))  log.write(LogLevel::DEBUG, "[RECEIVED] " + std::to_string(total_bytes_read) + " bytes");
+}
+
+/* Receives at least one and up to size bytes, without printing them (used for streamed payloads) */
+size_t Client::receiveSome(unsigned char* data, size_t size) {
+    Metrics::Span receive(Metrics::Stage::RECEIVE);
+    size_t bytes_read = socket.read_some(boost::asio::buffer(data, size));
+    if (bytes_read == 0) 
+        throw std::runtime_error(RED "Server disconnected. Exiting client." RESET);
+    if (Metrics::firstByte())   receive.restart();
+    Metrics::count(Metrics::Counter::BYTES_RECEIVED, bytes_read);
+    return bytes_read;
+}
+
+/* Returns the io_context the connection runs on */
+boost::asio::io_context& Client::getContext() {
+    return io_context;
+}
+
+/* Returns the buffer pool of the connection */
+FramePool& Client::getFramePool() {
+    return framePool;
+}
+
+/* Returns the connection socket */
+boost::asio::ip::tcp::socket& Client::getSocket() {
+    return socket;
+}
+
+/* Sends all the entries in a single request (605), the server stores them in one transaction.
+    Returns the message ID of every entry, in the same order. */
+std::vector<uint32_t> Client::sendBatch(const std::vector<BatchEntry>& entries) {
+    if (!user.has_value())  throw std::runtime_error(YELLOW "Please register first!" RESET);
+
+    protocolManager.setBatch(user.value().getUUID(), entries);
+    sendMessage(protocolManager.createMessage());
+    protocolManager.responseHandler(this);
+    return protocolManager.getMessageIDs();
+}
+
+/* Reads frames pushed by the server, each one is handled as soon as its header arrives.
+    Ends with operation_aborted when listen cancels the socket. */
+boost::asio::awaitable<void> Client::pushReader() {
+    ResponseHeader header;
+    while (true) {
+        co_await boost::asio::async_read(socket, boost::asio::buffer(&header, sizeof(ResponseHeader)), boost::asio::use_awaitable);
+        receivePushed(header);
+    }
+}
 
-    /* Let the user know how many bytes received, we have private functions for printing each part. */
-    std::cout << "\n" << RED << "[RECEIVED] " << total_bytes_read << " bytes of data: " << RESET << std::endl;
-    for (size_t i = 0; i < buffer.size(); i++)
-        std::cout << std::hex << std::setfill('0') << std::setw(2) << (int)buffer[i] << " ";
-    std::cout << std::dec << std::endl;
-    return buffer;
+/* Handles a pushed frame whose header was already read, the rest of the frame is read right here */
+void Client::receivePushed(const ResponseHeader& header) {
+    protocolManager.receivePushed(this, header);
+}
+
+/* Received messages go to handler instead of std::cout (an empty handler prints them again) */
+void Client::setMessageHandler(ProtocolManager::MessageHandler handler) {
+    protocolManager.setMessageHandler(std::move(handler));
+}
+
+/* Waits for pushed messages for duration, without polling the server. A frame that already started is always finished,
+    the socket is only cancelled while the reader waits for the next header. */
+void Client::listen(std::chrono::seconds duration) {
+    std::cout << YELLOW "Listening for " RESET << duration.count() << YELLOW " seconds..." RESET << std::endl;
+    boost::asio::co_spawn(io_context, pushReader(), [this](std::exception_ptr e) {
+        try {
+            if (e)  std::rethrow_exception(e);
+        } catch (const boost::system::system_error& error) {
+            if (error.code() != boost::asio::error::operation_aborted)
+                std::cerr << RED << error.what() << RESET << std::endl;
+        } catch (const std::exception& error) {
+            /* The frame was not read to its end, the stream position is lost */
+            std::cerr << error.what() << std::endl;
+            closeConnection();
+        }
+    });
+    io_context.restart();
+    io_context.run_for(duration);
+
+    /* Stop waiting for the next header, and let the reader end */
+    if (socket.is_open())   socket.cancel();
+    io_context.run();
+}
+
+/* Registers many users at once, for provisioning test accounts. Keys are taken from the pool, which keeps generating
+    on every core while a chunk of sign ups is pipelined to the server. Every registered user is saved to
+    directory/<name>.info in the me.info format. Returns the names that were registered (names in use are skipped). */
+std::vector<std::string> Client::provisionUsers(const std::vector<std::string>& names, const std::string& directory, KeyPool& pool) {
+    std::filesystem::create_directories(directory);
+    std::vector<std::string> registered;
+
+    for (size_t first = 0; first < names.size(); first += PROVISION_CHUNK) {
+        size_t count = std::min<size_t>(PROVISION_CHUNK, names.size() - first);
+        std::deque<RSAPrivateWrapper> keys;
+        Pipeline pipeline(this);
+        for (size_t i = 0; i < count; i++) {
+            keys.emplace_back(pool.take());
+            pipeline.registerUser(names[first + i], keys.back().getPublicKey());
+        }
+
+        std::vector<PipelineResult> results = pipeline.run();
+        for (size_t i = 0; i < count; i++) {
+            const std::string& name = names[first + i];
+            if (static_cast<ResponseOp>(results[i].header.responseOp) != ResponseOp::RESP_REGISTER_SUCCESSFULL || results[i].payload.size() != Uuid::SIZE) {
+                std::cerr << YELLOW "Could not register " RESET << name << std::endl;
+                continue;
+            }
+            writeUserInfo((std::filesystem::path(directory) / (name + ".info")).string(), name, Uuid::fromBytes(results[i].payload.data()), keys[i].getPrivateKey());
+            registered.push_back(name);
+        }
+    }
+    return registered;
 }
 
 /* Closes the connection */
@@ -132,9 +320,17 @@ void Client::clientService(){
     /* Attempting to handle building and sending the message */
     try {
         protocolManager.messageHandler(choice, this);
-        sendMessage(protocolManager.createMessage());
-        /* Process received response from server */
-        protocolManager.responseHandler(this);
+        /* Waiting messages come in pages, we keep asking as long as the server has more. */
+        do {
+            sendMessage(protocolManager.createMessage());
+            protocolManager.streamContent(this);
+            /* Process received response from server */
+            protocolManager.responseHandler(this);
+        } while (protocolManager.nextPage(this));
+
+        /* After subscribing we stay and receive the pushed messages for as long as the user asked */
+        if (protocolManager.getResponseHeader().responseOp == static_cast<uint16_t>(ResponseOp::RESP_SUBSCRIBED))
+            listen(std::chrono::seconds(receiveSeconds()));
         
     } catch (const std::exception & e){
         std::cerr << e.what() << std::endl;
@@ -0,0 +1,140 @@
+#include "../../include/Compression.h"
+#include <filters.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/* Input fed to the inflator at once, bounds the output produced past maxSize */
+constexpr size_t INFLATE_PIECE = 64 * 1024;
+
+/* Block read from the input of compressStream */
+constexpr size_t DEFLATE_BLOCK = 1024 * 1024;
+
+/*
+ * Shannon entropy of the bytes of data: 0 for a single repeated byte, 8 for uniformly random bytes.
+ */
+double Compression::entropy(const void* data, size_t size) {
+    if (size == 0)  return 0;
+    std::array<size_t, 256> counts{};
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)   counts[bytes[i]]++;
+
+    double bits = 0;
+    for (size_t count : counts) {
+        if (count == 0)     continue;
+        double p = static_cast<double>(count) / size;
+        bits -= p * std::log2(p);
+    }
+    return bits;
+}
+
+/*
+ * True if a content is long enough to gain from deflate, and its first SAMPLE_SIZE bytes do not look random.
+ */
+bool Compression::worthCompressing(const void* sample, size_t size) {
+    if (size < MIN_SIZE)    return false;
+    return entropy(sample, std::min(size, SAMPLE_SIZE)) <= MAX_ENTROPY;
+}
+
+std::string Compression::compress(const std::string& plain) {
+    std::string compressed;
+    CryptoPP::Deflator deflator(new CryptoPP::StringSink(compressed), LEVEL);
+    deflator.Put(reinterpret_cast<const CryptoPP::byte*>(plain.data()), plain.size());
+    deflator.MessageEnd();
+    return compressed;
+}
+
+/*
+ * Replaces content with its compressed form, unless it is not worth compressing or does not get smaller.
+ */
+bool Compression::compressInPlace(std::string& content) {
+    if (!worthCompressing(content.data(), content.size()))  return false;
+    std::string compressed = compress(content);
+    if (compressed.size() >= content.size())    return false;
+    content = std::move(compressed);
+    return true;
+}
+
+std::string Compression::decompress(const std::string& compressed, uint64_t maxSize) {
+    StreamDecompressor decompressor(maxSize);
+    std::string plain = decompressor.update(compressed.data(), compressed.size());
+    plain += decompressor.final();
+    return plain;
+}
+
+/*
+ * Deflates everything left in in to out, one block in memory at a time.
+ */
+uint64_t Compression::compressStream(std::istream& in, std::ostream& out) {
+    std::vector<char> block(DEFLATE_BLOCK);
+    StreamCompressor compressor;
+    uint64_t written = 0;
+    while (in) {
+        in.read(block.data(), block.size());
+        size_t bytesRead = static_cast<size_t>(in.gcount());
+        if (bytesRead == 0)     break;
+        const std::string& compressed = compressor.update(block.data(), bytesRead);
+        out.write(compressed.data(), compressed.size());
+        written += compressed.size();
+    }
+    if (in.bad())   throw std::runtime_error("Failed reading the content to compress");
+    const std::string& rest = compressor.final();
+    out.write(rest.data(), rest.size());
+    written += rest.size();
+    if (!out)   throw std::runtime_error("Failed writing the compressed content");
+    return written;
+}
+
+/*
+ * The deflator writes into _out, which is emptied before every call.
+ */
+Compression::StreamCompressor::StreamCompressor()
+    : _deflator(new CryptoPP::StringSink(_out), LEVEL) {}
+
+const std::string& Compression::StreamCompressor::update(const char* plain, size_t size) {
+    _out.clear();
+    _deflator.Put(reinterpret_cast<const CryptoPP::byte*>(plain), size);
+    return _out;
+}
+
+const std::string& Compression::StreamCompressor::final() {
+    _out.clear();
+    _deflator.MessageEnd();
+    return _out;
+}
+
+Compression::StreamDecompressor::StreamDecompressor(uint64_t maxSize)
+    : _inflator(new CryptoPP::StringSink(_out)), _maxSize(maxSize) {}
+
+/*
+ * Inflates the block piece by piece, and stops as soon as the plaintext grows past maxSize.
+ */
+const std::string& Compression::StreamDecompressor::update(const char* compressed, size_t size) {
+    _out.clear();
+    for (size_t offset = 0; offset < size; offset += INFLATE_PIECE) {
+        size_t piece = std::min(INFLATE_PIECE, size - offset);
+        size_t before = _out.size();
+        _inflator.Put(reinterpret_cast<const CryptoPP::byte*>(compressed + offset), piece);
+        _produced += _out.size() - before;
+        check();
+    }
+    return _out;
+}
+
+/*
+ * Throws if the content ended in the middle of a deflate block.
+ */
+const std::string& Compression::StreamDecompressor::final() {
+    _out.clear();
+    _inflator.MessageEnd();
+    _produced += _out.size();
+    check();
+    return _out;
+}
+
+void Compression::StreamDecompressor::check() {
+    if (_produced > _maxSize)   throw std::runtime_error("Decompressed content is too big");
+}
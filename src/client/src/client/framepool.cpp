@@ -0,0 +1,77 @@
+#include "../../include/FramePool.h"
+#include <utility>
+
+/* Room for every idle buffer is made once, so giving one back never allocates */
+FramePool::FramePool() {
+    idleBuffers.reserve(FRAME_POOL_IDLE);
+}
+
+/* Lends the smallest idle buffer that holds size bytes. If none does, the biggest one grows (or a new one is made). */
+FramePool::Lease FramePool::take(size_t size) {
+    size_t best = idleBuffers.size();
+    for (size_t i = 0; i < idleBuffers.size(); i++) {
+        if (best == idleBuffers.size()) {
+            best = i;
+            continue;
+        }
+        size_t capacity = idleBuffers[i].capacity(), bestCapacity = idleBuffers[best].capacity();
+        bool fits = capacity >= size, bestFits = bestCapacity >= size;
+        if (fits && (!bestFits || capacity < bestCapacity))     best = i;
+        else if (!fits && !bestFits && capacity > bestCapacity)     best = i;
+    }
+
+    std::vector<unsigned char> buffer;
+    if (best < idleBuffers.size()) {
+        buffer = std::move(idleBuffers[best]);
+        idleBuffers[best] = std::move(idleBuffers.back());
+        idleBuffers.pop_back();
+        idleBytes -= buffer.capacity();
+    }
+    if (buffer.capacity() < size)   made++;
+    buffer.resize(size);
+    return Lease(this, std::move(buffer));
+}
+
+/* Returns the amount of buffers waiting to be reused */
+size_t FramePool::idle() const {
+    return idleBuffers.size();
+}
+
+/* Returns the amount of buffers made or grown, it stops growing once the pool fits the traffic */
+uint64_t FramePool::allocations() const {
+    return made;
+}
+
+/* Keeps a buffer for the next take, unless the pool is full. Empty buffers are not worth keeping. */
+void FramePool::give(std::vector<unsigned char>&& buffer) {
+    size_t capacity = buffer.capacity();
+    if (capacity == 0 || idleBuffers.size() >= FRAME_POOL_IDLE || idleBytes + capacity > FRAME_POOL_KEEP_BYTES)     return;
+    idleBytes += capacity;
+    idleBuffers.push_back(std::move(buffer));
+}
+
+FramePool::Lease::Lease(FramePool* pool, std::vector<unsigned char>&& buffer)
+    : pool(pool), buffer(std::move(buffer)) {}
+
+FramePool::Lease::Lease(Lease&& other) noexcept
+    : pool(std::exchange(other.pool, nullptr)), buffer(std::move(other.buffer)) {}
+
+/* Returns the buffer held so far, and takes the one of other */
+FramePool::Lease& FramePool::Lease::operator=(Lease&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool = std::exchange(other.pool, nullptr);
+        buffer = std::move(other.buffer);
+    }
+    return *this;
+}
+
+FramePool::Lease::~Lease() {
+    release();
+}
+
+void FramePool::Lease::release() {
+    if (pool != nullptr)    pool -> give(std::move(buffer));
+    pool = nullptr;
+    buffer = {};
+}
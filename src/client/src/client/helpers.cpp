@@ -1,5 +1,6 @@
 #include "../../include/Helpers.h"
 #include "../../include/Client.h"
+#include "../../include/Hex.h"
 #include "Helpers.h"
 
 /* Reads the server IP and port from server.info */
@@ -30,9 +31,9 @@ std::pair<std::string, int> getServerInfo() {
     return {ip, port};
 }
 
-/* Reads user data from my.info */
-std::vector<std::string> getUserInfo() {
-    std::ifstream file("me.info");
+/* Reads user data from a me.info file: username, UUID and the private key (the rest of the file). Empty if the file is missing or short. */
+std::vector<std::string> getUserInfo(const std::string& path) {
+    std::ifstream file(path);
     std::vector<std::string> user_info;
     if (!file.is_open()) return user_info;
 
@@ -77,6 +78,8 @@ int openingMessage(Client* client){
                 "151)   Send a request for symmetric key\n" << 
                 "152)   Send your symmetric key\n" <<
                 "153)   Send a file\n" <<
+                "154)   Send a file (encrypted in parallel frames)\n" <<
+                "160)   Listen for incoming messages\n" <<
                 " 0)    Exit Client" << std::endl;
     
     std::cin.clear();
@@ -93,6 +96,52 @@ int openingMessage(Client* client){
     return choice;
 }
 
+/* Writes a user in the me.info format: username, UUID in hex, and the private key in base 64 */
+void writeUserInfo(const std::string& path, const std::string& name, const Uuid& uuid, const std::string& privateKey){
+    std::ofstream file(path);
+    if (!file)  throw std::runtime_error(RED  "Could not open the requested file!"  RESET);
+
+    /* First row: username*/
+    file << name << std::endl;
+
+    /* Second row: UUID*/
+    file << uuid.hex() << std::endl;
+
+    /* Third row: Private key in base 64*/
+    file << Base64Wrapper::encode(privateKey) << std::endl;
+    file.close();
+}
+
+/* Reads the public key cache: records of the UUID in hex (32 bytes), the key size (2 bytes, little endian) and the key.
+    A later record of the same UUID replaces an earlier one. A missing file is an empty cache, a cut record ends it,
+    a record that is not a UUID in hex is skipped. */
+std::unordered_map<Uuid, std::string> readPublicKeys(const std::string& path){
+    std::unordered_map<Uuid, std::string> keys;
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return keys;
+
+    std::array<char, Uuid::HEX_SIZE> uuid;
+    unsigned char size[2];
+    while (file.read(uuid.data(), uuid.size()) && file.read(reinterpret_cast<char*>(size), sizeof(size))){
+        std::string key(size[0] | (size[1] << 8), '\0');
+        if (!file.read(key.data(), key.size())) break;
+        if (std::optional<Uuid> id = Uuid::fromHex(std::string_view(uuid.data(), uuid.size())))
+            keys[*id] = std::move(key);
+    }
+    return keys;
+}
+
+/* Appends a public key record to the cache file */
+void appendPublicKey(const std::string& path, const std::string& uuid, const std::string& key){
+    std::ofstream file(path, std::ios::binary | std::ios::app);
+    if (!file)  throw std::runtime_error(RED  "Could not open the public key cache!"  RESET);
+
+    const unsigned char size[2] = { static_cast<unsigned char>(key.size()), static_cast<unsigned char>(key.size() >> 8) };
+    file.write(uuid.data(), uuid.size());
+    file.write(reinterpret_cast<const char*>(size), sizeof(size));
+    file.write(key.data(), key.size());
+}
+
 /* Receives username input from user*/
 std::string receiveUsername(){
     /* Request username */
@@ -107,16 +156,25 @@ std::string receiveUsername(){
     return username;
 }
 
-/* Turns a binary vector to string representation for pretty printing */
-std::string binaryToStr(std::vector<unsigned char> data, const size_t size){
-    std::ostringstream oss;
-    for (auto it = data.begin(); it != data.begin() + size; it++) 
-        oss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(*it);
-    
-    return oss.str();
+/* Receives an amount of seconds (to listen) from user */
+int receiveSeconds(){
+    std::cout << YELLOW  "For how many seconds should we listen?"  RESET << std::endl;
+    int seconds;
+    while (!(std::cin >> seconds) || seconds <= 0){
+        std::cout <<  RED  "\nInvalid input, please enter a positive number!\n" RESET << std::endl;
+        std::cin.clear();
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    return seconds;
+}
+
+/* Turns binary data to its hex representation for pretty printing */
+std::string binaryToStr(std::span<const unsigned char> data){
+    return Hex::encode(data.data(), data.size());
 }
 
-std::string saveToTemp(std::string data){
+/* Creates a new temporary file, and returns its path. The caller writes the data (files are written block by block). */
+std::string createTempFile(){
     /* We alloate space for the longest path possible, and get the path to temp from windows.h */
     std::string path(MAX_PATH,'\0');
     DWORD length = GetTempPath(MAX_PATH, path.data());
@@ -130,12 +188,5 @@ std::string saveToTemp(std::string data){
         throw std::runtime_error(YELLOW "Failed to create temporary file at " RESET +dir );
     dir.resize(strlen(dir.c_str()));  // We resize according to the true size of it.
 
-    /* Write the data to file */
-    std::ofstream outFile(dir, std::ios::binary);
-    if (!outFile)
-        throw std::runtime_error(YELLOW "Failed to open the temporary file at " RESET +dir);
-    outFile << data;
-    outFile.close();
-
     return dir;    
 }
\ No newline at end of file
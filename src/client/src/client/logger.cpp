@@ -0,0 +1,156 @@
+#include "../../include/Logger.h"
+#include "../../include/Hex.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr const char* LEVEL_NAMES[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "OFF"};
+
+/* [2024-03-10 12:00:00.123] LEVEL text */
+void writeLine(std::ostream& out, LogLevel level, std::chrono::system_clock::time_point time, const std::string& text) {
+    std::time_t seconds = std::chrono::system_clock::to_time_t(time);
+    auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() % 1000;
+    std::tm local{};
+#ifdef _WIN32
+    localtime_s(&local, &seconds);
+#else
+    localtime_r(&seconds, &local);
+#endif
+    out << '[' << std::put_time(&local, "%Y-%m-%d %H:%M:%S") << '.' << std::setw(3) << std::setfill('0') << millis << std::setfill(' ')
+        << "] " << std::left << std::setw(5) << LEVEL_NAMES[static_cast<size_t>(level)] << std::right << ' ' << text << '\n';
+}
+
+/* Opens the log file before the writer starts, so a failure leaves no thread behind */
+std::ofstream openLog(const std::string& path) {
+    std::ofstream file(path, std::ios::app);
+    if (!file)  throw std::runtime_error("Could not open the log file " + path);
+    return file;
+}
+
+}
+
+/* Starts the writer on out */
+Logger::Logger(std::ostream& out, LogLevel level) : out(out), level(level), writer(&Logger::run, this) {}
+
+/* Starts the writer on a file, appended to */
+Logger::Logger(const std::string& path, LogLevel level)
+    : file(openLog(path)), out(*file), level(level), writer(&Logger::run, this) {}
+
+/* Lets the writer finish the queue, then stops it */
+Logger::~Logger() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    lineQueued.notify_one();
+    writer.join();
+}
+
+/* The client log: the level and the file are taken from the environment once, on first use.
+    It is destroyed at exit, after the lines still queued were written. */
+Logger& Logger::shared() {
+    static std::unique_ptr<Logger> log = []{
+        const char* level = std::getenv(LOG_LEVEL_ENV);
+        LogLevel parsed = level ? parseLevel(level, LogLevel::INFO) : LogLevel::INFO;
+        const char* path = std::getenv(LOG_FILE_ENV);
+        try {
+            if (path)   return std::make_unique<Logger>(path, parsed);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << ", logging to stderr." << std::endl;
+        }
+        return std::make_unique<Logger>(std::clog, parsed);
+    }();
+    return *log;
+}
+
+/* trace, debug, info, warn, error or off, in any case. Anything else is otherwise. */
+LogLevel Logger::parseLevel(const std::string& name, LogLevel otherwise) {
+    std::string upper = name;
+    std::transform(upper.begin(), upper.end(), upper.begin(), [](unsigned char c){ return static_cast<char>(std::toupper(c)); });
+    for (size_t i = 0; i < std::size(LEVEL_NAMES); i++)
+        if (upper == LEVEL_NAMES[i])    return static_cast<LogLevel>(i);
+    return otherwise;
+}
+
+void Logger::setLevel(LogLevel newLevel) {
+    level.store(newLevel, std::memory_order_relaxed);
+}
+
+/* Lines below WARN take a token, the bucket refills by LOG_RATE_LIMIT a second and holds at most as many */
+bool Logger::allowed(LogLevel level, Clock::time_point now) {
+    if (level >= LogLevel::WARN)    return true;
+    tokens = std::min<double>(LOG_RATE_LIMIT, tokens + std::chrono::duration<double>(now - refilled).count() * LOG_RATE_LIMIT);
+    refilled = now;
+    if (tokens < 1)     return false;
+    tokens -= 1;
+    return true;
+}
+
+/* Queues a line for the writer. The caller never waits for the output, a line that does not fit is dropped. */
+void Logger::write(LogLevel level, std::string line) {
+    if (!enabled(level))    return;
+    std::chrono::system_clock::time_point time = std::chrono::system_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (queue.size() >= LOG_QUEUE_SIZE || !allowed(level, Clock::now())) {
+            droppedLines++;
+            droppedTotal++;
+            return;
+        }
+        queue.push_back({level, time, std::move(line)});
+    }
+    lineQueued.notify_one();
+}
+
+/* A capped hex dump, the size is always the real one */
+void Logger::writeHex(LogLevel level, const char* what, const void* data, size_t size) {
+    write(level, std::string(what) + " (" + std::to_string(size) + " bytes): " + Hex::dump(data, size, LOG_HEX_LIMIT));
+}
+
+/* Waits until the writer wrote everything queued so far */
+void Logger::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    drained.wait(lock, [this]{ return (queue.empty() && !writing) || stopping; });
+}
+
+uint64_t Logger::dropped() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return droppedTotal;
+}
+
+/* Takes everything queued at once and writes it without the lock, so callers are only held for a push */
+void Logger::run() {
+    std::vector<Line> lines;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        lineQueued.wait(lock, [this]{ return !queue.empty() || stopping; });
+        if (queue.empty())  break;
+
+        lines.assign(std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.end()));
+        queue.clear();
+        uint64_t dropped = std::exchange(droppedLines, 0);
+        writing = true;
+        lock.unlock();
+
+        std::ostringstream text;
+        for (const Line& line : lines)  writeLine(text, line.level, line.time, line.text);
+        if (dropped > 0)    writeLine(text, LogLevel::WARN, std::chrono::system_clock::now(), std::to_string(dropped) + " lines dropped (queue full or rate limited)");
+        out << text.str() << std::flush;
+        lines.clear();
+
+        lock.lock();
+        writing = false;
+        if (queue.empty())  drained.notify_all();
+    }
+    drained.notify_all();
+}
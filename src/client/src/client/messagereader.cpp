@@ -0,0 +1,113 @@
+#include "../../include/MessageReader.h"
+#include "../../include/Client.h"
+#include "../../include/ProtocolManager.h"
+#include "../../include/WireCodec.h"
+#include "../../include/Metrics.h"
+#include <cstring>
+
+/* Makes a reader for a payload of payloadSize bytes in the encoding of version, the response header must already be read.
+    The window is borrowed from the connection, so reading a page after another reuses the same buffer. */
+MessageReader::MessageReader(Client* client, uint32_t payloadSize, uint8_t version)
+    : client(client), window(client -> getFramePool().take(STREAM_BLOCK_SIZE)), payloadRemaining(payloadSize), version(version) {}
+
+/* Returns the amount of bytes in the window that were not read yet */
+size_t MessageReader::buffered() const {
+    return tail - head;
+}
+
+/* Returns the amount of content bytes of the current message that were not read yet */
+uint32_t MessageReader::contentRemaining() const {
+    return contentLeft;
+}
+
+/* Makes sure 'needed' bytes are in the window, in one piece.
+    We never read past the payload, the next bytes on the socket belong to the next response. */
+bool MessageReader::fill(size_t needed) {
+    if (buffered() >= needed)   return true;
+    if (needed - buffered() > payloadRemaining)     return false;
+
+    /* Move the unread bytes to the start, and grow only if a single message is bigger than the window */
+    if (head + needed > window.size()) {
+        std::memmove(window.data(), window.data() + head, buffered());
+        tail -= head;
+        head = 0;
+        if (needed > window.size())     window -> resize(needed);
+    }
+
+    while (buffered() < needed) {
+        size_t space = std::min(window.size() - tail, static_cast<size_t>(payloadRemaining));
+        size_t bytesRead = client -> receiveSome(window.data() + tail, space);
+        tail += bytesRead;
+        payloadRemaining -= static_cast<uint32_t>(bytesRead);
+    }
+    return true;
+}
+
+/* Reads the next message header. Content the caller did not read of the previous message is skipped. */
+bool MessageReader::next(MessageRecord& record) {
+    while (contentLeft > 0)     contentChunk();
+    if (buffered() == 0 && payloadRemaining == 0)   return false;
+
+    /* The header size is only known once it is parsed (varints), so we make sure the longest one is buffered, or the rest of the payload */
+    fill(std::min<size_t>(WIRE_MAX_RECORD_HEADER, buffered() + payloadRemaining));
+    Metrics::Span parse(Metrics::Stage::PARSE);
+    WireReader reader(std::span<const unsigned char>(window.data() + head, buffered()), version);
+    try {
+        reader.uuid(record.fromID);
+        record.msgID = reader.u32();
+        record.type = reader.u8();
+        record.size = reader.u32();
+    } catch (const std::runtime_error&) {
+        throw std::runtime_error(YELLOW  "Incomplete message"  RESET);
+    }
+    head += reader.size();
+
+    contentLeft = record.size;
+    if (contentLeft > buffered() + payloadRemaining)
+        throw std::runtime_error(YELLOW  "Incomplete message"  RESET);
+    return true;
+}
+
+/* Returns the whole content of the current message. The view is valid until the next call to the reader. */
+std::span<const unsigned char> MessageReader::content() {
+    if (!fill(contentLeft))     throw std::runtime_error(YELLOW  "Incomplete message"  RESET);
+
+    std::span<const unsigned char> view(window.data() + head, contentLeft);
+    head += contentLeft;
+    contentLeft = 0;
+    return view;
+}
+
+/* Returns whatever part of the content already arrived (at least one byte), so big contents never need to fit in the window.
+    The view is valid until the next call to the reader. */
+std::span<const unsigned char> MessageReader::contentChunk() {
+    if (contentLeft == 0)   return {};
+    if (!fill(1))   throw std::runtime_error(YELLOW  "Incomplete message"  RESET);
+
+    size_t size = std::min(buffered(), static_cast<size_t>(contentLeft));
+    std::span<const unsigned char> view(window.data() + head, size);
+    head += size;
+    contentLeft -= static_cast<uint32_t>(size);
+
+    /* Start over at the beginning of the window when it is empty, so the reads stay big */
+    if (buffered() == 0)    head = tail = 0;
+    return view;
+}
+
+/* Reads the next size bytes of content (less only at its end) into out, 0 when it was all read.
+    What is already in the window is copied, the rest is received straight into out. */
+size_t MessageReader::readContent(unsigned char* out, size_t size) {
+    size = std::min(size, static_cast<size_t>(contentLeft));
+    size_t copied = std::min(buffered(), size);
+    std::memcpy(out, window.data() + head, copied);
+    head += copied;
+    if (buffered() == 0)    head = tail = 0;
+
+    while (copied < size) {
+        size_t bytesRead = client -> receiveSome(out + copied, size - copied);
+        copied += bytesRead;
+        payloadRemaining -= static_cast<uint32_t>(bytesRead);
+    }
+    contentLeft -= static_cast<uint32_t>(copied);
+    return copied;
+}
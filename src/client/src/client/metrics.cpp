@@ -0,0 +1,259 @@
+#include "../../include/Metrics.h"
+#include "../../include/Logger.h"
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#if CLIENT_METRICS
+
+namespace {
+
+constexpr const char* STAGE_NAMES[Metrics::STAGES] = {"connect", "serialize", "encrypt", "send", "first_byte", "receive", "parse", "decrypt"};
+constexpr const char* COUNTER_NAMES[Metrics::COUNTERS] = {"bytes_sent", "bytes_received", "requests", "responses", "messages_sent", "messages_received"};
+constexpr const char* COUNTER_HELP[Metrics::COUNTERS] = {
+    "Bytes written to the server", "Bytes read from the server", "Requests built", "Response headers read",
+    "Messages sent in a request or a batch", "Messages read from a waiting or pushed list"};
+
+using Cell = std::atomic<uint64_t>;
+
+/* Timings of one stage of one op */
+struct Histogram {
+    Cell count{0};
+    Cell sum{0};                                                                // Nanoseconds
+    Cell max{0};
+    std::array<Cell, Metrics::BUCKETS.size() + 1> buckets{};                    // Per bound, the last one is +Inf
+};
+
+/* Everything a thread records. Only its thread writes to it, while it owns it. */
+struct Slot {
+    std::array<Cell, Metrics::COUNTERS> counters{};
+    std::array<std::array<Histogram, Metrics::OPS>, Metrics::STAGES> spans;
+    bool owned = false;                                                         // Guarded by the registry mutex
+};
+
+/* Every slot ever made. It is never destroyed, threads may still record while the program exits. */
+struct Registry {
+    std::mutex mutex;
+    std::deque<Slot> slots;                                                     // A deque, so slots never move
+};
+
+Registry& registry() {
+    static Registry* registry = new Registry;
+    return *registry;
+}
+
+/* Takes a free slot for the thread, and gives it back when the thread ends. The totals of the slot keep growing with its next owner. */
+class SlotOwner {
+    public:
+        SlotOwner() {
+            std::lock_guard<std::mutex> lock(registry().mutex);
+            for (Slot& free : registry().slots)
+                if (!free.owned) {
+                    slot = &free;
+                    break;
+                }
+            if (slot == nullptr)    slot = &registry().slots.emplace_back();
+            slot -> owned = true;
+        }
+
+        ~SlotOwner() {
+            std::lock_guard<std::mutex> lock(registry().mutex);
+            slot -> owned = false;
+        }
+
+        Slot* slot = nullptr;
+};
+
+Slot& threadSlot() {
+    thread_local SlotOwner owner;
+    return *owner.slot;
+}
+
+/* A single writer needs no read-modify-write, a plain store is enough for the readers */
+void add(Cell& cell, uint64_t amount) {
+    cell.store(cell.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+/* The sum of every slot, read while the threads keep writing (each value is whole, the set of them may be a moment apart) */
+struct Totals {
+    struct Timings {
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        std::array<uint64_t, Metrics::BUCKETS.size() + 1> buckets{};
+
+        /* Taken from the buckets, so a histogram always adds up */
+        uint64_t count() const {
+            uint64_t total = 0;
+            for (uint64_t bucket : buckets)     total += bucket;
+            return total;
+        }
+    };
+
+    std::array<uint64_t, Metrics::COUNTERS> counters{};
+    std::array<std::array<Timings, Metrics::OPS>, Metrics::STAGES> spans;
+};
+
+Totals collect() {
+    Totals totals;
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    for (const Slot& slot : registry().slots) {
+        for (size_t i = 0; i < Metrics::COUNTERS; i++)
+            totals.counters[i] += slot.counters[i].load(std::memory_order_relaxed);
+        for (size_t stage = 0; stage < Metrics::STAGES; stage++)
+            for (size_t op = 0; op < Metrics::OPS; op++) {
+                const Histogram& from = slot.spans[stage][op];
+                Totals::Timings& to = totals.spans[stage][op];
+                to.sum += from.sum.load(std::memory_order_relaxed);
+                to.max = std::max(to.max, from.max.load(std::memory_order_relaxed));
+                for (size_t bucket = 0; bucket < to.buckets.size(); bucket++)
+                    to.buckets[bucket] += from.buckets[bucket].load(std::memory_order_relaxed);
+            }
+    }
+    return totals;
+}
+
+std::string opLabel(size_t index) {
+    return index == 0 ? "none" : std::to_string(Metrics::FIRST_OP + index - 1);
+}
+
+void writePrometheus(std::ostream& out, const Totals& totals) {
+    out << "# HELP client_span_seconds Time spent in a stage of a request\n"
+        << "# TYPE client_span_seconds histogram\n";
+    for (size_t stage = 0; stage < Metrics::STAGES; stage++)
+        for (size_t op = 0; op < Metrics::OPS; op++) {
+            const Totals::Timings& timings = totals.spans[stage][op];
+            if (timings.count() == 0)   continue;
+            std::string labels = std::string("stage=\"") + STAGE_NAMES[stage] + "\",op=\"" + opLabel(op) + "\"";
+            uint64_t cumulative = 0;
+            for (size_t bucket = 0; bucket < Metrics::BUCKETS.size(); bucket++) {
+                cumulative += timings.buckets[bucket];
+                out << "client_span_seconds_bucket{" << labels << ",le=\"" << Metrics::BUCKETS[bucket] / 1e9 << "\"} " << cumulative << "\n";
+            }
+            out << "client_span_seconds_bucket{" << labels << ",le=\"+Inf\"} " << timings.count() << "\n"
+                << "client_span_seconds_sum{" << labels << "} " << std::setprecision(9) << timings.sum / 1e9 << std::setprecision(6) << "\n"
+                << "client_span_seconds_count{" << labels << "} " << timings.count() << "\n";
+        }
+
+    out << "# HELP client_span_max_seconds Longest time spent in a stage of a request\n"
+        << "# TYPE client_span_max_seconds gauge\n";
+    for (size_t stage = 0; stage < Metrics::STAGES; stage++)
+        for (size_t op = 0; op < Metrics::OPS; op++) {
+            const Totals::Timings& timings = totals.spans[stage][op];
+            if (timings.count() == 0)   continue;
+            out << "client_span_max_seconds{stage=\"" << STAGE_NAMES[stage] << "\",op=\"" << opLabel(op) << "\"} "
+                << std::setprecision(9) << timings.max / 1e9 << std::setprecision(6) << "\n";
+        }
+
+    for (size_t i = 0; i < Metrics::COUNTERS; i++) {
+        out << "# HELP client_" << COUNTER_NAMES[i] << "_total " << COUNTER_HELP[i] << "\n"
+            << "# TYPE client_" << COUNTER_NAMES[i] << "_total counter\n"
+            << "client_" << COUNTER_NAMES[i] << "_total " << totals.counters[i] << "\n";
+    }
+}
+
+void writeStats(std::ostream& out, const Totals& totals) {
+    out << std::left << std::setw(12) << "STAGE" << std::setw(6) << "OP" << std::right << std::setw(10) << "COUNT"
+        << std::setw(12) << "AVG US" << std::setw(12) << "MAX US" << std::setw(12) << "TOTAL MS" << "\n";
+    out << std::fixed << std::setprecision(1);
+    for (size_t stage = 0; stage < Metrics::STAGES; stage++)
+        for (size_t op = 0; op < Metrics::OPS; op++) {
+            const Totals::Timings& timings = totals.spans[stage][op];
+            uint64_t count = timings.count();
+            if (count == 0)     continue;
+            out << std::left << std::setw(12) << STAGE_NAMES[stage] << std::setw(6) << opLabel(op) << std::right
+                << std::setw(10) << count << std::setw(12) << timings.sum / 1e3 / count << std::setw(12) << timings.max / 1e3
+                << std::setw(12) << timings.sum / 1e6 << "\n";
+        }
+    for (size_t i = 0; i < Metrics::COUNTERS; i++)
+        out << std::left << std::setw(18) << COUNTER_NAMES[i] << std::right << std::setw(20) << totals.counters[i] << "\n";
+}
+
+}
+
+/* Ops 600-608 have their own slot, anything else (connecting, no request yet) is "none" */
+size_t Metrics::opIndex(uint16_t op) {
+    return op >= FIRST_OP && op < FIRST_OP + OPS - 1 ? op - FIRST_OP + 1 : 0;
+}
+
+/* Adds to a counter of this thread */
+void Metrics::count(Counter counter, uint64_t amount) {
+    add(threadSlot().counters[static_cast<size_t>(counter)], amount);
+}
+
+/* Adds a timed stage to the histogram of its op, the bucket is the first bound it fits under */
+void Metrics::record(Stage stage, uint16_t op, Clock::duration elapsed) {
+    uint64_t nanos = static_cast<uint64_t>(std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), 0));
+    Histogram& histogram = threadSlot().spans[static_cast<size_t>(stage)][opIndex(op)];
+    add(histogram.count, 1);
+    add(histogram.sum, nanos);
+    if (nanos > histogram.max.load(std::memory_order_relaxed))
+        histogram.max.store(nanos, std::memory_order_relaxed);
+    add(histogram.buckets[std::lower_bound(BUCKETS.begin(), BUCKETS.end(), nanos) - BUCKETS.begin()], 1);
+}
+
+/* Writes the metrics of every thread, formatted apart so the flags of out are left alone */
+void Metrics::write(std::ostream& out, Format format) {
+    std::ostringstream text;
+    if (format == Format::PROMETHEUS)   writePrometheus(text, collect());
+    else    writeStats(text, collect());
+    out << text.str();
+}
+
+#else
+
+/* Built without metrics, there is nothing to write */
+void Metrics::write(std::ostream& out, Format) {
+    out << "# metrics were compiled out (CLIENT_METRICS 0)\n";
+}
+
+#endif
+
+/* Starts writing path every interval (at least a second) */
+Metrics::Exporter::Exporter(std::string path, Format format, std::chrono::seconds interval)
+    : path(std::move(path)), format(format), interval(std::max(interval, std::chrono::seconds(1))), worker(&Exporter::run, this) {}
+
+/* Stops the worker, and writes the final metrics */
+Metrics::Exporter::~Exporter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    stopped.notify_all();
+    worker.join();
+    flush();
+}
+
+/* Writes the file through a temporary one. A failed write is reported and the next interval tries again. */
+void Metrics::Exporter::flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        write(out, format);
+        if (!out) {
+            Logger::shared().write(LogLevel::WARN, "Could not write the metrics to " + temporary);
+            return;
+        }
+    }
+
+    /* Some systems do not rename over an existing file */
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::filesystem::remove(path, error);
+        std::filesystem::rename(temporary, path, error);
+    }
+    if (error)  Logger::shared().write(LogLevel::WARN, "Could not write the metrics to " + path + ": " + error.message());
+}
+
+void Metrics::Exporter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopped.wait_for(lock, interval, [this]{ return stopping; })) {
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
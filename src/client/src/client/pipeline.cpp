@@ -0,0 +1,134 @@
+#include "../../include/Pipeline.h"
+#include "../../include/Client.h"
+#include "../../include/Compression.h"
+#include "../../include/Metrics.h"
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+
+/* Makes an empty pipeline on the client connection. The client must be connected, and signed in for anything but sign ups. */
+Pipeline::Pipeline(Client* client, size_t maxInFlight)
+    : client(client), maxInFlight(std::max<size_t>(maxInFlight, 1)), slotFreed(client -> getContext()) {}
+
+/* Queues a new request, with the header of clientID */
+ProtocolManager& Pipeline::newRequest(RequestOp op, const Uuid& clientID) {
+    ProtocolManager& request = requests.emplace_back();
+    request.setRequestHeader(clientID, PROTOCOL_VERSION, static_cast<uint16_t>(op));
+    ops.push_back(op);
+    return request;
+}
+
+/* Queues a new request, with the header of the current user */
+ProtocolManager& Pipeline::newRequest(RequestOp op) {
+    if (!client -> getUser().has_value())   throw std::runtime_error(YELLOW "Please register first!" RESET);
+    return newRequest(op, client -> getUser().value().getUUID());
+}
+
+/* Queues a sign up of a new user, the payload is the username and the public key */
+void Pipeline::registerUser(const std::string& name, const std::string& publicKey) {
+    ProtocolManager& request = newRequest(RequestOp::REQ_REGISTER, Uuid());
+    request.setRegister(name, publicKey);
+}
+
+/* Queues a public key request for a member */
+void Pipeline::requestPublicKey(const ClientData& member) {
+    ProtocolManager& request = newRequest(RequestOp::REQ_PUBLIC_KEY);
+    const Uuid& uuid = member.getUUID();
+    request.setPayload(uuid.data(), uuid.size());
+    request.setPayloadSize(static_cast<uint32_t>(uuid.size()));
+}
+
+/* Deflates a text when it is worth it, encrypts it with the member symmetric key and queues it */
+void Pipeline::sendText(ClientData& member, const std::string& text) {
+    if (!member.getAESWrapper().has_value())
+        throw std::runtime_error(YELLOW  "Request a symmetrical key first for user "  RESET + member.getUsername());
+    std::string plain = text;
+    bool compressed = Compression::compressInPlace(plain);
+    Metrics::Span encrypt(Metrics::Stage::ENCRYPT, static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR));
+    std::string cipher = member.getAESWrapper().value().encrypt(plain);
+    encrypt.stop();
+    sendMessage(member.getUUID(), MessageType::SEND_TEXT_MSG, std::move(cipher), compressed);
+}
+
+/* Queues a message to a target. The content is sent as is (it should already be encrypted), compressed sets MESSAGE_COMPRESSED. */
+void Pipeline::sendMessage(const Uuid& target, MessageType type, std::string content, bool compressed) {
+    if (content.size() >= std::numeric_limits<uint32_t>::max() - WIRE_MAX_MESSAGE_HEADER)     throw std::runtime_error(RED  "Message is to long! Shorten it."  RESET);
+    ProtocolManager& request = newRequest(RequestOp::REQ_SEND_MSG_TO_USR);
+    uint8_t typeByte = static_cast<uint8_t>(type) | (compressed ? MESSAGE_COMPRESSED : 0);
+    request.setMessageHeader(target, typeByte, static_cast<uint32_t>(content.size()));
+    request.setPayloadSize(static_cast<uint32_t>(request.getPayload().size() + content.size()));
+    request.setContent(std::move(content));
+}
+
+/* Returns the amount of queued requests */
+size_t Pipeline::size() const {
+    return requests.size();
+}
+
+/* Writes every request, waiting only while maxInFlight requests have no response yet */
+boost::asio::awaitable<void> Pipeline::writer() {
+    for (ProtocolManager& request : requests) {
+        while (written - results.size() >= maxInFlight) {
+            boost::system::error_code ec;
+            slotFreed.expires_at(boost::asio::steady_timer::time_point::max());
+            co_await slotFreed.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        }
+        Metrics::Span span(Metrics::Stage::SEND, static_cast<uint16_t>(ops[written]));
+        size_t size = co_await boost::asio::async_write(client -> getSocket(), request.createMessage(), boost::asio::use_awaitable);
+        span.stop();
+        Metrics::count(Metrics::Counter::BYTES_SENT, size);
+        written++;
+    }
+}
+
+/* Reads a response for every request. A response can only arrive after its request was written, so no waiting is needed here. */
+boost::asio::awaitable<void> Pipeline::reader() {
+    while (results.size() < requests.size()) {
+        PipelineResult result;
+        result.request = ops[results.size()];
+
+        co_await boost::asio::async_read(client -> getSocket(), boost::asio::buffer(&result.header, sizeof(ResponseHeader)), boost::asio::use_awaitable);
+        result.payload.resize(result.header.payloadSize);
+        co_await boost::asio::async_read(client -> getSocket(), boost::asio::buffer(result.payload), boost::asio::use_awaitable);
+        Metrics::count(Metrics::Counter::RESPONSES);
+        Metrics::count(Metrics::Counter::BYTES_RECEIVED, sizeof(ResponseHeader) + result.payload.size());
+        results.push_back(std::move(result));
+        slotFreed.cancel();
+
+        /* Store public keys as they arrive */
+        const PipelineResult& received = results.back();
+        if (static_cast<ResponseOp>(received.header.responseOp) == ResponseOp::RESP_PUBLIC_KEY && received.payload.size() > Uuid::SIZE) {
+            client -> cachePublicKey(client -> findUser(Uuid::fromBytes(received.payload.data())), std::string(received.payload.begin() + Uuid::SIZE, received.payload.end()));
+        }
+    }
+}
+
+/* Runs the writer and reader on the client io_context until every response arrived.
+    If either fails the connection is closed (the stream position is lost), and the error is thrown. */
+std::vector<PipelineResult> Pipeline::run() {
+    std::exception_ptr failure;
+    auto onDone = [this, &failure](std::exception_ptr e) {
+        if (e && !failure) {
+            failure = e;
+            client -> closeConnection();
+        }
+    };
+
+    results.clear();
+    results.reserve(requests.size());
+    written = 0;
+
+    boost::asio::io_context& io_context = client -> getContext();
+    boost::asio::co_spawn(io_context, writer(), onDone);
+    boost::asio::co_spawn(io_context, reader(), onDone);
+    io_context.restart();
+    io_context.run();
+
+    if (failure)    std::rethrow_exception(failure);
+
+    requests.clear();
+    ops.clear();
+    return std::move(results);
+}
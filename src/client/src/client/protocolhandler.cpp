@@ -1,15 +1,20 @@
 #include "../../include/ProtocolManager.h"
 #include "../../include/Client.h"
 #include "../../include/Helpers.h"
+#include "../../include/MessageReader.h"
+#include "../../include/Compression.h"
+#include "../../include/Metrics.h"
+#include "../../include/Logger.h"
 #include <boost/endian/conversion.hpp>
 #include <boost/asio.hpp>
 #include <filesystem>
+#include <future>
 #include <limits>
 #include <fstream>
 #include <windows.h>
 
 /* Parses the new request header correctly, while turning the payloadsize and requestop to little endian */
-void ProtocolManager::setRequestHeader(std::array<uint8_t,16> clientID, uint8_t version, uint16_t requestOp){
+void ProtocolManager::setRequestHeader(const Uuid& clientID, uint8_t version, uint16_t requestOp){
     requestHeader.clientID = clientID;
     requestHeader.version = version;
     if(boost::endian::order::native == boost::endian::order::little)
@@ -25,21 +30,26 @@ void ProtocolManager::setPayloadSize(uint32_t payloadSize) {
     else requestHeader.payloadSize = boost::endian::native_to_little(payloadSize);
 }
 
-/* Sets the message header (Secondary header upon sending a message)*/
-void ProtocolManager::setMessageHeader(std::array<uint8_t, 16> target_uuid, uint8_t msg_type, uint32_t content_size) {
-    payload.clear();
-
-    if (boost::endian::order::native != boost::endian::order::little) {
-        msg_type = boost::endian::native_to_little(msg_type);
-        content_size = boost::endian::native_to_little(content_size);
-    }
+/* Sets the message header (Secondary header upon sending a message), in the encoding of the request header version.
+    The payload keeps its capacity between requests, so no allocation is made after the first one. */
+void ProtocolManager::setMessageHeader(const Uuid& target_uuid, uint8_t msg_type, uint32_t content_size) {
+    payload.resize(WIRE_MAX_MESSAGE_HEADER);
+    WireWriter writer(payload.data(), requestHeader.version);
+    writer.uuid(target_uuid);
+    writer.u8(msg_type);
+    writer.u32(content_size);
+    payload.resize(writer.size());
+    Metrics::count(Metrics::Counter::MESSAGES_SENT);
+}
 
-    payload.insert(payload.end(), target_uuid.begin(), target_uuid.end());
-    payload.push_back(msg_type);  
-    /* We need to make sure content size is added as 4 bytes */
-    uint8_t size_bytes[4];  
-    std::memcpy(size_bytes, &content_size, sizeof(content_size));  
-    payload.insert(payload.end(), size_bytes, size_bytes + 4);
+/* Sets the payload of a sign up: the username (padded, or length prefixed) and the public key */
+void ProtocolManager::setRegister(const std::string& username, const std::string& publicKey) {
+    if (username.size() > MAX_USERNAME_SIZE)    throw std::runtime_error(RED  "Username to long, please enter again!"  RESET);
+    payload.resize(WireWriter::nameSize(username.size(), requestHeader.version) + publicKey.size());
+    WireWriter writer(payload.data(), requestHeader.version);
+    writer.name(username, '0');
+    writer.bytes(publicKey.data(), publicKey.size());
+    setPayloadSize(static_cast<uint32_t>(writer.size()));
 }
 
 /* Gets the request header */
@@ -47,65 +57,124 @@ RequestHeader ProtocolManager::getRequestHeader() const {
     return requestHeader;
 }
 
+/* Gets the payload, the message header for messages (the content is kept apart) */
+const std::vector<unsigned char>& ProtocolManager::getPayload() const {
+    return payload;
+}
+
 /* Gets the response header */
 ResponseHeader ProtocolManager::getResponseHeader() const {
     return responseHeader;
 }
 
-/* Prints the response header */
-void ProtocolManager::printResponseHeader() {   
-    std::cout << YELLOW << "Raw Header Bytes: " << RESET;
-    for (size_t i = 0; i < payload.size(); i++)
-        std::cout << std::hex << std::setfill('0') << std::setw(2) << (int)payload[i] << " ";
-    std::cout << std::dec << std::endl;
-    std::cout << YELLOW <<"Version: " << RESET <<(int)responseHeader.version << std::endl;
-    std::cout << YELLOW <<"ResponseOp: " << RESET << responseHeader.responseOp << std::endl;
-    std::cout << YELLOW <<"Payload Size: " << RESET <<responseHeader.payloadSize << std::endl;
+/* Logs the response header at debug level, and its raw bytes at trace level */
+void ProtocolManager::logResponseHeader() {
+    Logger& log = Logger::shared();
+    if (!log.enabled(LogLevel::DEBUG))  return;
+    log.hexDump(LogLevel::TRACE, "Raw header", &responseHeader, sizeof(ResponseHeader));
+    log.write(LogLevel::DEBUG, "Response: version " + std::to_string(responseHeader.version) + ", op " + std::to_string(responseHeader.responseOp)
+                               + ", payload " + std::to_string(responseHeader.payloadSize) + " bytes");
 }
 
-/* Returns a vector of vectors. First vector includes header + message. 
-    If message is greater than MAX_BUFFER size, we split it into more vectors, appended. */
-std::vector<std::vector<unsigned char>> ProtocolManager::createMessage(){
-    /* A message chunk vector of vectors */
-    std::vector<std::vector<unsigned char>> messageChunks;
+/* Received messages are given to handler instead of printed (an empty handler prints them again) */
+void ProtocolManager::setMessageHandler(MessageHandler handler) {
+    onMessage = std::move(handler);
+}
 
-    /* Size available in first chunk is not including the header. */
-    size_t availableSize = MAX_BUFFER - sizeof(RequestHeader);
+/* Parses the members added / changed since our version into changed, returns the version the list is at now.
+    Payload: version (8 bytes), count (4 bytes), then UUID (16 bytes), name length (1 byte) and name per member.
+    In version 3 the version, count and name lengths are varints. */
+uint64_t ProtocolManager::parseMemberSync(std::span<const unsigned char> payload, uint8_t version, std::vector<std::pair<Uuid, std::string>>& changed) {
+    WireReader reader(payload, version);
+    uint64_t listVersion = reader.u64();
+    uint32_t count = reader.u32();
+    if (count > reader.remaining() / (Uuid::SIZE + 1))  throw std::runtime_error(RED  "Invalid payload size for member list!"  RESET);
+
+    changed.resize(count);
+    for (auto& [UUID, username] : changed){
+        reader.uuid(UUID);
+        username = version < PROTOCOL_VERSION_COMPACT ? reader.view(reader.u8()) : reader.name('\0');
+    }
+    if (reader.remaining() != 0)    throw std::runtime_error(RED  "Invalid payload size for member list!"  RESET);
+    return listVersion;
+}
 
-    /* The first chunk (first vector) of data to be sent */
-    std::vector<unsigned char> firstChunk;
-    firstChunk.resize(sizeof(RequestHeader));
-    std::memcpy(firstChunk.data(), &requestHeader, sizeof(RequestHeader));
-    
-    size_t bytesRemaining = payload.size();
-    size_t offset = 0;
-    /* If the amount of bytes remaining to be added fits in first chunk, we add it. */
-    if (bytesRemaining <= availableSize){
-        firstChunk.insert(firstChunk.end(), payload.begin(), payload.end());
-        messageChunks.push_back(firstChunk);
-    }else {
-        /* If the payload is greater than size left, we put only the amount we can. Rest will go in other chunks. */
-        firstChunk.insert(firstChunk.end(), payload.begin(), payload.begin() + availableSize);
-        messageChunks.push_back(firstChunk);
-        offset += availableSize;
-        bytesRemaining -= availableSize;
-
-        /* As long as we still have data, we make more chunks. */
-        while (bytesRemaining > 0){
-            /* Chunk size is the max between 4096 or the amount left */
-            size_t chunkSize = std::min(bytesRemaining,static_cast<size_t>(MAX_BUFFER));
-            std::vector<unsigned char> chunk(payload.begin()+offset,payload.begin()+offset+chunkSize);
-            messageChunks.push_back(chunk);
-            offset+=chunkSize;
-            bytesRemaining -= chunkSize;
-        }
+/* Sets the payload (for requests without a message header) */
+void ProtocolManager::setPayload(const unsigned char* data, size_t size) {
+    payload.assign(data, data + size);
+}
+
+/* Sets the content of the message. The content is kept in its own buffer and is only referenced by createMessage. */
+void ProtocolManager::setContent(std::string newContent) {
+    content = std::move(newContent);
+}
+
+/* Returns a buffer sequence of the request header, the payload and the content.
+    Nothing is copied, the buffers point at the members, so they must stay untouched until the message is written. */
+const std::vector<boost::asio::const_buffer>& ProtocolManager::createMessage() {
+    /* The spans that follow on this thread (send, receive...) belong to this request */
+    uint16_t op = boost::endian::little_to_native(requestHeader.requestOp);
+    Metrics::setRequest(op);
+    Metrics::count(Metrics::Counter::REQUESTS);
+    Metrics::Span span(Metrics::Stage::SERIALIZE, op);
+
+    message.clear();
+    message.push_back(boost::asio::buffer(&requestHeader, sizeof(RequestHeader)));
+    if (!payload.empty())
+        message.push_back(boost::asio::buffer(payload));
+    if (!content.empty())
+        message.push_back(boost::asio::buffer(content));
+    message.insert(message.end(), batchContents.begin(), batchContents.end());
+
+    return message;
+}
+
+/* Sets a batch of messages. The payload holds the amount of entries and a table of their headers (target, type, size),
+    the contents follow the table in the same order and are sent straight from the entries. */
+void ProtocolManager::setBatch(const Uuid& clientID, const std::vector<BatchEntry>& entries){
+    if (entries.empty())    throw std::runtime_error(YELLOW "There are no messages in the batch!" RESET);
+    Metrics::Span span(Metrics::Stage::SERIALIZE, static_cast<uint16_t>(RequestOp::REQ_SEND_BATCH));
+    for (const BatchEntry& entry : entries)
+        if (entry.content.size() >= std::numeric_limits<uint32_t>::max())   throw std::runtime_error(RED  "Batch is to big! Split it."  RESET);
+
+    setRequestHeader(clientID, PROTOCOL_VERSION, static_cast<uint16_t>(RequestOp::REQ_SEND_BATCH));
+    content.clear();
+    batchContents.clear();
+    payload.resize(WIRE_MAX_VARINT32 + entries.size() * WIRE_MAX_MESSAGE_HEADER);
+
+    WireWriter writer(payload.data(), requestHeader.version);
+    uint64_t totalSize = 0;
+    writer.u32(static_cast<uint32_t>(entries.size()));
+    for (const BatchEntry& entry : entries){
+        writer.uuid(entry.target);
+        writer.u8(static_cast<uint8_t>(entry.type));
+        writer.u32(static_cast<uint32_t>(entry.content.size()));
+        totalSize += entry.content.size();
+        if (!entry.content.empty())
+            batchContents.push_back(boost::asio::buffer(entry.content));
     }
+    payload.resize(writer.size());
+
+    totalSize += payload.size();
+    if (totalSize >= std::numeric_limits<uint32_t>::max())     throw std::runtime_error(RED  "Batch is to big! Split it."  RESET);
+    setPayloadSize(static_cast<uint32_t>(totalSize));
+    Metrics::count(Metrics::Counter::MESSAGES_SENT, entries.size());
+}
 
-    return messageChunks;
+/* Returns the message IDs the server gave the last batch, in the order of the entries */
+const std::vector<uint32_t>& ProtocolManager::getMessageIDs() const {
+    return messageIDs;
 }
 
 /* Handles the sending messages interaction according to user choice*/
 void ProtocolManager::messageHandler(int choice, Client* client){
+    /* Content is only set by the message requests (150-153) */
+    content.clear();
+    morePages = false;
+    batchContents.clear();
+    closeFile();
+    frameCipher.reset();
+
     switch (choice){
         /* Register request */
         case 110:{
@@ -117,31 +186,25 @@ void ProtocolManager::messageHandler(int choice, Client* client){
             /* We get a new publickey, and the username requested */
             std::string username = receiveUsername();
             client -> setUser(username);                // Set with unpadded name
-            username.resize(255,'0');                   // Pad name
             std::string publicKey = client -> getUser().value().getDecryptor().value().getPublicKey();
             
-            /* Combine the message header and payload, consisting of publickey and username */
-            setRequestHeader(std::array<unsigned char,16>{0},2,op);
-            setPayloadSize(static_cast<uint32_t>(publicKey.size() + username.size()));
-
-            /* We clear the payload and put the new data inside */
-            payload.clear();
-            payload.insert(payload.end(), username.begin(), username.end());
-            payload.insert(payload.end(),publicKey.begin(), publicKey.end());
+            /* Combine the message header and payload, consisting of username (padded or length prefixed) and publickey */
+            setRequestHeader(Uuid(),PROTOCOL_VERSION,op);
+            setRegister(username, publicKey);
             break;
         }
-        /* User List Request */
+        /* User List Request. We send the member list version we have, the server only sends who was added / changed after it,
+            so the first request brings everyone and a refresh only the difference. */
         case 120:{
             if (!(client -> getUser().has_value())) throw std::runtime_error(YELLOW "Invalid option, you are already signed in!" RESET);
-            if (!(client -> getMembers()).empty())  throw std::runtime_error(YELLOW "To refresh client list, please re-log" RESET);
-            uint16_t op = static_cast<uint16_t>(RequestOp::REQ_USER_LIST);
-
-            /* make a header, there is no payload */
-            setRequestHeader(client -> getUser().value().getUUID(),2,op);
-            setPayloadSize(0);
-
-            /* Clear the payload just incase */
-            payload.clear();
+            uint16_t op = static_cast<uint16_t>(RequestOp::REQ_USER_LIST_SINCE);
+
+            setRequestHeader(client -> getUser().value().getUUID(),PROTOCOL_VERSION,op);
+            payload.resize(WIRE_MAX_VARINT64);
+            WireWriter writer(payload.data(), requestHeader.version);
+            writer.u64(client -> getMemberVersion());
+            payload.resize(writer.size());
+            setPayloadSize(static_cast<uint32_t>(payload.size()));
             break;
         }
         /* Public Key Request */
@@ -153,13 +216,12 @@ void ProtocolManager::messageHandler(int choice, Client* client){
             /* Get target username from client & message */
             ClientData& it = client -> getMember();
             /* Set the header */
-            setRequestHeader(client -> getUser().value().getUUID(),2,op);
+            setRequestHeader(client -> getUser().value().getUUID(),PROTOCOL_VERSION,op);
             setPayloadSize(it.getUUID().size());
             
             /* Set the payload */
             payload.clear();
-            std::array<uint8_t, 16> uuidBytes = it.getUUID();  
-            payload.insert(payload.end(), uuidBytes.begin(), uuidBytes.end());  
+            payload.insert(payload.end(), it.getUUID().begin(), it.getUUID().end());  
             std::cout << payload.size() << std::endl;
             break;
         }
@@ -167,13 +229,20 @@ void ProtocolManager::messageHandler(int choice, Client* client){
         case 140:{
             if (!(client -> getUser().has_value())) throw std::runtime_error(YELLOW" Invalid option, you are already signed in!" RESET);
             if ((client -> getMembers()).empty())   throw std::runtime_error(YELLOW  "Please request member list first!" RESET);
-            uint16_t op = static_cast<uint16_t>(RequestOp::REQ_AWAITING_MESSAGES);
 
-            /* Make the header */
-            setRequestHeader(client -> getUser().value().getUUID(),2,op);
-            setPayloadSize(0);
+            /* Messages are pulled page by page, clientService keeps asking while the server has more (nextPage) */
+            setPageRequest(client);
+            break;
+        }
+        /* Subscribe request, after it the server pushes our messages as soon as they arrive (clientService listens) */
+        case 160:{
+            if (!(client -> getUser().has_value())) throw std::runtime_error(YELLOW" Invalid option, you are already signed in!" RESET);
+            if ((client -> getMembers()).empty())   throw std::runtime_error(YELLOW  "Please request member list first!" RESET);
+            uint16_t op = static_cast<uint16_t>(RequestOp::REQ_SUBSCRIBE);
 
-            /* Clear the payload */
+            /* make a header, there is no payload */
+            setRequestHeader(client -> getUser().value().getUUID(),PROTOCOL_VERSION,op);
+            setPayloadSize(0);
             payload.clear();
             break;
         }
@@ -188,7 +257,7 @@ void ProtocolManager::messageHandler(int choice, Client* client){
             if (!it.getRSAPublicWrapper().has_value())  throw std::runtime_error((YELLOW "Please request a public key for " RESET )+it.getUsername());
 
             /* Fix header */
-            setRequestHeader(client -> getUser().value().getUUID(),2,op);
+            setRequestHeader(client -> getUser().value().getUUID(),PROTOCOL_VERSION,op);
             setMessageHeader(it.getUUID(),static_cast<uint8_t>(type), static_cast<uint32_t>(0));
             setPayloadSize(payload.size());
             std::cout << payload.size() << std::endl;
@@ -207,13 +276,15 @@ void ProtocolManager::messageHandler(int choice, Client* client){
             it.setNewSymmetric();
 
             /* Encrypt the key */
+            Metrics::Span encrypt(Metrics::Stage::ENCRYPT, op);
             std::string encryptedSymmetric = it.getRSAPublicWrapper().value().encrypt(it.getAESWrapper().value().getKey());
+            encrypt.stop();
 
             /* Construct header, payload header and content */
-            setRequestHeader(client -> getUser().value().getUUID(),2,op);
+            setRequestHeader(client -> getUser().value().getUUID(),PROTOCOL_VERSION,op);
             setMessageHeader(it.getUUID(),type,encryptedSymmetric.size());
-            payload.insert(payload.end(),encryptedSymmetric.begin(), encryptedSymmetric.end());     // Content
-            setPayloadSize(payload.size());
+            setContent(std::move(encryptedSymmetric));                                              // Content
+            setPayloadSize(payload.size() + content.size());
 
             break;
         }
@@ -232,47 +303,41 @@ void ProtocolManager::messageHandler(int choice, Client* client){
             std::getline(std::cin, message);
             if (message.size() >= std::numeric_limits<uint32_t>::max()-21)  throw std::runtime_error(RED  "Message is to long! Shorten it."  RESET);
             
-            /* Encrypt the message */
+            /* Deflate the message when it is worth it, then encrypt it */
+            if (Compression::compressInPlace(message))     type |= MESSAGE_COMPRESSED;
+            Metrics::Span encrypt(Metrics::Stage::ENCRYPT, op);
             std::string encryptedMsg = it.getAESWrapper().value().encrypt(message);
+            encrypt.stop();
 
             /* Construct request header, payload header and content */
-            setRequestHeader(client -> getUser().value().getUUID(),2,op);
+            setRequestHeader(client -> getUser().value().getUUID(),PROTOCOL_VERSION,op);
             setMessageHeader(it.getUUID(),type,encryptedMsg.size());
-            payload.insert(payload.end(),encryptedMsg.begin(), encryptedMsg.end());             // Content
-            setPayloadSize(payload.size());
+            setContent(std::move(encryptedMsg));                                                 // Content
+            setPayloadSize(payload.size() + content.size());
             break;
         }
         /* Sending File  (type 4) */
         case 153:{
             if (!(client -> getUser().has_value()))    throw std::runtime_error(YELLOW "Invalid option, you are already signed in!" RESET);
-            uint16_t op = static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR);
-            uint8_t type = static_cast<uint8_t>(MessageType::SEND_FILE);
 
             /* Get target username from client */
             ClientData& it = client -> getMember();
-            if (!it.getAESWrapper().has_value())  if (!it.getAESWrapper().has_value())   throw std::runtime_error( YELLOW  "Request a symmetrical key first for user "  RESET+it.getUsername());
+            if (!it.getAESWrapper().has_value())   throw std::runtime_error( YELLOW  "Request a symmetrical key first for user "  RESET+it.getUsername());
 
-            /* Get file path from user */
-            std::cout << RED  "Enter complete file path: "  RESET << std::endl;
-            std::string file_path;
-            std::getline(std::cin, file_path);
-            std::ifstream file(file_path,std::ios::binary);
+            /* The file itself is encrypted and sent block by block in streamContent */
+            openFile(client, it, MessageType::SEND_FILE);
+            break;
+        }
+        /* Sending a file in GCM frames (type 5), encrypted on every core */
+        case 154:{
+            if (!(client -> getUser().has_value()))    throw std::runtime_error(YELLOW "Invalid option, you are already signed in!" RESET);
 
-            /* Check the path & the size of the file! , 21 is size of message header */
-            if (!file)  throw std::runtime_error(RED  "File Not found!"  RESET);
-            if (std::filesystem::file_size(file_path) >= std::numeric_limits<uint32_t>::max()-21) throw std::runtime_error(RED  "File is to big! Please choose a different file."  RESET);
-            
-            /* Parse the data to a string and encrypt */
-            std::string data(std::filesystem::file_size(file_path),'\0');
-            file.read(data.data(),std::filesystem::file_size(file_path));
-            file.close();
-            std::string encryptedData = it.getAESWrapper().value().encrypt(data);
-
-            /* Create the headers */
-            setRequestHeader(client -> getUser().value().getUUID(),2,op);
-            setMessageHeader(it.getUUID(),type,encryptedData.size());
-            payload.insert(payload.end(), encryptedData.begin(), encryptedData.end());
-            setPayloadSize(payload.size());
+            /* Get target username from client */
+            ClientData& it = client -> getMember();
+            if (!it.getAESWrapper().has_value())   throw std::runtime_error( YELLOW  "Request a symmetrical key first for user "  RESET+it.getUsername());
+
+            /* The file itself is encrypted and sent batch by batch in streamContent */
+            openFile(client, it, MessageType::SEND_FILE_FRAMED);
             break;
         }
         /* Exit client */
@@ -286,219 +351,310 @@ void ProtocolManager::messageHandler(int choice, Client* client){
 
 }
 
-/* Handles the responses */
-void ProtocolManager::responseHandler(Client* client){
-    /* We start by clearing the payload buffer */
-    payload.clear();
+/* Asks for the path of a file to send, opens it for streamContent and sets the headers of the file message.
+    A file whose start does not look random is deflated into a temporary file first (the header needs the content size),
+    and that copy is sent instead when it is smaller.
+    The content size depends on the format: CBC with padding (type 4) or GCM frames with their tags (type 5). */
+void ProtocolManager::openFile(Client* client, ClientData& target, MessageType type){
+    /* Get file path from user */
+    std::cout << RED  "Enter complete file path: "  RESET << std::endl;
+    std::string file_path;
+    std::getline(std::cin, file_path);
+    fileStream.emplace(file_path,std::ios::binary);
+
+    /* Check the path & the size of the encrypted file! , 21 is size of message header (the deflated copy is only smaller) */
+    if (!fileStream.value())  {
+        fileStream.reset();
+        throw std::runtime_error(RED  "File Not found!"  RESET);
+    }
+    uint64_t fileSize = std::filesystem::file_size(file_path);
+    if ((type == MessageType::SEND_FILE_FRAMED ? FramedAES::contentSize(fileSize) : AESWrapper::cipherSize(fileSize)) >= std::numeric_limits<uint32_t>::max()-21) {
+        fileStream.reset();
+        throw std::runtime_error(RED  "File is to big! Please choose a different file."  RESET);
+    }
+    uint8_t messageType = static_cast<uint8_t>(type);
+
+    /* Deflate the file when its sample is worth it */
+    std::vector<char> sample(std::min<uint64_t>(fileSize, Compression::SAMPLE_SIZE));
+    fileStream.value().read(sample.data(), sample.size());
+    fileStream.value().clear();
+    fileStream.value().seekg(0);
+    if (Compression::worthCompressing(sample.data(), fileSize)) {
+        std::string path = createTempFile();
+        uint64_t compressedSize;
+        try {
+            std::ofstream compressed(path, std::ios::binary);
+            compressedSize = Compression::compressStream(fileStream.value(), compressed);
+        } catch (const std::exception& e){
+            fileStream.reset();
+            std::filesystem::remove(path);
+            throw std::runtime_error(RED "Failed compressing the file!" RESET);
+        }
+        if (compressedSize < fileSize) {
+            fileStream.emplace(path, std::ios::binary);
+            compressedFile = path;
+            fileSize = compressedSize;
+            messageType |= MESSAGE_COMPRESSED;
+        } else {
+            std::filesystem::remove(path);
+            fileStream.value().clear();
+            fileStream.value().seekg(0);
+        }
+    }
 
-    /* Catch the header & Copy it to response header */
-    payload = client -> receiveMessage(sizeof(ResponseHeader));
-    memcpy(&responseHeader,payload.data(),sizeof(ResponseHeader));
+    uint64_t encryptedSize = type == MessageType::SEND_FILE_FRAMED ? FramedAES::contentSize(fileSize) : AESWrapper::cipherSize(fileSize);
 
-    /* Print the header received, this is mostly for debugging. */
-    printResponseHeader();
+    /* Create the headers */
+    if (type == MessageType::SEND_FILE_FRAMED)  frameCipher.emplace(target.getAESWrapper().value());
+    else                                        streamCipher.emplace(target.getAESWrapper().value());
+    setRequestHeader(client -> getUser().value().getUUID(),PROTOCOL_VERSION,static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR));
+    setMessageHeader(target.getUUID(),messageType,static_cast<uint32_t>(encryptedSize));
+    setPayloadSize(static_cast<uint32_t>(payload.size() + encryptedSize));
+}
 
-    /* We get the remainder of the payload from the socket */
-    payload = client -> receiveMessage(responseHeader.payloadSize);
+/* Closes the file that was sent, and removes it if it was our deflated copy */
+void ProtocolManager::closeFile(){
+    fileStream.reset();
+    if (compressedFile.has_value()) {
+        std::error_code error;
+        std::filesystem::remove(compressedFile.value(), error);
+        compressedFile.reset();
+    }
+}
+
+/* Sends the file set in request 153. Every block is read, encrypted and written to the socket before the next one is read,
+    so only one block of plaintext and ciphertext is held in memory. */
+void ProtocolManager::streamContent(Client* client){
+    if (!fileStream.has_value())   return;
+    if (frameCipher.has_value())    return streamFrames(client);
+
+    FramePool::Lease block = client -> getFramePool().take(STREAM_BLOCK_SIZE);
+    AESWrapper::StreamEncryptor encryptor(streamCipher.value());
+    try {
+        while (fileStream.value()){
+            fileStream.value().read(reinterpret_cast<char*>(block.data()), block.size());
+            size_t bytesRead = static_cast<size_t>(fileStream.value().gcount());
+            if (bytesRead == 0)    break;
+
+            Metrics::Span encrypt(Metrics::Stage::ENCRYPT);
+            const std::string& cipher = encryptor.update(reinterpret_cast<const char*>(block.data()), bytesRead);
+            encrypt.stop();
+            if (!cipher.empty())
+                client -> sendMessage({boost::asio::buffer(cipher)});
+        }
+        if (fileStream.value().bad())   throw std::runtime_error(RED "Failed reading the file!" RESET);
+        client -> sendMessage({boost::asio::buffer(encryptor.final())});
+    } catch (const std::exception& e){
+        /* The server is waiting for the rest of the payload, the connection can not be used anymore */
+        closeFile();
+        client -> closeConnection();
+        throw;
+    }
+    closeFile();
+}
+
+/* Sends the file set in request 154 as GCM frames. A batch of frames (one per core) is read and encrypted at once,
+    and is sent while the next batch is read and encrypted. Two batches are held in memory. */
+void ProtocolManager::streamFrames(Client* client){
+    FramedAES& frames = frameCipher.value();
+    size_t batchPlain = frames.batchFrames() * FramedAES::FRAME_SIZE;
+    FramePool& pool = client -> getFramePool();
+    FramePool::Lease plain = pool.take(batchPlain);
+    std::array<FramePool::Lease, 2> cipher;
+    for (FramePool::Lease& buffer : cipher)    buffer = pool.take(frames.batchFrames() * (FramedAES::FRAME_SIZE + FramedAES::TAG_SIZE));
+
+    std::future<void> sending;
+    uint16_t op = boost::endian::little_to_native(requestHeader.requestOp);
+    try {
+        std::string header = frames.newHeader();
+        client -> sendMessage({boost::asio::buffer(header)});
+
+        /* A batch shorter than batchPlain is the last one, it ends with the short last frame (it may be empty) */
+        uint32_t firstFrame = 0;
+        for (size_t current = 0, bytesRead = batchPlain; bytesRead == batchPlain; current ^= 1) {
+            fileStream.value().read(reinterpret_cast<char*>(plain.data()), plain.size());
+            bytesRead = static_cast<size_t>(fileStream.value().gcount());
+            if (fileStream.value().bad())   throw std::runtime_error(RED "Failed reading the file!" RESET);
+
+            Metrics::Span encrypt(Metrics::Stage::ENCRYPT, op);
+            size_t cipherSize = frames.encryptFrames(plain.data(), bytesRead, firstFrame, bytesRead < batchPlain, cipher[current].data());
+            encrypt.stop();
+            firstFrame += static_cast<uint32_t>(frames.batchFrames());
+
+            /* The previous batch must be on the socket before this one, and its buffer is the next one we encrypt into */
+            if (sending.valid())    sending.get();
+            sending = std::async(std::launch::async, [client, &cipher, current, cipherSize, op] {
+                Metrics::setRequest(op);
+                client -> sendMessage({boost::asio::buffer(cipher[current].data(), cipherSize)});
+            });
+        }
+        sending.get();
+        /* The last batch was sent by another thread, the wait for the response starts here */
+        Metrics::requestSent();
+    } catch (const std::exception& e){
+        /* The server is waiting for the rest of the payload, the connection can not be used anymore */
+        if (sending.valid())    sending.wait();
+        closeFile();
+        frameCipher.reset();
+        client -> closeConnection();
+        throw;
+    }
+    closeFile();
+    frameCipher.reset();
+}
+
+/* Handles the responses */
+void ProtocolManager::responseHandler(Client* client){
+    /* Catch the header straight into the response header */
+    client -> receiveMessage(reinterpret_cast<unsigned char*>(&responseHeader), sizeof(ResponseHeader));
+    Metrics::count(Metrics::Counter::RESPONSES);
+
+    /* Log the header received, this is mostly for debugging. */
+    logResponseHeader();
+
+    /* Once subscribed, messages pushed to us (2108) can arrive before the response. They are handled as they come. */
+    while (static_cast<ResponseOp>(responseHeader.responseOp) == ResponseOp::RESP_PUSHED_MESSAGES){
+        handleMessages(client, responseHeader.payloadSize);
+        client -> receiveMessage(reinterpret_cast<unsigned char*>(&responseHeader), sizeof(ResponseHeader));
+        Metrics::count(Metrics::Counter::RESPONSES);
+        logResponseHeader();
+    }
+
+    /* We get the remainder of the payload from the socket. Awaiting messages are read message by message while they are handled.
+        The payload buffer is resized, not replaced, so it is only allocated when a response is bigger than any before it. */
+    ResponseOp op = static_cast<ResponseOp>(responseHeader.responseOp);
+    if (op != ResponseOp::RESP_AWAITING_MESSAGES && op != ResponseOp::RESP_AWAITING_MESSAGES_PAGE) {
+        payload.resize(responseHeader.payloadSize);
+        client -> receiveMessage(payload.data(), payload.size());
+    }
        
-    
+    /* Waiting messages are parsed by the reader as they arrive, their span ends before it starts */
+    Metrics::Span parse(Metrics::Stage::PARSE);
     switch(static_cast<ResponseOp>(responseHeader.responseOp)){
         /* Makes a new me.info file. Sets the correct UUID / User for the client. */
         case ResponseOp::RESP_REGISTER_SUCCESSFULL:{
-            /* Open the me.info file */
-            std::ofstream file("me.info");
-            if (!file)  throw std::runtime_error(RED  "Could not open the requested file!"  RESET);
-
-            /* First row: username*/
-            file << client -> getUser().value().getName() << std::endl;
-            
-            /* Second row: UUID*/
             /* We set a new UUID to the user */
-            std::array<uint8_t, 16> newUUID;
-            std::copy_n(payload.begin(), 16, newUUID.begin());
+            if (payload.size() < Uuid::SIZE)    throw std::runtime_error(RED  "Invalid payload size for register response!"  RESET);
+            Uuid newUUID = Uuid::fromBytes(payload.data());
             client -> setUserUUID(newUUID);
-            
-            /* We parse the payload to the file */
-            for (unsigned char c : payload)
-                file << std::hex << std::setw(2) << std::setfill('0') << (int)c << "";
-            file << std::endl;
-
-            /* Third row: Private key in base 64*/
-            std::string base64 = Base64Wrapper::encode(client -> getUser().value().getDecryptor().value().getPrivateKey());
-            file << base64 << std::endl;
-            file.close();
 
+            /* And save it all to the me.info file */
+            const User& user = client -> getUser().value();
+            writeUserInfo("me.info", user.getName(), newUUID, user.getDecryptor().value().getPrivateKey());
             break;
         }
         /* Saves the member list in client -> members. ClientData(username, uuid) 
             Prints the member list to the user */
         case ResponseOp::RESP_USER_LIST:{
         /* First we make constant sizes for parsing the data */
-            constexpr size_t UUID_SIZE = 16;
             constexpr size_t USERNAME_SIZE = 255;
-            constexpr size_t INFO_SIZE = UUID_SIZE + USERNAME_SIZE;
+            constexpr size_t INFO_SIZE = Uuid::SIZE + USERNAME_SIZE;
 
-            /* If the payload size does not divide by 255+16 without a remainder, it means we got to much or to less data,
+            /* In version 2 every user is 255+16 bytes, if the payload size does not divide by it we got to much or to less data,
              and the data is missing or extra, therefor the database is corrupted!! (For ex: Username without UUID!!)*/
 
             if (payload.size() == 0)    throw std::runtime_error(YELLOW  "There are no other members!"  RESET);
-            else if (payload.size() % INFO_SIZE != 0)
+            else if (responseHeader.version < PROTOCOL_VERSION_COMPACT && payload.size() % INFO_SIZE != 0)
                 throw std::runtime_error(RED  "Invalid payload size, the database is probably corrupted!"  RESET);
             
             /* We reserve number of users amount of room in the members vector & clear old data  */
-            size_t numberOfUsers = payload.size() / INFO_SIZE;
-            client -> getMembers().clear();
+            client -> clearMembers(payload.size() / INFO_SIZE);
 
             /* For every member we extract the data and place a new object (ClientData) in the vector of members */
             /* We now pretty print the uuid / username for the client to see. */
             std::cout << YELLOW << "MEMBERS LIST" << RESET << std::endl;
-            for (size_t i = 0 ; i < numberOfUsers; i++){
-                size_t offset = i * INFO_SIZE;
-
-                std::string UUID = binaryToStr(std::vector<uint8_t>(payload.begin() + offset, payload.begin() + offset + UUID_SIZE),UUID_SIZE); 
-                
-                std::string username(reinterpret_cast<const char*>(&payload[offset + UUID_SIZE]), USERNAME_SIZE);
-
-                client->setMembers(UUID, username.erase(username.find_last_not_of('0') + 1));
-                std::cout << YELLOW << "UUID: " << RESET << UUID
+            WireReader reader(payload, responseHeader.version);
+            while (reader.remaining() > 0){
+                Uuid UUID;
+                reader.uuid(UUID);
+                std::string username(reader.name('0'));
+
+                client->setMembers(UUID, username);
+                std::cout << YELLOW << "UUID: " << RESET << UUID.hex()
                         << YELLOW << " | Username: " << RESET << username << std::endl;
             }
             break;
         }
+        /* Merges the members added / changed since our version into client -> members (nothing is cleared) */
+        case ResponseOp::RESP_USER_LIST_SINCE:{
+            /* Parse everything first, a cut payload must not leave half a sync behind */
+            std::vector<std::pair<Uuid, std::string>> changed;
+            uint64_t version = parseMemberSync(payload, responseHeader.version, changed);
+
+            std::cout << YELLOW << "MEMBERS LIST" << RESET << " (" << changed.size() << " new / changed)" << std::endl;
+            for (const auto& [UUID, username] : changed){
+                bool added = client -> mergeMember(UUID, username);
+                std::cout << (added ? YELLOW "NEW " RESET : YELLOW "CHANGED " RESET)
+                          << YELLOW << "UUID: " << RESET << UUID.hex()
+                          << YELLOW << " | Username: " << RESET << username << std::endl;
+            }
+            client -> setMemberVersion(version);
+
+            if (client -> getMembers().empty())     throw std::runtime_error(YELLOW  "There are no other members!"  RESET);
+            break;
+        }
         /* Saves the information in client -> members . setPublicKey(key) */
         case ResponseOp::RESP_PUBLIC_KEY:{
-            /* Constant sizes */
-            constexpr size_t UUID_SIZE = 16;
-
-            /* We 'grab' the string value of the UID so we can search the member list according to it */
-            std::string UUID = binaryToStr(payload, UUID_SIZE);
+            if (payload.size() < Uuid::SIZE)    throw std::runtime_error(RED  "Invalid payload size for public key response!"  RESET);
 
             /* We grab the member with the same UUID */
-            ClientData& user = client -> findUser(UUID);
+            ClientData& user = client -> findUser(Uuid::fromBytes(payload.data()));
             
             /* We store the public key for the member. When we need to send a message, we will use it. */
-            std::string pubKey(payload.begin()+UUID_SIZE, payload.end());
-            user.setPublic(pubKey);
+            std::string pubKey(payload.begin() + Uuid::SIZE, payload.end());
+            client -> cachePublicKey(user, pubKey);
 
             std::cout << YELLOW  "Public key received for: "  RESET << user.getUsername() << YELLOW  ". You can now send him a symmetric key (If he asked for one)."  RESET << std::endl;
             break;
         }
         /* Just prints message to user regarding success */
         case ResponseOp::RESP_MSG_SENT_TO_USER:{
-            constexpr size_t UUID_SIZE = 16;
-            std::string UUID = binaryToStr(payload,UUID_SIZE);
-            std::cout << YELLOW  "Sent message successfully to "  RESET << (client -> findUser(UUID)).getUsername() << std::endl;
+            if (payload.size() < Uuid::SIZE)    throw std::runtime_error(RED  "Invalid payload size for message sent response!"  RESET);
+            std::cout << YELLOW  "Sent message successfully to "  RESET << (client -> findUser(Uuid::fromBytes(payload.data()))).getUsername() << std::endl;
+            break;
+        }
+        /* Saves the message IDs of a batch, one ID per message after the amount (4 bytes each, varints in version 3) */
+        case ResponseOp::RESP_BATCH_SENT:{
+            WireReader reader(payload, responseHeader.version);
+            uint32_t count = reader.u32();
+            if (count > reader.remaining())     throw std::runtime_error(RED  "Invalid payload size for batch response!"  RESET);
+
+            messageIDs.resize(count);
+            for (uint32_t& messageID : messageIDs)     messageID = reader.u32();
+            if (reader.remaining() != 0)    throw std::runtime_error(RED  "Invalid payload size for batch response!"  RESET);
+            std::cout << YELLOW  "Sent a batch of "  RESET << count << YELLOW " messages successfully." RESET << std::endl;
             break;
         }
-        /* Handles receiving awaiting messages list, including prompting user & parsing data */
+        /* Handles receiving awaiting messages list, including prompting user & parsing data.
+            The messages are parsed and handled one by one as they arrive from the socket. */
         case ResponseOp::RESP_AWAITING_MESSAGES: {
-            if (payload.size() == 0) {
+            parse.stop();
+            if (responseHeader.payloadSize == 0) {
                 std::cout << YELLOW  "No waiting messages for "  RESET << client -> getUser().value().getName() << std::endl;
                 break;
             }
-            constexpr size_t UUID_SIZE = 16;
-            constexpr size_t MSG_ID = sizeof(uint32_t) ;
-            constexpr size_t MSG_TYPE = sizeof(uint8_t);
-            constexpr size_t MSG_SIZE = sizeof(uint32_t) ;
-            size_t offset = 0;
-            size_t totalSize = payload.size();
-            while (offset < totalSize){
-                if (offset + UUID_SIZE + MSG_ID + MSG_TYPE + MSG_SIZE > totalSize) {
-                    std::cerr << YELLOW  "Incomplete message"  RESET << std::endl;
-                    break;
-                }  
-
-                std::vector<unsigned char> clientID(payload.begin() + offset, payload.begin() + offset + UUID_SIZE);
-                std::string stringID = binaryToStr(clientID, UUID_SIZE);
-                offset += UUID_SIZE;
-
-                std::vector<unsigned char> msgID(payload.begin() + offset, payload.begin() + offset + MSG_ID);
-                offset += MSG_ID;
-
-                uint8_t msgType = payload[offset];
-                offset += MSG_TYPE;
-                
-
-                std::vector<unsigned char> msgSizeBytes(payload.begin() + offset, payload.begin() + offset + MSG_SIZE);
-                offset += MSG_SIZE;
-                /* We need to convert it to an int */
-                uint32_t msgSize;
-                std::memcpy(&msgSize, msgSizeBytes.data(), sizeof(msgSize)); 
-
-                std::vector<unsigned char> content(payload.begin() + offset, payload.begin() + offset + msgSize);
-                std::string stringcontent = binaryToStr(content, msgSize);
-                offset += msgSize;
-                
-                std::cout << RED  "FROM:\t"  RESET << (client -> findUser(stringID)).getUsername() << std::endl;
-
-                switch(msgType){
-                    /* Request for symmetric key */
-                    case 1:{
-                        /* Finding the target user */
-                        ClientData& user = client -> findUser(stringID);
-                        /* Mark that he asked a symmetric (If it wasnt previuosly marked) */
-                        if (!user.getRequested()) user.setRequested();
-                        stringcontent = "Request for symmetric key.";
-                        break;
-                    }
-                    /* Receiving a symmetric key */
-                    case 2:{
-                        /* Finding the target user */
-                        ClientData& user = client -> findUser(stringID);
-                        /* Decrypting the encrypted key */
-                        try{
-                            std::string decrpytedkey = client -> getUser().value().getDecryptor().value().decrypt(std::string(content.begin(), content.end()));
-                            /* Saving it for specific user */
-                            user.setSymmetric(decrpytedkey);
-                            /* Print response */
-                            stringcontent = "Received symmetric key.";
-                        }catch (const std::exception& e){
-                            stringcontent = "Can't decrypt message";
-                        }
-                        break;
-                    }
-                    /*Text msg */
-                    case 3:{
-                        /* Finding the target user */
-                        ClientData& user = client -> findUser(stringID);
-                        if (!user.getAESWrapper().has_value())  stringcontent="Can't decrypt message.";
-                        /* Decrypting the encrypted key */
-                        else {
-                            try{
-                                stringcontent = user.getAESWrapper().value().decrypt(std::string(content.begin(), content.end()));
-                            }catch (const std::exception& e){
-                                stringcontent= "Can't decrypt message.";
-                            }
-                        }
-                        break;
-                    }
-                    /* File received */
-                    case 4:{
-                        /* Finding the target user */
-                        ClientData& user = client -> findUser(stringID);
-                        if (!user.getAESWrapper().has_value())  stringcontent="Can't decrypt message.";
-                        
-                        /* Decrypting the encrypted key */
-                        else {
-                            try{
-                                stringcontent = user.getAESWrapper().value().decrypt(std::string(content.begin(), content.end()));
-                                /* Write to file, and return the directory. */
-                                stringcontent = "File saved to "+saveToTemp(stringcontent);
-                            }catch (const std::exception& e){
-                                stringcontent= "Can't decrypt message.";
-                            }
-                        }
-                        break;
-                    }
-                    default:
-                        break;
-                }
-                std::cout << RED "CONTENT: "RESET << stringcontent << std::endl;
-                std::cout << "----------------------------------------------------------" << std::endl;
+            handleMessages(client, responseHeader.payloadSize);
+            break;
+        }
+        /* A page of the waiting messages, the first byte tells if more are waiting */
+        case ResponseOp::RESP_AWAITING_MESSAGES_PAGE: {
+            parse.stop();
+            if (responseHeader.payloadSize == 0)    throw std::runtime_error(RED "Invalid payload size for messages page!" RESET);
+            unsigned char more;
+            client -> receiveMessage(&more, 1);
+            morePages = more != 0;
+            if (responseHeader.payloadSize == 1) {
+                std::cout << YELLOW  "No waiting messages for "  RESET << client -> getUser().value().getName() << std::endl;
+                break;
             }
+            handleMessages(client, responseHeader.payloadSize - 1);
+            break;
+        }
+        /* The server will push our messages from now on, the ones already waiting follow right after */
+        case ResponseOp::RESP_SUBSCRIBED: {
+            std::cout << YELLOW  "Subscribed, new messages for "  RESET << client -> getUser().value().getName() << YELLOW " will be pushed as they arrive." RESET << std::endl;
             break;
         }
-         
         //case ResponseOp::RESP_GENERAL_ERROR : Handled in default!
         default:{
         /* If we get an error, and the request was to register, we need to clear the username field so we can request it again */
@@ -510,3 +666,218 @@ void ProtocolManager::responseHandler(Client* client){
 
 
 }
+
+/* Sets a request for the next page of waiting messages. The server deletes what it served, so a page starts at the
+    oldest message still waiting, and is limited in messages and bytes so a big backlog never arrives as one huge response. */
+void ProtocolManager::setPageRequest(Client* client){
+    setRequestHeader(client -> getUser().value().getUUID(),PROTOCOL_VERSION,static_cast<uint16_t>(RequestOp::REQ_AWAITING_MESSAGES_PAGE));
+    payload.resize(3 * WIRE_MAX_VARINT32);
+    WireWriter writer(payload.data(), requestHeader.version);
+    writer.u32(0);                                                              // Last message ID, not used by the server any more
+    writer.u32(static_cast<uint32_t>(PAGE_MAX_MESSAGES));
+    writer.u32(static_cast<uint32_t>(PAGE_MAX_BYTES));
+    payload.resize(writer.size());
+    setPayloadSize(static_cast<uint32_t>(payload.size()));
+    content.clear();
+    morePages = false;
+}
+
+/* If the last page said more messages are waiting, sets the request for the next one and returns true. */
+bool ProtocolManager::nextPage(Client* client){
+    if (!morePages)     return false;
+    setPageRequest(client);
+    return true;
+}
+
+/* Handles a frame pushed by the server while we listen (the header was already read by the async reader) */
+void ProtocolManager::receivePushed(Client* client, const ResponseHeader& header){
+    responseHeader = header;
+    Metrics::count(Metrics::Counter::RESPONSES);
+    logResponseHeader();
+    if (static_cast<ResponseOp>(header.responseOp) != ResponseOp::RESP_PUSHED_MESSAGES)
+        throw std::runtime_error(RED "Unexpected response while listening!" RESET);
+
+    handleMessages(client, header.payloadSize);
+}
+
+/* Handles a list of waiting messages, each message is parsed and handled as soon as it arrives */
+void ProtocolManager::handleMessages(Client* client, uint32_t size){
+    MessageReader reader(client, size, responseHeader.version);
+    MessageRecord record;
+    while (reader.next(record)){
+        Metrics::count(Metrics::Counter::MESSAGES_RECEIVED);
+        /* An unknown sender only skips its own message, the reader drops the rest of its content. */
+        try {
+            handleMessage(client, record, reader);
+        } catch (const std::exception& e){
+            std::cerr << e.what() << std::endl;
+        }
+        if (!onMessage)     std::cout << "----------------------------------------------------------" << std::endl;
+    }
+}
+
+/* Writes plaintext of a received file, inflating it first when the content was deflated */
+static void writePlain(std::ofstream& outFile, std::optional<Compression::StreamDecompressor>& decompressor, const char* plain, size_t size){
+    if (!decompressor.has_value()) {
+        outFile.write(plain, size);
+        return;
+    }
+    const std::string& inflated = decompressor.value().update(plain, size);
+    outFile.write(inflated.data(), inflated.size());
+}
+
+/* Removes the partial file of a received file that failed (decryption, integrity check or a cut stream) */
+static void discardFile(std::ofstream& outFile, const std::string& path){
+    outFile.close();
+    std::error_code error;
+    if (!path.empty())  std::filesystem::remove(path, error);
+}
+
+/* Handles a single message from the awaiting messages list. The content is pulled from the reader,
+    text and keys as a whole, files piece by piece straight into the output file.
+    Contents flagged MESSAGE_COMPRESSED are inflated after they are decrypted.
+    A text is decrypted into a buffer of the connection pool and printed from it, so a stream of texts makes no allocation. */
+void ProtocolManager::handleMessage(Client* client, const MessageRecord& record, MessageReader& reader){
+    std::string_view stringcontent;                                             // What is printed: a literal, the text or built
+    std::string built;                                                          // Content made here (file path, hex, inflated text)
+    FramePool::Lease text;                                                      // Decrypted text
+    bool compressed = record.type & MESSAGE_COMPRESSED;
+
+    /* Finding the target user */
+    ClientData& user = client -> findUser(record.fromID);
+
+    switch(record.type & ~MESSAGE_COMPRESSED){
+        /* Request for symmetric key */
+        case 1:{
+            /* Mark that he asked a symmetric (If it wasnt previuosly marked) */
+            if (!user.getRequested()) user.setRequested();
+            stringcontent = "Request for symmetric key.";
+            break;
+        }
+        /* Receiving a symmetric key */
+        case 2:{
+            /* Decrypting the encrypted key */
+            try{
+                std::span<const unsigned char> content = reader.content();
+                Metrics::Span decrypt(Metrics::Stage::DECRYPT);
+                std::string decrpytedkey = client -> getUser().value().getDecryptor().value().decrypt(std::string(content.begin(), content.end()));
+                decrypt.stop();
+                /* Saving it for specific user */
+                user.setSymmetric(decrpytedkey);
+                /* Print response */
+                stringcontent = "Received symmetric key.";
+            }catch (const std::exception& e){
+                stringcontent = "Can't decrypt message";
+            }
+            break;
+        }
+        /*Text msg */
+        case 3:{
+            if (!user.getAESWrapper().has_value())  stringcontent="Can't decrypt message.";
+            /* Decrypting the encrypted message */
+            else {
+                try{
+                    std::span<const unsigned char> content = reader.content();
+                    Metrics::Span decrypt(Metrics::Stage::DECRYPT);
+                    text = client -> getFramePool().take(content.size());
+                    size_t size = user.getAESWrapper().value().decrypt(content.data(), content.size(), text.data());
+                    decrypt.stop();
+                    stringcontent = std::string_view(reinterpret_cast<const char*>(text.data()), size);
+                    if (compressed)     stringcontent = built = Compression::decompress(std::string(stringcontent));
+                }catch (const std::exception& e){
+                    stringcontent= "Can't decrypt message.";
+                }
+            }
+            break;
+        }
+        /* File received */
+        case 4:{
+            if (!user.getAESWrapper().has_value())  stringcontent="Can't decrypt message.";
+            
+            /* Decrypting straight into the file, in big blocks so the decryption runs on many blocks and threads at once */
+            else {
+                std::string path;                                               // Removed again if the file fails
+                std::ofstream outFile;
+                try{
+                    path = createTempFile();
+                    outFile.open(path, std::ios::binary);
+                    if (!outFile)   throw std::runtime_error(YELLOW "Failed to open the temporary file at " RESET + path);
+
+                    AESWrapper::StreamDecryptor decryptor(user.getAESWrapper().value());
+                    std::optional<Compression::StreamDecompressor> decompressor;
+                    if (compressed)     decompressor.emplace(std::numeric_limits<uint32_t>::max());
+                    FramePool::Lease block = client -> getFramePool().take(std::min<size_t>(FILE_DECRYPT_BLOCK, reader.contentRemaining()));
+                    for (size_t size = reader.readContent(block.data(), block.size()); size > 0; size = reader.readContent(block.data(), block.size())) {
+                        Metrics::Span decrypt(Metrics::Stage::DECRYPT);
+                        const std::string& plain = decryptor.update(reinterpret_cast<const char*>(block.data()), size);
+                        decrypt.stop();
+                        writePlain(outFile, decompressor, plain.data(), plain.size());
+                    }
+                    Metrics::Span decrypt(Metrics::Stage::DECRYPT);
+                    const std::string& plain = decryptor.final();
+                    decrypt.stop();
+                    writePlain(outFile, decompressor, plain.data(), plain.size());
+                    if (decompressor.has_value())   outFile << decompressor.value().final();
+                    outFile.close();
+                    stringcontent = built = "File saved to " + path;
+                }catch (const std::exception& e){
+                    discardFile(outFile, path);
+                    stringcontent= "Can't decrypt message.";
+                }
+            }
+            break;
+        }
+        /* File received in GCM frames, a batch of frames (one per core) is verified and decrypted at once */
+        case 5:{
+            if (!user.getAESWrapper().has_value())  stringcontent="Can't decrypt message.";
+
+            else {
+                std::string path;                                               // Removed again if the file fails
+                std::ofstream outFile;
+                try{
+                    FramedAES frames(user.getAESWrapper().value());
+                    std::array<unsigned char, FramedAES::HEADER_SIZE> header;
+                    if (reader.readContent(header.data(), header.size()) != header.size())
+                        throw std::runtime_error(YELLOW "Incomplete message" RESET);
+                    frames.readHeader(header.data());
+
+                    path = createTempFile();
+                    outFile.open(path, std::ios::binary);
+                    if (!outFile)   throw std::runtime_error(YELLOW "Failed to open the temporary file at " RESET + path);
+
+                    /* Batches are whole frames, the content ends with the short last frame */
+                    FramePool::Lease batch = client -> getFramePool().take(frames.batchFrames() * (frames.getFrameSize() + FramedAES::TAG_SIZE));
+                    FramePool::Lease plain = client -> getFramePool().take(frames.batchFrames() * frames.getFrameSize());
+                    std::optional<Compression::StreamDecompressor> decompressor;
+                    if (compressed)     decompressor.emplace(std::numeric_limits<uint32_t>::max());
+                    for (uint32_t firstFrame = 0; ; firstFrame += static_cast<uint32_t>(frames.batchFrames())) {
+                        bool last = reader.contentRemaining() <= batch.size();
+                        size_t size = reader.readContent(batch.data(), batch.size());
+                        Metrics::Span decrypt(Metrics::Stage::DECRYPT);
+                        size_t plainSize = frames.decryptFrames(batch.data(), size, firstFrame, last, plain.data());
+                        decrypt.stop();
+                        writePlain(outFile, decompressor, reinterpret_cast<const char*>(plain.data()), plainSize);
+                        if (last)   break;
+                    }
+                    if (decompressor.has_value())   outFile << decompressor.value().final();
+                    outFile.close();
+                    stringcontent = built = "File saved to " + path;
+                }catch (const std::exception& e){
+                    discardFile(outFile, path);
+                    stringcontent= "Can't decrypt message.";
+                }
+            }
+            break;
+        }
+        default:{
+            stringcontent = built = binaryToStr(reader.content());
+            break;
+        }
+    }
+    if (onMessage) {
+        onMessage(user, static_cast<MessageType>(record.type & ~MESSAGE_COMPRESSED), stringcontent);
+        return;
+    }
+    std::cout << RED  "FROM:\t"  RESET << user.getUsername() << std::endl;
+    std::cout << RED "CONTENT: " RESET << stringcontent << std::endl;
+}
@@ -0,0 +1,386 @@
+#include "../../include/SessionManager.h"
+#include "../../include/Client.h"
+#include "../../include/Compression.h"
+#include "../../include/Helpers.h"
+#include "../../include/Logger.h"
+#include "../../include/Metrics.h"
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <limits>
+#include <optional>
+#include <utility>
+
+/* A request waiting for its response, and the member it was about (for a 602) */
+struct PendingRequest {
+    RequestOp op;
+    Uuid target;
+};
+
+/* One identity: its client (connection, member list and keys) and the requests queued on it. Only used on its strand. */
+struct SessionManager::Session {
+    Session(boost::asio::io_context& context, const std::string& server_ip, int server_port, const std::string& name, const std::string& keyCache)
+        : client(context, server_ip, server_port, keyCache), strand(boost::asio::make_strand(context)), queued(strand), name(name) {}
+
+    ProtocolManager& newRequest(RequestOp op, const Uuid& target = Uuid());     // Queues a request from the identity, with the header set
+    void sendMessage(const Uuid& target, MessageType type, std::string content, bool compressed = false);   // Queues a message with ready content (603)
+    void requestSync();                                                         // Queues a member list sync (608) from our version, unless one is waiting
+    void sendKey(ClientData& member);                                           // Makes a new symmetric key for member and queues it (type 2)
+    void deliver(ClientData& member, std::optional<std::string> text);          // Sends a text, or a symmetric key (nullopt), after the keys it needs
+
+    Client client;
+    boost::asio::strand<boost::asio::io_context::executor_type> strand;        // Everything of the session runs on it
+    boost::asio::steady_timer queued;                                           // Wakes the writer when a request was queued
+    std::string name;                                                           // Name of the identity
+    std::deque<ProtocolManager> outgoing;                                       // Requests not written yet, each owns the buffers of its frame
+    std::deque<PendingRequest> awaiting;                                        // Requests without a response, in order (the server answers a connection in order)
+    std::unordered_map<Uuid, std::vector<std::optional<std::string>>> parked;  // Waiting for the public key of a member: texts, or nullopt for a key he asked for
+    std::vector<std::pair<std::string, std::string>> unresolved;                // Texts to names not in our list, retried after the next sync
+    bool syncing = false;                                                       // A member list sync is waiting for its response
+    bool connected = false;
+    bool subscribed = false;
+    bool closed = false;                                                        // The connection ended, nothing is sent anymore
+};
+
+/* Queues a request, the writer is woken to send it */
+ProtocolManager& SessionManager::Session::newRequest(RequestOp op, const Uuid& target) {
+    ProtocolManager& request = outgoing.emplace_back();
+    request.setRequestHeader(client.getUser().value().getUUID(), PROTOCOL_VERSION, static_cast<uint16_t>(op));
+    request.setPayloadSize(0);
+    awaiting.push_back({op, target});
+    queued.cancel();
+    return request;
+}
+
+/* Queues a message to a target. The content is sent as is (it should already be encrypted), compressed sets MESSAGE_COMPRESSED. */
+void SessionManager::Session::sendMessage(const Uuid& target, MessageType type, std::string content, bool compressed) {
+    ProtocolManager& request = newRequest(RequestOp::REQ_SEND_MSG_TO_USR, target);
+    uint8_t typeByte = static_cast<uint8_t>(type) | (compressed ? MESSAGE_COMPRESSED : 0);
+    request.setMessageHeader(target, typeByte, static_cast<uint32_t>(content.size()));
+    request.setPayloadSize(static_cast<uint32_t>(request.getPayload().size() + content.size()));
+    request.setContent(std::move(content));
+}
+
+/* Asks for the members added / changed since the version we have (the first sync brings everyone) */
+void SessionManager::Session::requestSync() {
+    if (syncing)    return;
+    syncing = true;
+    std::array<unsigned char, WIRE_MAX_VARINT64> version;
+    WireWriter writer(version.data(), PROTOCOL_VERSION);
+    writer.u64(client.getMemberVersion());
+    ProtocolManager& request = newRequest(RequestOp::REQ_USER_LIST_SINCE);
+    request.setPayload(version.data(), writer.size());
+    request.setPayloadSize(static_cast<uint32_t>(writer.size()));
+}
+
+/* Makes a new symmetric key for member, and sends it encrypted with his public key */
+void SessionManager::Session::sendKey(ClientData& member) {
+    member.setNewSymmetric();
+    Metrics::Span encrypt(Metrics::Stage::ENCRYPT, static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR));
+    std::string key = member.getRSAPublicWrapper().value().encrypt(member.getAESWrapper().value().getKey());
+    encrypt.stop();
+    sendMessage(member.getUUID(), MessageType::SEND_SYMMETRIC_KEY, std::move(key));
+}
+
+/* Sends a text to member, or a new symmetric key if there is no text. A text without a symmetric key sends a new key first,
+    and without his public key both wait for it (the first one waiting asks the server for it). */
+void SessionManager::Session::deliver(ClientData& member, std::optional<std::string> text) {
+    bool needsKey = !text.has_value() || !member.getAESWrapper().has_value();
+    if (needsKey && !member.getRSAPublicWrapper().has_value()) {
+        std::vector<std::optional<std::string>>& waiting = parked[member.getUUID()];
+        if (waiting.empty()) {
+            ProtocolManager& request = newRequest(RequestOp::REQ_PUBLIC_KEY, member.getUUID());
+            request.setPayload(member.getUUID().data(), member.getUUID().size());
+            request.setPayloadSize(static_cast<uint32_t>(member.getUUID().size()));
+        }
+        waiting.push_back(std::move(text));
+        return;
+    }
+
+    if (needsKey)   sendKey(member);
+    if (!text.has_value())  return;
+
+    /* Deflated when it is worth it, then encrypted */
+    bool compressed = Compression::compressInPlace(text.value());
+    Metrics::Span encrypt(Metrics::Stage::ENCRYPT, static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR));
+    std::string cipher = member.getAESWrapper().value().encrypt(text.value());
+    encrypt.stop();
+    sendMessage(member.getUUID(), MessageType::SEND_TEXT_MSG, std::move(cipher), compressed);
+}
+
+/* Makes an empty manager, the threads only start with start() */
+SessionManager::SessionManager(const std::string& server_ip, int server_port, size_t threads)
+    : work(boost::asio::make_work_guard(io_context)), server_ip(server_ip), server_port(server_port),
+      threadCount(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency())) {}
+
+SessionManager::~SessionManager() {
+    stop();
+}
+
+/* Adds a session for every identity file in directory (name, UUID in hex and private key in base 64, like me.info).
+    Files that are not an identity are reported and skipped. The public keys an identity receives are cached next to its file. */
+size_t SessionManager::loadIdentities(const std::string& directory) {
+    if (!threads.empty())   throw std::runtime_error(YELLOW "Identities must be loaded before the sessions start!" RESET);
+
+    std::vector<std::filesystem::path> files;
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory))
+        if (entry.is_regular_file() && entry.path().extension() == SESSION_IDENTITY_EXTENSION)
+            files.push_back(entry.path());
+    std::sort(files.begin(), files.end());
+
+    size_t loaded = 0;
+    for (const std::filesystem::path& file : files) {
+        try {
+            std::vector<std::string> info = getUserInfo(file.string());
+            if (info.size() != 3)   throw std::runtime_error("expected a name, a UUID and a private key");
+            if (sessionsByName.contains(info[0]))   throw std::runtime_error("the identity " + info[0] + " was already loaded");
+
+            std::filesystem::path keyCache = file;
+            keyCache.replace_extension(SESSION_KEY_CACHE_EXTENSION);
+            std::unique_ptr<Session> session = std::make_unique<Session>(io_context, server_ip, server_port, info[0], keyCache.string());
+            session -> client.setUser(info[0], info[1], info[2]);
+
+            Session* added = session.get();
+            added -> client.setMessageHandler([this, added](const ClientData& from, MessageType type, std::string_view content) {
+                received(*added, from, type, content);
+            });
+            sessionsByName[added -> name] = added;
+            sessions.push_back(std::move(session));
+            loaded++;
+        } catch (const std::exception& e) {
+            std::cerr << YELLOW "Skipped " RESET << file.string() << ": " << e.what() << std::endl;
+        }
+    }
+    return loaded;
+}
+
+/* Received messages go to handler, they are printed with the name of their identity otherwise */
+void SessionManager::setMessageHandler(MessageHandler handler) {
+    onMessage = std::move(handler);
+}
+
+/* Resolves the server once, starts every session on its strand and runs the context on the pool */
+void SessionManager::start() {
+    if (!threads.empty())   throw std::runtime_error(YELLOW "The sessions already started!" RESET);
+
+    boost::asio::ip::tcp::resolver resolver(io_context);
+    boost::asio::ip::tcp::resolver::results_type endpoints = resolver.resolve(server_ip, std::to_string(server_port));
+
+    for (const std::unique_ptr<Session>& session : sessions) {
+        boost::asio::co_spawn(session -> strand, run(*session, endpoints), [this, session = session.get()](std::exception_ptr e) {
+            try {
+                if (e)  std::rethrow_exception(e);
+            } catch (const boost::system::system_error& error) {
+                if (error.code() != boost::asio::error::operation_aborted)
+                    Logger::shared().write(LogLevel::WARN, session -> name + ": " + error.what());
+            } catch (const std::exception& error) {
+                /* A frame was not read to its end, the stream position is lost */
+                Logger::shared().write(LogLevel::WARN, session -> name + ": " + error.what());
+            }
+            close(*session);
+        });
+    }
+
+    for (size_t i = 0; i < threadCount; i++)
+        threads.emplace_back([this] { io_context.run(); });
+}
+
+/* Queues a text from identity to a member of its list. A member we do not know yet is looked up with a member list sync first.
+    The text is handed to the session right away, it is encrypted and sent on the pool. */
+void SessionManager::sendText(const std::string& identity, const std::string& member, std::string text) {
+    auto it = sessionsByName.find(identity);
+    if (it == sessionsByName.end())     throw std::runtime_error(YELLOW "No such identity: " RESET + identity);
+    if (text.size() >= std::numeric_limits<uint32_t>::max() - WIRE_MAX_MESSAGE_HEADER)     throw std::runtime_error(RED  "Message is to long! Shorten it."  RESET);
+
+    Session* session = it -> second;
+    boost::asio::post(session -> strand, [session, member, text = std::move(text)]() mutable {
+        if (session -> closed) {
+            Logger::shared().write(LogLevel::WARN, session -> name + ": not connected, the text to " + member + " was dropped");
+            return;
+        }
+        try {
+            ClientData* target = session -> client.findMember(member);
+            if (target != nullptr)  session -> deliver(*target, std::move(text));
+            else {
+                session -> unresolved.emplace_back(member, std::move(text));
+                session -> requestSync();
+            }
+        } catch (const std::exception& e) {
+            Logger::shared().write(LogLevel::WARN, session -> name + ": could not send to " + member + ": " + e.what());
+        }
+    });
+}
+
+/* Closes every session, and waits for the pool to finish what they were doing. A frame that already started is read to its end. */
+void SessionManager::stop() {
+    for (const std::unique_ptr<Session>& session : sessions)
+        boost::asio::post(session -> strand, [this, session = session.get()] { close(*session); });
+    work.reset();
+    for (std::thread& thread : threads)     thread.join();
+    threads.clear();
+}
+
+/* Returns the amount of sessions loaded */
+size_t SessionManager::size() const {
+    return sessions.size();
+}
+
+/* Returns the amount of sessions connected now */
+size_t SessionManager::connected() const {
+    return connectedSessions.load(std::memory_order_relaxed);
+}
+
+/* Returns the amount of sessions the server pushes to now */
+size_t SessionManager::subscribed() const {
+    return subscribedSessions.load(std::memory_order_relaxed);
+}
+
+/* Connects, queues the member list sync and the subscription, and reads responses until the connection ends.
+    Responses are matched to the requests in order, pushed frames (2108) can come between them at any time. */
+boost::asio::awaitable<void> SessionManager::run(Session& session, boost::asio::ip::tcp::resolver::results_type endpoints) {
+    Client& client = session.client;
+    Metrics::Span connect(Metrics::Stage::CONNECT, 0);
+    co_await boost::asio::async_connect(client.getSocket(), endpoints, boost::asio::use_awaitable);
+    connect.stop();
+    session.connected = true;
+    connectedSessions++;
+    Logger::shared().write(LogLevel::DEBUG, session.name + ": connected");
+
+    boost::asio::co_spawn(session.strand, writer(session), [this, &session](std::exception_ptr e) {
+        try {
+            if (e)  std::rethrow_exception(e);
+        } catch (const boost::system::system_error& error) {
+            if (error.code() != boost::asio::error::operation_aborted)
+                Logger::shared().write(LogLevel::WARN, session.name + ": " + error.what());
+        }
+        close(session);
+    });
+    session.requestSync();
+    session.newRequest(RequestOp::REQ_SUBSCRIBE);
+
+    ResponseHeader header;
+    while (true) {
+        co_await boost::asio::async_read(client.getSocket(), boost::asio::buffer(&header, sizeof(ResponseHeader)), boost::asio::use_awaitable);
+        if (static_cast<ResponseOp>(header.responseOp) == ResponseOp::RESP_PUSHED_MESSAGES) {
+            client.receivePushed(header);
+            continue;
+        }
+        if (session.awaiting.empty())
+            throw std::runtime_error("Unexpected response " + std::to_string(header.responseOp) + ", no request is waiting");
+
+        FramePool::Lease payload = client.getFramePool().take(header.payloadSize);
+        co_await boost::asio::async_read(client.getSocket(), boost::asio::buffer(payload.data(), payload.size()), boost::asio::use_awaitable);
+        Metrics::count(Metrics::Counter::RESPONSES);
+        Metrics::count(Metrics::Counter::BYTES_RECEIVED, sizeof(ResponseHeader) + payload.size());
+
+        PendingRequest request = session.awaiting.front();
+        session.awaiting.pop_front();
+        handleResponse(session, request.op, request.target, header, std::span<const unsigned char>(payload.data(), payload.size()));
+    }
+}
+
+/* Writes the queued requests one by one, and waits for more while there are none */
+boost::asio::awaitable<void> SessionManager::writer(Session& session) {
+    while (!session.closed) {
+        if (session.outgoing.empty()) {
+            boost::system::error_code ec;
+            session.queued.expires_at(boost::asio::steady_timer::time_point::max());
+            co_await session.queued.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+            continue;
+        }
+        ProtocolManager& request = session.outgoing.front();
+        Metrics::Span span(Metrics::Stage::SEND, request.getRequestHeader().requestOp);
+        size_t size = co_await boost::asio::async_write(session.client.getSocket(), request.createMessage(), boost::asio::use_awaitable);
+        span.stop();
+        Metrics::count(Metrics::Counter::BYTES_SENT, size);
+        session.outgoing.pop_front();
+    }
+}
+
+/* Handles the response to a request of the session. A failed request only loses what waited for it,
+    a response that makes no sense ends the session. */
+void SessionManager::handleResponse(Session& session, RequestOp request, const Uuid& target, const ResponseHeader& header, std::span<const unsigned char> payload) {
+    Client& client = session.client;
+    switch (static_cast<ResponseOp>(header.responseOp)) {
+        /* Merges the changed members, and sends the texts that waited for them */
+        case ResponseOp::RESP_USER_LIST_SINCE: {
+            std::vector<std::pair<Uuid, std::string>> changed;
+            uint64_t version = ProtocolManager::parseMemberSync(payload, header.version, changed);
+            for (const auto& [UUID, username] : changed)    client.mergeMember(UUID, username);
+            client.setMemberVersion(version);
+            session.syncing = false;
+
+            for (auto& [member, text] : std::exchange(session.unresolved, {})) {
+                ClientData* found = client.findMember(member);
+                if (found != nullptr)   session.deliver(*found, std::move(text));
+                else    Logger::shared().write(LogLevel::WARN, session.name + ": no member named " + member + ", the text was dropped");
+            }
+            break;
+        }
+        /* Stores the key, and sends what waited for it */
+        case ResponseOp::RESP_PUBLIC_KEY: {
+            if (payload.size() <= Uuid::SIZE)   throw std::runtime_error(RED  "Invalid payload size for public key response!"  RESET);
+            ClientData& member = client.findUser(Uuid::fromBytes(payload.data()));
+            client.cachePublicKey(member, std::string(payload.begin() + Uuid::SIZE, payload.end()));
+
+            auto waiting = session.parked.extract(member.getUUID());
+            if (!waiting.empty())
+                for (std::optional<std::string>& text : waiting.mapped())   session.deliver(member, std::move(text));
+            break;
+        }
+        case ResponseOp::RESP_MSG_SENT_TO_USER:
+            break;
+        case ResponseOp::RESP_SUBSCRIBED: {
+            session.subscribed = true;
+            subscribedSessions++;
+            Logger::shared().write(LogLevel::DEBUG, session.name + ": subscribed");
+            break;
+        }
+        case ResponseOp::RESP_GENERAL_ERROR: {
+            Logger::shared().write(LogLevel::WARN, session.name + ": the server failed request " + std::to_string(static_cast<uint16_t>(request)));
+            if (request == RequestOp::REQ_SUBSCRIBE)    throw std::runtime_error("Could not subscribe");
+            if (request == RequestOp::REQ_PUBLIC_KEY)   session.parked.erase(target);
+            if (request == RequestOp::REQ_USER_LIST_SINCE) {
+                session.syncing = false;
+                session.unresolved.clear();
+            }
+            break;
+        }
+        default:
+            throw std::runtime_error("Unexpected response " + std::to_string(header.responseOp) + " to request " + std::to_string(static_cast<uint16_t>(request)));
+    }
+}
+
+/* A message pushed to a session. A member that asks for a symmetric key gets a new one right away. */
+void SessionManager::received(Session& session, const ClientData& from, MessageType type, std::string_view content) {
+    if (type == MessageType::REQ_SYMMETRIC_KEY && !session.closed)
+        session.deliver(session.client.findUser(from.getUUID()), std::nullopt);
+
+    if (onMessage) {
+        onMessage(session.name, from, type, content);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(printing);
+    std::cout << RED "[" << session.name << "] FROM:\t" RESET << from.getUsername() << "\n"
+              << RED "CONTENT: " RESET << content << std::endl;
+}
+
+/* Closes the connection of a session and stops its writer, on its strand. Nothing queued afterwards is sent. */
+void SessionManager::close(Session& session) {
+    if (session.connected)  connectedSessions--;
+    if (session.subscribed)     subscribedSessions--;
+    session.connected = session.subscribed = false;
+    session.closed = true;
+    boost::system::error_code ignored;
+    session.client.getSocket().close(ignored);
+    session.queued.cancel();
+}
@@ -1,27 +1,25 @@
 #include "../../include/User.h"
+#include "../../include/KeyPool.h"
 
 /* Creates a user from existing info in my.info 
     We already have a private key, and a public key stored in the database, 
     therefor we only initialize the decryptor. */
 User::User(const std::string& name,const std::string& uuid,const std::string& base64Key) 
     : name(name) {
+        std::string_view hex(uuid);
+        hex = hex.substr(0, hex.find_last_not_of(" \t\r") + 1);                 // A file edited by hand may have trailing blanks
+        std::optional<Uuid> parsed = Uuid::fromHex(hex);
+        if (!parsed.has_value())    throw std::runtime_error("Invalid UUID in me.info, expected 32 hex digits");
+        UUID = parsed.value();
         decryptor.emplace(Base64Wrapper::decode(base64Key));
-        for (size_t i = 0 ; i < 16; i ++){
-            std::stringstream ss;
-            ss << std::hex << uuid.substr(i*2,2);
-            int byte;
-            ss >> byte;
-            UUID[i] = static_cast<uint8_t>(byte);
-        }
         // does not initiate encryptor! Since encryptor is going to hold target public key.
     }
 
-/* Creates a new encryptor and decryptor, since we need to store both for new user. */
+/* Creates a new decryptor for a new user. The key pair comes ready from the key pool (generated in the background),
+    so the user does not wait for a key generation at the register prompt. */
 User::User(const std::string& name)
     : name(name){ 
-        RSAPrivateWrapper rsapriv;
-        std::string pubkey = rsapriv.getPublicKey();
-        decryptor.emplace(rsapriv.getPrivateKey());
+        decryptor.emplace(KeyPool::shared().take());
         // does not initiate encryptor! Since encryptor is going to hold target public key.
     }
 
@@ -36,11 +34,11 @@ const std::string& User::getName() const{
 }
 
 /* Returns the UUID of currently online user */
-const std::array<uint8_t, 16>& User::getUUID() const{
+const Uuid& User::getUUID() const{
     return UUID;
 }
 
 /* Sets the UUID of currently online user */
-void User::setUUID(const std::array<uint8_t, 16>& newUUID){
+void User::setUUID(const Uuid& newUUID){
     UUID = newUUID;
 }
@@ -4,13 +4,83 @@
 #include <aes.h>
 #include <filters.h>
 #include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <vector>
 #include <immintrin.h>	// _rdrand32_step
 
 
+/* Fixed IV (unsafe in real applications), used by every mode of the wrapper */
+static const CryptoPP::byte fixedIV[CryptoPP::AES::BLOCKSIZE] = {0};
+
+/*
+ * Returns the PKCS #7 padding length at the end of a decrypted message, every padding byte holds it.
+ * Throws InvalidCiphertext (like the StreamTransformationFilter) on a bad padding.
+ */
+static size_t paddingSize(const CryptoPP::byte* plain, size_t size) {
+    size_t padding = plain[size - 1];
+    if (padding == 0 || padding > CryptoPP::AES::BLOCKSIZE)
+        throw CryptoPP::InvalidCiphertext("AESWrapper: invalid PKCS #7 block padding found");
+    for (size_t i = size - padding; i < size; i++)
+        if (plain[i] != padding)
+            throw CryptoPP::InvalidCiphertext("AESWrapper: invalid PKCS #7 block padding found");
+    return padding;
+}
+
+/*
+ * Decrypts whole CBC blocks: plaintext block i is D(cipher[i]) xor cipher[i-1], previous stands for cipher[-1].
+ * No block waits for another one, so the ciphertext is split at block boundaries across threads (big inputs only),
+ * and every thread hands its blocks to the cipher at once, which runs 4-8 of them in parallel with AES-NI.
+ * out can not overlap cipher, the blocks before a split are still needed by the next thread.
+ */
+static void decryptBlocks(const CryptoPP::BlockCipher& aes, const CryptoPP::byte* previous, const CryptoPP::byte* cipher,
+                          CryptoPP::byte* out, size_t size, unsigned threads) {
+    constexpr size_t BLOCK = CryptoPP::AES::BLOCKSIZE;
+    auto decryptSegment = [&](size_t offset, size_t length) {
+        aes.ProcessAndXorBlock(cipher + offset, offset ? cipher + offset - BLOCK : previous, out + offset);
+        if (length > BLOCK)
+            aes.AdvancedProcessBlocks(cipher + offset + BLOCK, cipher + offset, out + offset + BLOCK, length - BLOCK,
+                                      CryptoPP::BlockTransformation::BT_AllowParallel);
+    };
+    if (size == 0)  return;
+
+    if (threads == 0)   threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t segments = std::min<size_t>(threads, size / AESWrapper::BULK_THREAD_MIN);
+    if (segments <= 1) {
+        decryptSegment(0, size);
+        return;
+    }
+
+    /* Every segment is a whole amount of blocks, the last one takes the rest */
+    size_t segmentSize = (size / BLOCK / segments) * BLOCK;
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < segments; i++)
+        workers.emplace_back(decryptSegment, i * segmentSize, i == segments - 1 ? size - i * segmentSize : segmentSize);
+    decryptSegment(0, segmentSize);
+    for (std::thread& worker : workers)     worker.join();
+}
+
+/*
+ * The expanded key schedules. Building these is the expensive part of a call, so it is done once per key.
+ * Nothing writes to them once built, so any number of threads can use them at once (decryptBlocks does).
+ * The CBC modes keep chaining state, every wrapper has its own over the schedule and only resynchronizes them.
+ */
+struct AESWrapper::KeySchedule {
+    KeySchedule(const std::string& key)
+        : encryption(reinterpret_cast<const CryptoPP::byte*>(key.data()), DEFAULT_KEYLENGTH),
+          decryption(reinterpret_cast<const CryptoPP::byte*>(key.data()), DEFAULT_KEYLENGTH) {}
+
+    CryptoPP::AES::Encryption encryption;
+    CryptoPP::AES::Decryption decryption;
+};
+
 /*
  * Default constructor: Generates a new random 128-bit AES key.
  */
-AESWrapper::AESWrapper() : _key(GenerateKey()) {}
+AESWrapper::AESWrapper() : _key(GenerateKey()), _schedule(std::make_shared<KeySchedule>(_key)) {
+    bindModes();
+}
 
 /*
  * Constructor: Initializes AES with an existing key.
@@ -20,6 +90,32 @@ AESWrapper::AESWrapper(const std::string& key) {
     if (key.size() != DEFAULT_KEYLENGTH) 
         throw std::length_error("Key length must be 16 bytes (128 bits)");
     _key = key;
+    _schedule = std::make_shared<KeySchedule>(_key);
+    bindModes();
+}
+
+/*
+ * Copy constructor: shares the key schedule, the copy gets CBC modes of its own so it can be used on another thread.
+ */
+AESWrapper::AESWrapper(const AESWrapper& other) : _key(other._key), _schedule(other._schedule) {
+    bindModes();
+}
+
+AESWrapper& AESWrapper::operator=(const AESWrapper& other) {
+    if (this != &other) {
+        _key = other._key;
+        _schedule = other._schedule;
+        bindModes();
+    }
+    return *this;
+}
+
+/*
+ * Points the CBC modes of this wrapper at the key schedule.
+ */
+void AESWrapper::bindModes() {
+    _cbcEncryption.SetCipherWithIV(_schedule -> encryption, fixedIV);
+    _cbcDecryption.SetCipherWithIV(_schedule -> decryption, fixedIV);
 }
 
 
@@ -44,16 +140,8 @@ const std::string& AESWrapper::getKey() const { return _key;}
  * Returns the encrypted ciphertext as a std::string.
  */
 std::string AESWrapper::encrypt(const std::string& plain) const{
-    CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = {0}; // Fixed IV (unsafe in real applications)
-    
-    CryptoPP::AES::Encryption aesEncryption(reinterpret_cast<const CryptoPP::byte*>(_key.data()), DEFAULT_KEYLENGTH);
-    CryptoPP::CBC_Mode_ExternalCipher::Encryption cbcEncryption(aesEncryption, iv);
-
-    std::string cipher;
-    CryptoPP::StreamTransformationFilter stfEncryptor(cbcEncryption, new CryptoPP::StringSink(cipher));
-    stfEncryptor.Put(reinterpret_cast<const CryptoPP::byte*>(plain.data()), plain.size());
-    stfEncryptor.MessageEnd();
-
+    std::string cipher(cipherSize(plain.size()), '\0');
+    encrypt(reinterpret_cast<const unsigned char*>(plain.data()), plain.size(), reinterpret_cast<unsigned char*>(cipher.data()));
     return cipher;
 }
 
@@ -62,15 +150,156 @@ std::string AESWrapper::encrypt(const std::string& plain) const{
  * Returns the decrypted plaintext as a std::string.
  */
 std::string AESWrapper::decrypt(const std::string& cipher) const{
-    CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = {0}; // Fixed IV (unsafe in real applications)
-    
-    CryptoPP::AES::Decryption aesDecryption(reinterpret_cast<const CryptoPP::byte*>(_key.data()), DEFAULT_KEYLENGTH);
-    CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption, iv);
+    std::string decrypted(cipher.size(), '\0');
+    decrypted.resize(decrypt(reinterpret_cast<const unsigned char*>(cipher.data()), cipher.size(), reinterpret_cast<unsigned char*>(decrypted.data())));
+    return decrypted;
+}
 
-    std::string decrypted;
-    CryptoPP::StreamTransformationFilter stfDecryptor(cbcDecryption, new CryptoPP::StringSink(decrypted));
-    stfDecryptor.Put(reinterpret_cast<const CryptoPP::byte*>(cipher.data()), cipher.size());
-    stfDecryptor.MessageEnd();
+/*
+ * Encrypts size bytes of plain into out with PKCS #7 padding, same output as the StreamTransformationFilter.
+ * out must hold cipherSize(size) bytes and may be the same buffer as plain. Returns the ciphertext size.
+ */
+size_t AESWrapper::encrypt(const unsigned char* plain, size_t size, unsigned char* out) const{
+    constexpr size_t BLOCK = CryptoPP::AES::BLOCKSIZE;
+    _cbcEncryption.Resynchronize(fixedIV);
 
-    return decrypted;
+    /* Whole blocks go straight from plain to out, the remainder is padded in a block of our own */
+    size_t whole = size - size % BLOCK;
+    size_t remainder = size - whole;
+    CryptoPP::byte last[BLOCK];
+    std::memcpy(last, plain + whole, remainder);
+    std::memset(last + remainder, static_cast<int>(BLOCK - remainder), BLOCK - remainder);
+
+    if (whole)  _cbcEncryption.ProcessData(out, plain, whole);
+    _cbcEncryption.ProcessData(out + whole, last, BLOCK);
+    return whole + BLOCK;
+}
+
+/*
+ * Decrypts size bytes of cipher into out and removes the PKCS #7 padding.
+ * out must hold size bytes and may be the same buffer as cipher. Returns the plaintext size.
+ * Throws InvalidCiphertext (like the StreamTransformationFilter) on a bad size or padding.
+ */
+size_t AESWrapper::decrypt(const unsigned char* cipher, size_t size, unsigned char* out) const{
+    constexpr size_t BLOCK = CryptoPP::AES::BLOCKSIZE;
+    if (size == 0 || size % BLOCK != 0)
+        throw CryptoPP::InvalidCiphertext("AESWrapper: ciphertext length is not a multiple of block size");
+
+    _cbcDecryption.Resynchronize(fixedIV);
+    _cbcDecryption.ProcessData(out, cipher, size);
+    return size - paddingSize(out, size);
+}
+
+/*
+ * Decrypts a big ciphertext (received files) into out, same result as decrypt().
+ * Every BULK_THREAD_MIN bytes can get a thread of their own, up to threads (0 for every core).
+ * out must hold size bytes and can not overlap cipher. Returns the plaintext size.
+ */
+size_t AESWrapper::decryptBulk(const unsigned char* cipher, size_t size, unsigned char* out, unsigned threads) const{
+    if (size == 0 || size % CryptoPP::AES::BLOCKSIZE != 0)
+        throw CryptoPP::InvalidCiphertext("AESWrapper: ciphertext length is not a multiple of block size");
+
+    decryptBlocks(_schedule -> decryption, fixedIV, cipher, out, size, threads);
+    return size - paddingSize(out, size);
+}
+
+/*
+ * Returns the ciphertext size of a plaintext, PKCS padding always adds 1 to 16 bytes.
+ */
+size_t AESWrapper::cipherSize(size_t plainSize) {
+    return (plainSize / CryptoPP::AES::BLOCKSIZE + 1) * CryptoPP::AES::BLOCKSIZE;
+}
+
+/*
+ * Streaming encryptor: same key schedule, IV and padding as encrypt(), but fed block by block.
+ * It has its own CBC mode (its own chaining state) over the key schedule of the wrapper.
+ */
+AESWrapper::StreamEncryptor::StreamEncryptor(const AESWrapper& aes)
+    : _schedule(aes._schedule), _cbc(_schedule -> encryption, fixedIV) {
+    _filter = std::make_unique<CryptoPP::StreamTransformationFilter>(_cbc, new CryptoPP::StringSink(_out));
+}
+
+/*
+ * Encrypts the next plaintext block. Returns only the ciphertext produced by this call.
+ */
+const std::string& AESWrapper::StreamEncryptor::update(const char* plain, size_t size) {
+    _out.clear();
+    _filter -> Put(reinterpret_cast<const CryptoPP::byte*>(plain), size);
+    return _out;
+}
+
+/*
+ * Pads and encrypts what is left. The encryptor can not be used after this.
+ */
+const std::string& AESWrapper::StreamEncryptor::final() {
+    _out.clear();
+    _filter -> MessageEnd();
+    return _out;
+}
+
+/*
+ * Streaming decryptor: the counterpart of StreamEncryptor. It works on the key schedule of the wrapper directly,
+ * the CBC chaining is the last ciphertext block it decrypted.
+ */
+AESWrapper::StreamDecryptor::StreamDecryptor(const AESWrapper& aes, unsigned threads)
+    : _schedule(aes._schedule), _threads(threads) {
+    std::memcpy(_previous, fixedIV, sizeof(_previous));
+}
+
+/*
+ * Decrypts the next ciphertext block. Returns only the plaintext produced by this call.
+ * 1 to 16 bytes are always kept pending, so the last block (with the padding) is left for final().
+ */
+const std::string& AESWrapper::StreamDecryptor::update(const char* cipher, size_t size) {
+    constexpr size_t BLOCK = CryptoPP::AES::BLOCKSIZE;
+    const CryptoPP::byte* in = reinterpret_cast<const CryptoPP::byte*>(cipher);
+    _out.clear();
+
+    size_t total = _pendingSize + size;
+    if (total <= BLOCK) {
+        std::memcpy(_pending + _pendingSize, in, size);
+        _pendingSize = total;
+        return _out;
+    }
+
+    _out.resize((total - 1) / BLOCK * BLOCK);
+    CryptoPP::byte* out = reinterpret_cast<CryptoPP::byte*>(_out.data());
+    size_t ready = _out.size();
+
+    /* A partial block from the last call is completed with the first new bytes */
+    if (_pendingSize) {
+        size_t missing = BLOCK - _pendingSize;
+        std::memcpy(_pending + _pendingSize, in, missing);
+        _schedule -> decryption.ProcessAndXorBlock(_pending, _previous, out);
+        std::memcpy(_previous, _pending, BLOCK);
+        in += missing;
+        size -= missing;
+        out += BLOCK;
+        ready -= BLOCK;
+    }
+
+    /* The rest of the whole blocks are decrypted straight from the input */
+    if (ready) {
+        decryptBlocks(_schedule -> decryption, _previous, in, out, ready, _threads);
+        std::memcpy(_previous, in + ready - BLOCK, BLOCK);
+    }
+    _pendingSize = size - ready;
+    std::memcpy(_pending, in + ready, _pendingSize);
+    return _out;
+}
+
+/*
+ * Decrypts the last block and strips the padding. Throws if the size or the padding is invalid.
+ */
+const std::string& AESWrapper::StreamDecryptor::final() {
+    constexpr size_t BLOCK = CryptoPP::AES::BLOCKSIZE;
+    _out.clear();
+    if (_pendingSize != BLOCK)
+        throw CryptoPP::InvalidCiphertext("AESWrapper: ciphertext length is not a multiple of block size");
+
+    CryptoPP::byte plain[BLOCK];
+    _schedule -> decryption.ProcessAndXorBlock(_pending, _previous, plain);
+    _out.assign(reinterpret_cast<const char*>(plain), BLOCK - paddingSize(plain, BLOCK));
+    _pendingSize = 0;
+    return _out;
 }
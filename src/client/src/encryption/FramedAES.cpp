@@ -0,0 +1,183 @@
+#include "../../include/FramedAES.h"
+#include <boost/endian/conversion.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <immintrin.h>	// _rdrand32_step
+
+/* Size of a GCM nonce: the nonce prefix and the frame index */
+constexpr size_t NONCE_SIZE = FramedAES::NONCE_PREFIX_SIZE + sizeof(uint32_t);
+
+/* Authenticated data of a frame: the content header and the 'last frame' byte */
+constexpr size_t AAD_SIZE = FramedAES::HEADER_SIZE + 1;
+
+/*
+ * Runs function(worker) on workers threads, the calling thread is worker 0.
+ */
+template <typename Function>
+static void forEachWorker(size_t workers, Function function) {
+    std::vector<std::thread> threads;
+    for (size_t worker = 1; worker < workers; worker++)
+        threads.emplace_back(function, worker);
+    function(0);
+    for (std::thread& thread : threads)     thread.join();
+}
+
+/*
+ * Frames under the key of aes. The GCM contexts are made on first use, one per worker.
+ */
+FramedAES::FramedAES(const AESWrapper& aes, unsigned threads)
+    : _key(aes.getKey()), _threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())) {}
+
+/*
+ * Returns the content size of a file: the header, the file and a tag for every frame (the last frame is always shorter).
+ */
+uint64_t FramedAES::contentSize(uint64_t plainSize, size_t frameSize) {
+    return HEADER_SIZE + plainSize + (plainSize / frameSize + 1) * TAG_SIZE;
+}
+
+/*
+ * Returns the amount of frames encrypted / decrypted at once, a batch gives every worker one frame.
+ * The frame size comes from the sender (up to MAX_FRAME_SIZE), so a batch is also capped at BATCH_BUDGET bytes
+ * of frames, and is never less than one frame.
+ */
+size_t FramedAES::batchFrames() const {
+    return std::max<size_t>(1, std::min<size_t>(_threads, BATCH_BUDGET / _frameSize));
+}
+
+/*
+ * Returns the plaintext bytes in every frame except the last one.
+ */
+size_t FramedAES::getFrameSize() const {
+    return _frameSize;
+}
+
+/*
+ * Picks a random nonce prefix (RDRAND) for a new file, so no two files share a nonce under the same key.
+ * Returns the header to send before the frames.
+ */
+std::string FramedAES::newHeader(size_t frameSize) {
+    if (frameSize == 0 || frameSize > MAX_FRAME_SIZE)
+        throw std::invalid_argument("FramedAES: invalid frame size");
+    _frameSize = static_cast<uint32_t>(frameSize);
+    for (size_t i = 0; i < NONCE_PREFIX_SIZE; i += sizeof(unsigned int))
+        _rdrand32_step(reinterpret_cast<unsigned int*>(&_noncePrefix[i]));
+
+    std::string header(HEADER_SIZE, '\0');
+    uint32_t size = boost::endian::native_to_little(_frameSize);
+    std::memcpy(header.data(), &size, sizeof(size));
+    std::memcpy(header.data() + sizeof(size), _noncePrefix, NONCE_PREFIX_SIZE);
+    return header;
+}
+
+/*
+ * Reads the frame size and nonce prefix of received content. Throws if the frame size is not one we accept.
+ */
+void FramedAES::readHeader(const unsigned char* header) {
+    uint32_t size;
+    std::memcpy(&size, header, sizeof(size));
+    size = boost::endian::little_to_native(size);
+    if (size == 0 || size > MAX_FRAME_SIZE)
+        throw CryptoPP::InvalidCiphertext("FramedAES: invalid frame size");
+    _frameSize = size;
+    std::memcpy(_noncePrefix, header + sizeof(size), NONCE_PREFIX_SIZE);
+}
+
+/*
+ * The nonce of a frame: the prefix of the file and the frame index (big endian).
+ */
+void FramedAES::nonce(uint32_t frame, unsigned char* out) const {
+    std::memcpy(out, _noncePrefix, NONCE_PREFIX_SIZE);
+    uint32_t index = boost::endian::native_to_big(frame);
+    std::memcpy(out + NONCE_PREFIX_SIZE, &index, sizeof(index));
+}
+
+/*
+ * The authenticated data of a frame: the header, so frames can't be moved to another file, and if it is the last frame.
+ */
+void FramedAES::aad(bool lastFrame, unsigned char* out) const {
+    uint32_t size = boost::endian::native_to_little(_frameSize);
+    std::memcpy(out, &size, sizeof(size));
+    std::memcpy(out + sizeof(size), _noncePrefix, NONCE_PREFIX_SIZE);
+    out[HEADER_SIZE] = lastFrame ? 1 : 0;
+}
+
+/*
+ * Encrypts a batch of frames, starting at frame firstFrame of the file, into out (every frame followed by its tag).
+ * Only the last batch (last) may end with a partial frame, it always ends with the short last frame of the file.
+ * out must hold size + frames * TAG_SIZE bytes. Returns the bytes written.
+ */
+size_t FramedAES::encryptFrames(const unsigned char* plain, size_t size, uint32_t firstFrame, bool last, unsigned char* out) {
+    if (!last && size % _frameSize != 0)
+        throw std::invalid_argument("FramedAES: only the last batch can end with a partial frame");
+
+    size_t frames = size / _frameSize + (last ? 1 : 0);
+    size_t workers = std::min<size_t>(frames, _threads);
+    while (_encryptors.size() < workers) {
+        const unsigned char zeroNonce[NONCE_SIZE] = {0};
+        _encryptors.push_back(std::make_unique<CryptoPP::GCM<CryptoPP::AES>::Encryption>());
+        _encryptors.back() -> SetKeyWithIV(reinterpret_cast<const CryptoPP::byte*>(_key.data()), _key.size(), zeroNonce, NONCE_SIZE);
+    }
+
+    /* Worker w takes frames w, w + workers, ... */
+    forEachWorker(workers, [&](size_t worker) {
+        CryptoPP::GCM<CryptoPP::AES>::Encryption& gcm = *_encryptors[worker];
+        unsigned char frameNonce[NONCE_SIZE];
+        unsigned char frameAAD[AAD_SIZE];
+        for (size_t i = worker; i < frames; i += workers) {
+            bool lastFrame = last && i == frames - 1;
+            size_t length = lastFrame ? size - i * _frameSize : _frameSize;
+            unsigned char* frameOut = out + i * (_frameSize + TAG_SIZE);
+
+            nonce(firstFrame + static_cast<uint32_t>(i), frameNonce);
+            aad(lastFrame, frameAAD);
+            gcm.EncryptAndAuthenticate(frameOut, frameOut + length, TAG_SIZE, frameNonce, NONCE_SIZE,
+                                       frameAAD, AAD_SIZE, plain + i * _frameSize, length);
+        }
+    });
+    return size + frames * TAG_SIZE;
+}
+
+/*
+ * Decrypts and verifies a batch of frames (each followed by its tag), starting at frame firstFrame of the file.
+ * The last batch (last) ends with the short last frame. out must hold batchFrames() * getFrameSize() bytes.
+ * Returns the plaintext size. Throws InvalidCiphertext if any frame or tag was changed, out must not be used then.
+ */
+size_t FramedAES::decryptFrames(const unsigned char* cipher, size_t size, uint32_t firstFrame, bool last, unsigned char* out) {
+    size_t step = _frameSize + TAG_SIZE;
+    if (!last && size % step != 0)
+        throw std::invalid_argument("FramedAES: only the last batch can end with a partial frame");
+    if (last && size % step < TAG_SIZE)
+        throw CryptoPP::InvalidCiphertext("FramedAES: the last frame is incomplete");
+
+    size_t frames = size / step + (last ? 1 : 0);
+    size_t workers = std::min<size_t>(frames, _threads);
+    while (_decryptors.size() < workers) {
+        const unsigned char zeroNonce[NONCE_SIZE] = {0};
+        _decryptors.push_back(std::make_unique<CryptoPP::GCM<CryptoPP::AES>::Decryption>());
+        _decryptors.back() -> SetKeyWithIV(reinterpret_cast<const CryptoPP::byte*>(_key.data()), _key.size(), zeroNonce, NONCE_SIZE);
+    }
+
+    std::atomic<bool> verified = true;
+    forEachWorker(workers, [&](size_t worker) {
+        CryptoPP::GCM<CryptoPP::AES>::Decryption& gcm = *_decryptors[worker];
+        unsigned char frameNonce[NONCE_SIZE];
+        unsigned char frameAAD[AAD_SIZE];
+        for (size_t i = worker; i < frames && verified; i += workers) {
+            bool lastFrame = last && i == frames - 1;
+            size_t length = lastFrame ? size - i * step - TAG_SIZE : _frameSize;
+            const unsigned char* frameIn = cipher + i * step;
+
+            nonce(firstFrame + static_cast<uint32_t>(i), frameNonce);
+            aad(lastFrame, frameAAD);
+            if (!gcm.DecryptAndVerify(out + i * _frameSize, frameIn + length, TAG_SIZE, frameNonce, NONCE_SIZE,
+                                      frameAAD, AAD_SIZE, frameIn, length))
+                verified = false;
+        }
+    });
+
+    if (!verified)  throw CryptoPP::InvalidCiphertext("FramedAES: frame authentication failed");
+    return size - frames * TAG_SIZE;
+}
@@ -0,0 +1,68 @@
+#include "../../include/KeyPool.h"
+#include <algorithm>
+
+/* Starts the workers. There is no use in more workers than keys the pool can hold. */
+KeyPool::KeyPool(size_t capacity, unsigned threads) : capacity(std::max<size_t>(capacity, 1)) {
+    if (threads == 0)   threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t count = std::min<size_t>(threads, this -> capacity);
+    for (size_t i = 0; i < count; i++)
+        workers.emplace_back(&KeyPool::generate, this);
+}
+
+/* Wakes the workers up and waits for them, a key that is half generated is finished (and dropped) */
+KeyPool::~KeyPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    roomFreed.notify_all();
+    for (std::thread& worker : workers)     worker.join();
+}
+
+/* The pool the client registers with. It is small, the client needs one key per registration. */
+KeyPool& KeyPool::shared() {
+    static KeyPool pool(KEY_POOL_SIZE);
+    return pool;
+}
+
+/* Generates keys while the pool has room. The generation itself runs without the lock, every worker has its own RNG. */
+void KeyPool::generate() {
+    CryptoPP::AutoSeededRandomPool rng;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            roomFreed.wait(lock, [this]{ return stopping || keys.size() + generating < capacity; });
+            if (stopping)   return;
+            generating++;
+        }
+
+        CryptoPP::RSA::PrivateKey key;
+        key.Initialize(rng, RSAPrivateWrapper::BITS);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            generating--;
+            keys.push_back(std::move(key));
+        }
+        keyReady.notify_one();
+    }
+}
+
+/* Takes the oldest ready key, and lets a worker make a new one in its place */
+CryptoPP::RSA::PrivateKey KeyPool::take() {
+    CryptoPP::RSA::PrivateKey key;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        keyReady.wait(lock, [this]{ return !keys.empty(); });
+        key = std::move(keys.front());
+        keys.pop_front();
+    }
+    roomFreed.notify_one();
+    return key;
+}
+
+/* Returns the amount of keys ready to be taken */
+size_t KeyPool::ready() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return keys.size();
+}
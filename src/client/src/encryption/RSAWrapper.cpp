@@ -8,6 +8,7 @@
 RSAPublicWrapper::RSAPublicWrapper(const std::string& key){
 	CryptoPP::StringSource ss(key, true);
 	_publicKey.Load(ss);
+	_encryptor.AccessKey() = _publicKey;
 }
 
 /* Public key empty constructor */
@@ -18,18 +19,22 @@ std::string RSAPublicWrapper::getPublicKey() const{
 	return key;
 }
 
-/* Encrypts according to a given public key */
+/* Encrypts according to a given public key, with the encryptor of the key (no filters, one output allocation) */
 std::string RSAPublicWrapper::encrypt(const std::string& plain){
-	std::string cipher;
-	CryptoPP::RSAES_OAEP_SHA_Encryptor e(_publicKey);
-	CryptoPP::StringSource ss(plain, true, new CryptoPP::PK_EncryptorFilter(_rng, e, new CryptoPP::StringSink(cipher)));
+	if (plain.size() > _encryptor.FixedMaxPlaintextLength())
+		throw std::length_error("RSAPublicWrapper: message is too long for the key");
+
+	std::string cipher(_encryptor.CiphertextLength(plain.size()), '\0');
+	_encryptor.Encrypt(_rng, reinterpret_cast<const CryptoPP::byte*>(plain.data()), plain.size(), reinterpret_cast<CryptoPP::byte*>(cipher.data()));
 	return cipher;
 }
 
 /* Deep copy for operator = */
 RSAPublicWrapper& RSAPublicWrapper::operator=(const RSAPublicWrapper& rsapublic){
-	if (this != &rsapublic)
+	if (this != &rsapublic) {
 		this -> _publicKey = rsapublic._publicKey;
+		this -> _encryptor.AccessKey() = _publicKey;
+	}
 	return *this;
 }
 
@@ -40,12 +45,19 @@ RSAPublicWrapper& RSAPublicWrapper::operator=(const RSAPublicWrapper& rsapublic)
 /* Initializes a new private key */
 RSAPrivateWrapper::RSAPrivateWrapper(){
 	_privateKey.Initialize(_rng, BITS);
+	_decryptor.AccessKey() = _privateKey;
 }
 
 /* Private key constructor according to existing key (file) */
 RSAPrivateWrapper::RSAPrivateWrapper(const std::string& key){
 	CryptoPP::StringSource ss(key, true);
 	_privateKey.Load(ss);
+	_decryptor.AccessKey() = _privateKey;
+}
+
+/* Private key constructor according to a key generated elsewhere (KeyPool), no save / load round trip */
+RSAPrivateWrapper::RSAPrivateWrapper(const CryptoPP::RSA::PrivateKey& key) : _privateKey(key) {
+	_decryptor.AccessKey() = _privateKey;
 }
 
 /* Gets a private key */
@@ -65,18 +77,28 @@ std::string RSAPrivateWrapper::getPublicKey() const{
 	return key;
 }
 
-/* Decrpyts according to private key */
+/* Decrpyts according to private key. The decryptor is kept with the key, the private key holds its CRT values (p, q, dp, dq, u),
+	so every decryption is two half size exponentiations with nothing rebuilt. */
 std::string RSAPrivateWrapper::decrypt(std::string cipher) const{
-	std::string decrypted;
-	CryptoPP::RSAES_OAEP_SHA_Decryptor d(_privateKey);
-	CryptoPP::StringSource ss_cipher(cipher, true, new CryptoPP::PK_DecryptorFilter(_rng, d, new CryptoPP::StringSink(decrypted)));
+	size_t maxLength = _decryptor.MaxPlaintextLength(cipher.size());
+	if (maxLength == 0)
+		throw CryptoPP::InvalidCiphertext("RSAPrivateWrapper: invalid ciphertext length");
+
+	std::string decrypted(maxLength, '\0');
+	CryptoPP::DecodingResult result = _decryptor.Decrypt(_rng, reinterpret_cast<const CryptoPP::byte*>(cipher.data()), cipher.size(),
+														  reinterpret_cast<CryptoPP::byte*>(decrypted.data()));
+	if (!result.isValidCoding)
+		throw CryptoPP::InvalidCiphertext("RSAPrivateWrapper: invalid ciphertext");
+	decrypted.resize(result.messageLength);
 	return decrypted;
 }
 
 /* Deep copy for operator = */
 RSAPrivateWrapper& RSAPrivateWrapper::operator=(const RSAPrivateWrapper& rsaprivate){
-	if (this != &rsaprivate)
+	if (this != &rsaprivate) {
 		this -> _privateKey = rsaprivate._privateKey;
+		this -> _decryptor.AccessKey() = _privateKey;
+	}
 	return *this;
 }
 
@@ -1,8 +1,21 @@
 #include "../include/Client.h"
 #include "../include/Helpers.h"
+#include "../include/Metrics.h"
+#include <filesystem>
+
+#define METRICS_FILE_ENV "CLIENT_METRICS_FILE"                                  // Where the metrics are written (Prometheus text if it ends with .prom)
+#define METRICS_INTERVAL 10                                                     // Seconds between two writes of the metrics file
+
 /* Launches the client-server interaction */
 int main() {
     try {
+        /* The metrics are only written when asked for */
+        std::optional<Metrics::Exporter> metrics;
+        if (const char* path = std::getenv(METRICS_FILE_ENV)) {
+            Metrics::Format format = std::filesystem::path(path).extension() == ".prom" ? Metrics::Format::PROMETHEUS : Metrics::Format::STATS;
+            metrics.emplace(path, format, std::chrono::seconds(METRICS_INTERVAL));
+        }
+
         /* Grab server info from file, create a new client object and connect to server */
         auto [server_ip, server_port] = getServerInfo();
         Client client(server_ip, server_port);
@@ -15,6 +28,9 @@ int main() {
 
         if(!user_info.empty())
             client.setUser(user_info[0],user_info[1],user_info[2]);
+        /* No user yet, we start generating a key pair in the background while the menu is shown */
+        else
+            KeyPool::shared();
         
         /* Client Service Function */
         while (client.isConnected()) {
@@ -0,0 +1,404 @@
+#include "../include/Client.h"
+#include "../include/Helpers.h"
+#include "../include/KeyPool.h"
+#include "../include/Metrics.h"
+#include "../include/Pipeline.h"
+#include <algorithm>
+#include <barrier>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+
+/* LOAD GENERATOR (make msgbench ARGS="...")
+    Runs simulated clients against a running server.py, every client on its own connection and thread. Client i talks to client i + 1:
+        1. registers (600) with a key pair from a KeyPool (generated on every core before the run),
+        2. gets the member list (601) and the public key (602) of the next client,
+        3. sends it a new symmetric key (603, type 2), and pulls (604) the key of the previous client once everyone sent theirs,
+        4. sends --messages texts (603, type 3) at --rate messages per second, with sizes drawn from --sizes,
+           and pulls (604) every --pull-every messages, decrypting what arrived. A last pull is made once everyone is done.
+    A request is timed from the moment it was due until its response was read. With a rate, the moment it was due is its slot
+    in the schedule and not the moment it was sent, so a server that falls behind shows in the latencies instead of slowing the load.
+    The results are written to --out as JSON (one entry per op: count, errors, ops/s, MB/s, p50 / p99 / p999 / max in microseconds),
+    and printed as a table. The users are left registered on the server, run it on a scratch database.
+    --metrics also writes the client spans of every stage (serialize, encrypt, send, first byte...) of the whole run in the Prometheus text format.
+
+    ./msgbench.exe --clients 16 --messages 200 --rate 50 --sizes 128:80,4096:15,65536:5 --out results.json
+*/
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/* Command line options */
+struct Options {
+    std::string host;                                                           // Server address (server.info if not given)
+    int port = 0;
+    size_t clients = 8;                                                         // Simulated clients
+    size_t messages = 100;                                                      // Texts sent by every client
+    double rate = 0;                                                            // Texts per second per client, 0 for as fast as the server answers
+    size_t pullEvery = 10;                                                      // Texts sent between two pulls
+    std::string sizes = "128:80,4096:15,65536:5";                               // Text sizes, size:weight,...
+    std::string out = "msgbench.json";                                          // JSON results
+    std::string metrics;                                                        // Prometheus text of the client spans and counters, if given
+};
+
+/* Latencies of one op, recorded by a client and merged at the end */
+struct OpStats {
+    std::vector<double> micros;                                                 // Latency of every request that succeeded
+    uint64_t bytes = 0;                                                         // Request and response bytes
+    uint64_t errors = 0;                                                        // Requests the server answered with an error
+    Clock::time_point first = Clock::time_point::max();                         // When the first request was due
+    Clock::time_point last = Clock::time_point::min();                          // When the last response was read
+
+    void add(Clock::time_point due, Clock::time_point done, uint64_t size) {
+        micros.push_back(std::chrono::duration<double, std::micro>(done - due).count());
+        bytes += size;
+        first = std::min(first, due);
+        last = std::max(last, done);
+    }
+
+    void merge(const OpStats& other) {
+        micros.insert(micros.end(), other.micros.begin(), other.micros.end());
+        bytes += other.bytes;
+        errors += other.errors;
+        first = std::min(first, other.first);
+        last = std::max(last, other.last);
+    }
+};
+
+/* Text sizes and their weights */
+struct SizeDistribution {
+    std::vector<size_t> sizes;
+    std::discrete_distribution<size_t> pick;
+
+    explicit SizeDistribution(const std::string& spec) {
+        std::vector<double> weights;
+        std::stringstream entries(spec);
+        std::string entry;
+        while (std::getline(entries, entry, ',')) {
+            size_t colon = entry.find(':');
+            sizes.push_back(std::stoul(entry.substr(0, colon)));
+            weights.push_back(colon == std::string::npos ? 1.0 : std::stod(entry.substr(colon + 1)));
+        }
+        if (sizes.empty())  throw std::runtime_error("--sizes needs at least one size");
+        pick = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+    }
+
+    size_t next(std::mt19937& random) {
+        return sizes[pick(random)];
+    }
+};
+
+/* A simulated client: its connection, its user and what it measured */
+struct SimClient {
+    SimClient(const Options& options, size_t index, std::string name)
+        : client(options.host, options.port), index(index), name(std::move(name)), random(static_cast<uint32_t>(index)) {}
+
+    Client client;
+    size_t index;
+    std::string name;
+    Uuid uuid;
+    std::mt19937 random;
+    std::map<RequestOp, OpStats> stats;
+    uint64_t received = 0;                                                      // Texts pulled and decrypted
+    uint64_t receivedBytes = 0;                                                 // Plaintext bytes of those texts
+    uint64_t undecryptable = 0;                                                 // Texts pulled that did not decrypt
+    std::string failure;                                                        // Why the client stopped early (empty if it did not)
+};
+
+/* Shared by the clients of a run */
+struct Run {
+    const Options& options;
+    std::vector<std::unique_ptr<SimClient>> clients;
+    std::barrier<> phase;                                                       // Ends the registration, key exchange and sending phases
+    KeyPool& pool;
+    std::string text;                                                           // Texts are slices of it
+};
+
+const char* opName(RequestOp op) {
+    switch (op) {
+        case RequestOp::REQ_REGISTER:           return "register";
+        case RequestOp::REQ_USER_LIST:          return "user_list";
+        case RequestOp::REQ_PUBLIC_KEY:         return "public_key";
+        case RequestOp::REQ_SEND_MSG_TO_USR:    return "send_message";
+        case RequestOp::REQ_AWAITING_MESSAGES:  return "pull_messages";
+        default:                                return "other";
+    }
+}
+
+/* Sends a request and reads its response on the connection of sim, the time from due to the response is recorded for op */
+PipelineResult roundTrip(SimClient& sim, RequestOp op, ProtocolManager& request, Clock::time_point due) {
+    sim.client.sendMessage(request.createMessage());
+    PipelineResult result{op, {}, {}};
+    sim.client.receiveMessage(reinterpret_cast<unsigned char*>(&result.header), sizeof(ResponseHeader));
+    Metrics::count(Metrics::Counter::RESPONSES);
+    result.payload.resize(result.header.payloadSize);
+    sim.client.receiveMessage(result.payload.data(), result.payload.size());
+
+    OpStats& stats = sim.stats[op];
+    if (static_cast<ResponseOp>(result.header.responseOp) == ResponseOp::RESP_GENERAL_ERROR)     stats.errors++;
+    else    stats.add(due, Clock::now(), sizeof(RequestHeader) + request.getRequestHeader().payloadSize + sizeof(ResponseHeader) + result.payload.size());
+    return result;
+}
+
+/* Signs up with a key from the pool, and takes the user as ours like a me.info file would */
+void registerUser(Run& run, SimClient& sim) {
+    RSAPrivateWrapper key(run.pool.take());
+    ProtocolManager request;
+    request.setRequestHeader(Uuid(), PROTOCOL_VERSION, static_cast<uint16_t>(RequestOp::REQ_REGISTER));
+    request.setRegister(sim.name, key.getPublicKey());
+
+    PipelineResult result = roundTrip(sim, RequestOp::REQ_REGISTER, request, Clock::now());
+    if (static_cast<ResponseOp>(result.header.responseOp) != ResponseOp::RESP_REGISTER_SUCCESSFULL || result.payload.size() != Uuid::SIZE)
+        throw std::runtime_error("Could not register " + sim.name);
+    sim.uuid = Uuid::fromBytes(result.payload.data());
+    sim.client.setUser(sim.name, sim.uuid.hex(), Base64Wrapper::encode(key.getPrivateKey()));
+}
+
+/* Gets the member list and the public key of the next client, and sends him a new symmetric key */
+void exchangeKeys(Run& run, SimClient& sim) {
+    const SimClient& next = *run.clients[(sim.index + 1) % run.clients.size()];
+    const SimClient& previous = *run.clients[(sim.index + run.clients.size() - 1) % run.clients.size()];
+    sim.client.setMembers(next.uuid, next.name);
+    if (previous.index != next.index)   sim.client.setMembers(previous.uuid, previous.name);
+
+    ProtocolManager request;
+    request.setRequestHeader(sim.uuid, PROTOCOL_VERSION, static_cast<uint16_t>(RequestOp::REQ_USER_LIST));
+    request.setPayloadSize(0);
+    roundTrip(sim, RequestOp::REQ_USER_LIST, request, Clock::now());
+
+    request.setRequestHeader(sim.uuid, PROTOCOL_VERSION, static_cast<uint16_t>(RequestOp::REQ_PUBLIC_KEY));
+    request.setPayload(next.uuid.data(), next.uuid.size());
+    request.setPayloadSize(static_cast<uint32_t>(next.uuid.size()));
+    PipelineResult result = roundTrip(sim, RequestOp::REQ_PUBLIC_KEY, request, Clock::now());
+    if (static_cast<ResponseOp>(result.header.responseOp) != ResponseOp::RESP_PUBLIC_KEY || result.payload.size() <= Uuid::SIZE)
+        throw std::runtime_error("No public key for " + next.name);
+
+    ClientData& member = sim.client.findUser(next.uuid);
+    member.setPublic(std::string(result.payload.begin() + Uuid::SIZE, result.payload.end()));
+    member.setNewSymmetric();
+    Metrics::Span encrypt(Metrics::Stage::ENCRYPT, static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR));
+    std::string encryptedKey = member.getRSAPublicWrapper().value().encrypt(member.getAESWrapper().value().getKey());
+    encrypt.stop();
+
+    request.setRequestHeader(sim.uuid, PROTOCOL_VERSION, static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR));
+    request.setMessageHeader(next.uuid, static_cast<uint8_t>(MessageType::SEND_SYMMETRIC_KEY), static_cast<uint32_t>(encryptedKey.size()));
+    request.setPayloadSize(static_cast<uint32_t>(request.getPayload().size() + encryptedKey.size()));
+    request.setContent(std::move(encryptedKey));
+    roundTrip(sim, RequestOp::REQ_SEND_MSG_TO_USR, request, Clock::now());
+}
+
+/* Pulls the waiting messages, takes the symmetric keys and decrypts the texts */
+void pull(SimClient& sim) {
+    ProtocolManager request;
+    request.setRequestHeader(sim.uuid, PROTOCOL_VERSION, static_cast<uint16_t>(RequestOp::REQ_AWAITING_MESSAGES));
+    request.setPayloadSize(0);
+    PipelineResult result = roundTrip(sim, RequestOp::REQ_AWAITING_MESSAGES, request, Clock::now());
+
+    WireReader reader(result.payload, result.header.version);
+    Uuid fromID;
+    while (reader.remaining() > 0) {
+        Metrics::Span parse(Metrics::Stage::PARSE);
+        reader.uuid(fromID);
+        reader.u32();
+        uint8_t type = reader.u8();
+        std::string_view content = reader.view(reader.u32());
+        parse.stop();
+        Metrics::count(Metrics::Counter::MESSAGES_RECEIVED);
+        ClientData& member = sim.client.findUser(fromID);
+        try {
+            Metrics::Span decrypt(Metrics::Stage::DECRYPT);
+            if (type == static_cast<uint8_t>(MessageType::SEND_SYMMETRIC_KEY))
+                member.setSymmetric(sim.client.getUser().value().getDecryptor().value().decrypt(std::string(content)));
+            else if (type == static_cast<uint8_t>(MessageType::SEND_TEXT_MSG) && member.getAESWrapper().has_value()) {
+                sim.receivedBytes += member.getAESWrapper().value().decrypt(std::string(content)).size();
+                sim.received++;
+            }
+            else    sim.undecryptable++;
+        } catch (const std::exception& e) {
+            sim.undecryptable++;
+        }
+    }
+}
+
+/* Sends the texts on schedule to the next client, pulling every pullEvery texts */
+void sendMessages(Run& run, SimClient& sim) {
+    SizeDistribution sizes(run.options.sizes);
+    const SimClient& next = *run.clients[(sim.index + 1) % run.clients.size()];
+    const AESWrapper& aes = sim.client.findUser(next.uuid).getAESWrapper().value();
+
+    ProtocolManager request;
+    Clock::time_point start = Clock::now();
+    for (size_t message = 0; message < run.options.messages; message++) {
+        Clock::time_point due = Clock::now();
+        if (run.options.rate > 0) {
+            due = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(message / run.options.rate));
+            std::this_thread::sleep_until(due);
+        }
+        size_t size = std::min(sizes.next(sim.random), run.text.size());
+        size_t offset = std::uniform_int_distribution<size_t>(0, run.text.size() - size)(sim.random);
+        Metrics::Span encrypt(Metrics::Stage::ENCRYPT, static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR));
+        std::string cipher = aes.encrypt(run.text.substr(offset, size));
+        encrypt.stop();
+
+        request.setRequestHeader(sim.uuid, PROTOCOL_VERSION, static_cast<uint16_t>(RequestOp::REQ_SEND_MSG_TO_USR));
+        request.setMessageHeader(next.uuid, static_cast<uint8_t>(MessageType::SEND_TEXT_MSG), static_cast<uint32_t>(cipher.size()));
+        request.setPayloadSize(static_cast<uint32_t>(request.getPayload().size() + cipher.size()));
+        request.setContent(std::move(cipher));
+        roundTrip(sim, RequestOp::REQ_SEND_MSG_TO_USR, request, due);
+
+        if (run.options.pullEvery > 0 && (message + 1) % run.options.pullEvery == 0)     pull(sim);
+    }
+}
+
+/* Runs one simulated client through every phase. A client that fails drops out of the barriers, so the others go on. */
+void simulate(Run& run, SimClient& sim) {
+    size_t phases = 0;
+    try {
+        sim.client.connectToServer();
+        registerUser(run, sim);
+        run.phase.arrive_and_wait();    phases++;
+        exchangeKeys(run, sim);
+        run.phase.arrive_and_wait();    phases++;
+        pull(sim);
+        sendMessages(run, sim);
+        run.phase.arrive_and_wait();    phases++;
+        pull(sim);
+        sim.client.closeConnection();
+    } catch (const std::exception& e) {
+        sim.failure = e.what();
+        if (phases < 3)     run.phase.arrive_and_drop();
+    }
+}
+
+double percentile(const std::vector<double>& sorted, double fraction) {
+    if (sorted.empty())     return 0;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()))];
+}
+
+Options parseOptions(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if (i + 1 >= argc)  throw std::runtime_error("Missing value for " + option);
+        std::string value = argv[++i];
+        if (option == "--host")                 options.host = value;
+        else if (option == "--port")            options.port = std::stoi(value);
+        else if (option == "--clients")         options.clients = std::stoul(value);
+        else if (option == "--messages")        options.messages = std::stoul(value);
+        else if (option == "--rate")            options.rate = std::stod(value);
+        else if (option == "--pull-every")      options.pullEvery = std::stoul(value);
+        else if (option == "--sizes")           options.sizes = value;
+        else if (option == "--out")             options.out = value;
+        else if (option == "--metrics")         options.metrics = value;
+        else    throw std::runtime_error("Unknown option " + option);
+    }
+    if (options.clients == 0)   throw std::runtime_error("--clients must be at least 1");
+    if (options.host.empty()) {
+        auto [host, port] = getServerInfo();
+        options.host = host;
+        if (options.port == 0)  options.port = port;
+    }
+    SizeDistribution check(options.sizes);
+    return options;
+}
+
+/* Writes the merged results as JSON, and prints them as a table */
+void report(const Options& options, const std::vector<std::unique_ptr<SimClient>>& clients, double seconds) {
+    std::map<RequestOp, OpStats> merged;
+    uint64_t received = 0, receivedBytes = 0, undecryptable = 0, failed = 0;
+    for (const std::unique_ptr<SimClient>& sim : clients) {
+        for (const auto& [op, stats] : sim -> stats)    merged[op].merge(stats);
+        received += sim -> received;
+        receivedBytes += sim -> receivedBytes;
+        undecryptable += sim -> undecryptable;
+        if (!sim -> failure.empty()) {
+            failed++;
+            std::cerr << YELLOW "[FAILED] " RESET << sim -> name << ": " << sim -> failure << std::endl;
+        }
+    }
+
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(1);
+    json << "{\"clients\":" << options.clients << ",\"messages\":" << options.messages << ",\"rate\":" << options.rate
+         << ",\"sizes\":\"" << options.sizes << "\",\"seconds\":" << std::setprecision(3) << seconds << std::setprecision(1) << ",\"failed_clients\":" << failed
+         << ",\"received\":" << received << ",\"received_bytes\":" << receivedBytes << ",\"undecryptable\":" << undecryptable << ",\"ops\":[";
+
+    std::cout << std::left << std::setw(16) << "OP" << std::right << std::setw(10) << "COUNT" << std::setw(8) << "ERRORS"
+              << std::setw(12) << "OPS/S" << std::setw(10) << "MB/S" << std::setw(12) << "P50 US" << std::setw(12) << "P99 US"
+              << std::setw(12) << "P999 US" << std::setw(12) << "MAX US" << std::endl;
+    bool firstOp = true;
+    for (auto& [op, stats] : merged) {
+        std::sort(stats.micros.begin(), stats.micros.end());
+        double wall = stats.micros.empty() ? 0 : std::chrono::duration<double>(stats.last - stats.first).count();
+        double opsPerSecond = wall > 0 ? stats.micros.size() / wall : 0;
+        double mbPerSecond = wall > 0 ? stats.bytes / wall / (1024 * 1024) : 0;
+        double p50 = percentile(stats.micros, 0.50), p99 = percentile(stats.micros, 0.99), p999 = percentile(stats.micros, 0.999);
+        double max = stats.micros.empty() ? 0 : stats.micros.back();
+
+        json << (firstOp ? "" : ",") << "{\"op\":" << static_cast<uint16_t>(op) << ",\"name\":\"" << opName(op) << "\",\"count\":" << stats.micros.size()
+             << ",\"errors\":" << stats.errors << ",\"ops_per_s\":" << opsPerSecond << ",\"mb_per_s\":" << mbPerSecond
+             << ",\"p50_us\":" << p50 << ",\"p99_us\":" << p99 << ",\"p999_us\":" << p999 << ",\"max_us\":" << max << "}";
+        firstOp = false;
+
+        std::cout << std::left << std::setw(16) << opName(op) << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << stats.micros.size() << std::setw(8) << stats.errors << std::setw(12) << opsPerSecond
+                  << std::setw(10) << mbPerSecond << std::setw(12) << p50 << std::setw(12) << p99 << std::setw(12) << p999
+                  << std::setw(12) << max << std::endl;
+    }
+    json << "]}";
+
+    std::ofstream out(options.out);
+    out << json.str() << std::endl;
+    if (!out)   throw std::runtime_error("Could not write the results to " + options.out);
+    std::cout << "Received " << received << " texts (" << undecryptable << " undecryptable), " << failed << " clients failed. Results in " << options.out << std::endl;
+
+    if (!options.metrics.empty()) {
+        std::ofstream metrics(options.metrics);
+        Metrics::write(metrics, Metrics::Format::PROMETHEUS);
+        if (!metrics)   throw std::runtime_error("Could not write the metrics to " + options.metrics);
+        std::cout << "Client metrics in " << options.metrics << std::endl;
+    }
+}
+
+}
+
+/* Runs the load and reports it */
+int main(int argc, char* argv[]) {
+    try {
+        Options options = parseOptions(argc, argv);
+
+        /* Key pairs for every client are generated before the clock starts */
+        std::cout << "Generating " << options.clients << " key pairs..." << std::endl;
+        KeyPool pool(options.clients);
+        while (pool.ready() < options.clients)  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        /* Names are unique to the run, the server keeps the users of every run */
+        std::mt19937 random(std::random_device{}());
+        std::string runID = std::to_string(random() % 1000000);
+        std::string text(1024 * 1024, '\0');
+        for (char& c : text)    c = static_cast<char>('a' + random() % 26);
+
+        Run run{options, {}, std::barrier<>(static_cast<std::ptrdiff_t>(options.clients)), pool, std::move(text)};
+        for (size_t i = 0; i < options.clients; i++)
+            run.clients.push_back(std::make_unique<SimClient>(options, i, "msgbench_" + runID + "_" + std::to_string(i)));
+
+        Clock::time_point start = Clock::now();
+        std::vector<std::thread> threads;
+        for (std::unique_ptr<SimClient>& sim : run.clients)
+            threads.emplace_back(simulate, std::ref(run), std::ref(*sim));
+        for (std::thread& thread : threads)     thread.join();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        report(options, run.clients, seconds);
+    } catch (const std::exception& e) {
+        std::cerr << RED  "[ERROR] "  RESET << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+# Micro-benchmark of the database layer: requests per second for the database work of a 603 (send message)
+# and a 604 (pull messages) request, with a connection opened per call (the old way) and with the shared connection.
+# Runs on a temporary database, the server database is not touched.
+#   python3 bench_database.py [requests]
+import contextlib
+import io
+import os
+import sqlite3
+import struct
+import sys
+import tempfile
+import time
+import uuid
+from datetime import datetime
+
+import database
+
+# The way every database function worked before: connect, one statement, commit, close.
+def legacy_call(sql: str, params: tuple, fetch: bool = False):
+    conn = sqlite3.connect(database.DB_PATH)
+    try:
+        cursor = conn.execute(sql, params)
+        result = cursor.fetchall() if fetch else cursor.lastrowid
+        conn.commit()
+        return result
+    finally:
+        conn.close()
+
+# The database work of a 603 request, per connection
+def legacy_send(sender: bytes, target: bytes, content: bytes):
+    legacy_call("SELECT 1 FROM clients WHERE ID = ?", (target,), True)                    # userCheck(target)
+    legacy_call("SELECT 1 FROM clients WHERE ID = ?", (sender,), True)                    # userCheck inside updateLastSeen
+    legacy_call("UPDATE clients SET LastSeen = ? WHERE ID = ?", (now(), sender))
+    return struct.pack("I", legacy_call("INSERT INTO messages (ToClient, FromClient, Type, Content) VALUES (?, ?, ?, ?)",
+                                        (target, sender, 3, content)))
+
+def legacy_pull(client: bytes):
+    legacy_call("SELECT 1 FROM clients WHERE ID = ?", (client,), True)
+    legacy_call("SELECT 1 FROM clients WHERE ID = ?", (client,), True)
+    legacy_call("UPDATE clients SET LastSeen = ? WHERE ID = ?", (now(), client))
+    return legacy_call("SELECT ID, FromClient, Type, Content FROM messages WHERE ToClient = ?", (client,), True)
+
+# The same work with the database module
+def shared_send(sender: bytes, target: bytes, content: bytes):
+    database.userCheck(target)
+    database.updateLastSeen(sender)
+    return database.sendMessageToTarget(target, sender, 3, content)
+
+def shared_pull(client: bytes):
+    database.userCheck(client)
+    database.updateLastSeen(client)
+    return database.getAllMessages(client)
+
+def now():
+    return datetime.utcnow().strftime('%Y-%m-%d %H:%M:%S')
+
+# Runs a request function n times and returns requests per second
+def measure(function, n: int, *args) -> float:
+    start = time.perf_counter()
+    for _ in range(n):
+        function(*args)
+    return n / (time.perf_counter() - start)
+
+def main():
+    requests = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+    with tempfile.TemporaryDirectory() as directory:
+        database.DB_PATH = os.path.join(directory, "bench.db")
+        database.initialize_database()
+
+        users = [uuid.uuid4().bytes for _ in range(100)]
+        for i, user in enumerate(users):
+            database.register_user(user, f"user{i}", b"K" * 160, datetime.now().isoformat())
+        sender, target, puller = users[0], users[1], users[2]
+        content = b"M" * 64
+
+        benchmarks = [
+            ("send (connect per call)", legacy_send, sender, target, content),
+            ("send (shared connection)", shared_send, sender, target, content),
+            ("pull (connect per call)", legacy_pull, puller),
+            ("pull (shared connection)", shared_pull, puller),
+        ]
+
+        # updateLastSeen prints on every call, we keep the output to the results
+        with contextlib.redirect_stdout(io.StringIO()):
+            rates = [(name, measure(function, requests, *args)) for name, function, *args in benchmarks]
+
+        for name, rate in rates:
+            print(f"{name:<28}{rate:>12.0f} req/s")
+        database.close_connection()
+
+if __name__ == "__main__":
+    main()
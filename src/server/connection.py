@@ -0,0 +1,89 @@
+import selectors
+import socket
+import struct
+import time
+from request import Request, unsubscribe, messagesWritten
+
+RECEIVE_SIZE = 65536
+RECEIVE_TIMEOUT = 30        # Seconds a started request may wait for its next bytes before the connection is dropped
+SEND_TIMEOUT = 30           # Seconds the client may leave what we send unread before the connection is dropped
+
+# Open client connections, by socket
+connections: dict[socket.socket, "Connection"] = {}
+
+# A client connection of the selector loop. Nothing here waits on the socket, so one slow client can not stall the others:
+# bytes are buffered as they arrive and a request is only handled once all of it arrived, and what we send is queued
+# and written whenever the socket can take more (EVENT_WRITE is watched only while something is queued).
+class Connection:
+    def __init__(self, sock: socket.socket, selector: selectors.BaseSelector, handler):
+        self.socket = sock
+        self.selector = selector
+        self.callback = lambda mask: handler(self, mask)   # The selector calls it with the ready events
+        self.inbox = bytearray()            # Received bytes of requests that did not arrive whole yet
+        self.received_at = time.monotonic() # Last time bytes arrived
+        self.outbox = bytearray()           # Bytes waiting for the socket to take them
+        self.sent_at = time.monotonic()     # Last time the socket took queued bytes
+        self.writing = False                # EVENT_WRITE is watched
+        self.queued_messages = {}           # Last message ID queued for each client, deleted from the database once written
+        self.closed = False
+        sock.setblocking(False)
+        selector.register(sock, selectors.EVENT_READ, self.callback)
+        connections[sock] = self
+
+    # Reads what arrived and returns the whole requests (header and payload) it completed, in order
+    def receive(self) -> list[bytes]:
+        data = self.socket.recv(RECEIVE_SIZE)
+        if not data:
+            raise ConnectionResetError("Connection closed by the client")
+        self.inbox += data
+        self.received_at = time.monotonic()
+
+        requests = []
+        while len(self.inbox) >= Request.HEADER_SIZE:
+            *_, payload_size = struct.unpack_from(Request.HEADER_FORMAT, self.inbox)
+            size = Request.HEADER_SIZE + payload_size
+            if len(self.inbox) < size:
+                break
+            requests.append(bytes(self.inbox[:size]))
+            del self.inbox[:size]
+        return requests
+
+    # Queues data and writes as much of it as the socket takes now, the rest goes out on EVENT_WRITE
+    def send(self, data: bytes):
+        if self.closed:
+            raise ConnectionResetError("Connection is closed")
+        if not self.outbox:
+            self.sent_at = time.monotonic()
+        self.outbox += data
+        self.flush()
+
+    # Writes queued bytes until the socket would block, and watches EVENT_WRITE only while some are left
+    def flush(self):
+        try:
+            while self.outbox:
+                sent = self.socket.send(self.outbox)
+                del self.outbox[:sent]
+                self.sent_at = time.monotonic()
+        except BlockingIOError:
+            pass
+        if not self.outbox and self.queued_messages:
+            messagesWritten(self)
+        if self.writing != bool(self.outbox):
+            self.writing = bool(self.outbox)
+            events = selectors.EVENT_READ | (selectors.EVENT_WRITE if self.writing else 0)
+            self.selector.modify(self.socket, events, self.callback)
+
+    # True if a request started arriving and its next bytes are overdue, or the client stopped reading what we send
+    def stalled(self, now: float) -> bool:
+        return (bool(self.inbox) and now - self.received_at > RECEIVE_TIMEOUT) or \
+               (bool(self.outbox) and now - self.sent_at > SEND_TIMEOUT)
+
+    # Unsubscribes and closes the connection, what is still queued is dropped (its messages stay in the database)
+    def close(self):
+        if self.closed:
+            return
+        self.closed = True
+        unsubscribe(self)
+        self.selector.unregister(self.socket)
+        del connections[self.socket]
+        self.socket.close()
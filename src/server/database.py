@@ -2,12 +2,37 @@ import sqlite3
 import struct
 from datetime import datetime
 
-# Initializes the database 
+DB_PATH = "defensive.db"
+
+# The server handles one request at a time (selector loop), so one long lived connection is shared by every request.
+# sqlite3 keeps a prepared statement per SQL text on the connection, so every query below is compiled once.
+_connection = None
+
+# Returns the shared connection, opening and tuning it on first use
+def get_connection() -> sqlite3.Connection:
+    global _connection
+    if _connection is None:
+        _connection = sqlite3.connect(DB_PATH, cached_statements=256)
+        # WAL: readers don't block the writer and a commit is an append, NORMAL sync is safe with WAL (no fsync per commit).
+        _connection.execute("PRAGMA journal_mode = WAL")
+        _connection.execute("PRAGMA synchronous = NORMAL")
+        _connection.execute("PRAGMA cache_size = -16000")       # 16MB page cache
+        _connection.execute("PRAGMA temp_store = MEMORY")
+    return _connection
+
+# Closes the shared connection (on server shutdown)
+def close_connection():
+    global _connection
+    if _connection is not None:
+        _connection.close()
+        _connection = None
+
+# Initializes the database
 def initialize_database():
-    conn = sqlite3.connect("defensive.db");
+    conn = get_connection()
     cursor = conn.cursor()
 
-    # Makes the client table. ID is primary key, the rest can not be null. 
+    # Makes the client table. ID is primary key, the rest can not be null.
     cursor.execute("""
             CREATE TABLE IF NOT EXISTS clients (
                 ID BLOB(16) PRIMARY KEY,
@@ -15,7 +40,7 @@ def initialize_database():
                 PublicKey BLOB(160) NOT NULL,
                 LastSeen DATETIME NOT NULL
             )""")
-    
+
     # Makes the messages table, while making sure that ToClient ID and FromClient ID exist in database!
     # Type is TINYINT, we will store only 1 byte, so it will be saved as 1 byte in the memory. Better than saving an INT.
     cursor.execute("""
@@ -29,196 +54,200 @@ def initialize_database():
                 FOREIGN KEY (FromClient) REFERENCES clients(ID)
             )""")
 
+    # A client gets the next value of a change counter (Version) when he registers and whenever his UserName changes,
+    # so a member list sync (608) only sends what changed after the version the client already has.
+    # LastSeen is not sent by a sync and does not count. Databases made before the counter get it here.
+    columns = [column[1] for column in cursor.execute("PRAGMA table_info(clients)").fetchall()]
+    if "Version" not in columns:
+        cursor.execute("ALTER TABLE clients ADD COLUMN Version INTEGER NOT NULL DEFAULT 0")
+        cursor.execute("UPDATE clients SET Version = rowid")
+    cursor.execute("""CREATE TRIGGER IF NOT EXISTS clients_version_on_rename AFTER UPDATE OF UserName ON clients
+                      WHEN NEW.UserName IS NOT OLD.UserName
+                      BEGIN
+                          UPDATE clients SET Version = (SELECT MAX(Version) + 1 FROM clients) WHERE ID = NEW.ID;
+                      END""")
+
+    # Pulls look messages up by recipient (in ID order), and registration / userCheck look users up by name.
+    cursor.execute("CREATE INDEX IF NOT EXISTS idx_messages_to_client ON messages (ToClient, ID)")
+    cursor.execute("CREATE UNIQUE INDEX IF NOT EXISTS idx_clients_username ON clients (UserName)")
+    cursor.execute("CREATE INDEX IF NOT EXISTS idx_clients_version ON clients (Version)")
+
     conn.commit()
-    conn.close()
 
 # Inserts a user while checking if it already exists
 def register_user(ID: bytes, username: str, publicKey: bytes, lastSeen: str):
-    conn = None
     try:
-        conn = sqlite3.connect("defensive.db")
-        cursor = conn.cursor()
-        cursor.execute("INSERT INTO clients (ID, UserName, PublicKey, LastSeen) VALUES (?, ?, ?, ?)", 
-                    (ID, username, publicKey, lastSeen))
-        conn.commit()
-        conn.close()
+        with get_connection() as conn:
+            conn.execute("INSERT INTO clients (ID, UserName, PublicKey, LastSeen, Version) "
+                         "VALUES (?, ?, ?, ?, (SELECT COALESCE(MAX(Version), 0) + 1 FROM clients))",
+                        (ID, username, publicKey, lastSeen))
         return 0
     except sqlite3.Error as e:
         raise RuntimeError(f"Database error: {e}")
 
-    finally:
-        if conn:
-            conn.close()
-    
 # Sends a message to a client
 def sendMessageToTarget(ToClient: bytes, FromClient: bytes, Type : int, Content : bytes = None):
-    conn = None
     try:
-        conn = sqlite3.connect("defensive.db")
-        cursor = conn.cursor()
-
-        if Content is None:
-            Content = b''
-            cursor.execute("INSERT INTO messages (ToClient, FromClient, Type, Content) VALUES (?, ?, ?, ?)",
+        with get_connection() as conn:
+            if Content is None:
+                Content = b''
+            cursor = conn.execute("INSERT INTO messages (ToClient, FromClient, Type, Content) VALUES (?, ?, ?, ?)",
                 (ToClient, FromClient, Type, Content))
-        else:
-            cursor.execute("INSERT INTO messages (ToClient, FromClient, Type, Content) VALUES (?, ?, ?, ?)",
-                (ToClient, FromClient, Type, Content))
-
 
-        if cursor.rowcount <= 0:
-            raise RuntimeError("Insertion failed: No rows were inserted.")
+            if cursor.rowcount <= 0:
+                raise RuntimeError("Insertion failed: No rows were inserted.")
 
-        lastrow = struct.pack("I", cursor.lastrowid) # We just make sure its 4 bytes long
-        conn.commit()
-        return lastrow
+            return struct.pack("I", cursor.lastrowid) # We just make sure its 4 bytes long
 
     except sqlite3.Error as e:
         raise RuntimeError(f"Database error: {e}")
 
-    finally:
-        if conn:
-            conn.close()
-
-def getUUID(Username: str):
-    conn = None
+# Stores many messages in a single transaction. entries is a list of (ToClient, Type, Content).
+# Returns the 4 byte message IDs in the order of the entries. If any target does not exist nothing is stored.
+def sendMessagesToTargets(FromClient: bytes, entries: list[tuple[bytes, int, bytes | None]]) -> list[bytes]:
     try:
-        conn = sqlite3.connect("defensive.db")
-        cursor = conn.cursor()
-        cursor.execute("SELECT UserName FROM clients WHERE UserName = ?", (UserName,))
+        with get_connection() as conn:
+            targets = {target for target, _, _ in entries}
+            for target in targets:
+                if conn.execute("SELECT 1 FROM clients WHERE ID = ?", (target,)).fetchone() is None:
+                    raise RuntimeError(f"Invalid target ID: {target.hex()}")
+
+            messageIDs = []
+            for ToClient, Type, Content in entries:
+                cursor = conn.execute("INSERT INTO messages (ToClient, FromClient, Type, Content) VALUES (?, ?, ?, ?)",
+                    (ToClient, FromClient, Type, Content if Content is not None else b''))
+                messageIDs.append(struct.pack("I", cursor.lastrowid))
+
+            return messageIDs
 
-        result = cursor.fetchone()
-        conn.close()
-        return result[0] if result else None
     except sqlite3.Error as e:
         raise RuntimeError(f"Database error: {e}")
 
-    finally:
-        if conn:
-            conn.close()
+def getUUID(UserName: str):
+    try:
+        result = get_connection().execute("SELECT ID FROM clients WHERE UserName = ?", (UserName,)).fetchone()
+        return result[0] if result else None
+    except sqlite3.Error as e:
+        raise RuntimeError(f"Database error: {e}")
 
-# Searches for specific client ID, pulls the public key 
+# Searches for specific client ID, pulls the public key
 def getPublicKey(ID: bytes):
-    conn = None
     try:
-        conn = sqlite3.connect("defensive.db")
-        cursor = conn.cursor()
-        cursor.execute("SELECT PublicKey FROM clients WHERE ID = ?", (ID,))
-        result = cursor.fetchone()
-        conn.close()
+        result = get_connection().execute("SELECT PublicKey FROM clients WHERE ID = ?", (ID,)).fetchone()
         return result[0] if result else None
     except sqlite3.Error as e:
         raise RuntimeError(f"Database error: {e}")
 
-    finally:
-        if conn:
-            conn.close()
-
 def getUsername(ID: bytes):
-    try:      
-        conn = sqlite3.connect("defensive.db")
-        cursor = conn.cursor()
-
-        cursor.execute("SELECT UserName FROM clients WHERE ID = ? ", (ID,))
-        result = cursor.fetchone()
-
-        conn.close()
+    try:
+        result = get_connection().execute("SELECT UserName FROM clients WHERE ID = ? ", (ID,)).fetchone()
         return result[0] if result else None
     except sqlite3.Error as e:
         raise RuntimeError(f"Database error: {e}")
 
-    finally:
-        if conn:
-            conn.close()
-    
 # Returns a list of all messages for a certain client ID
 def getAllMessages(ID: bytes):
     try:
-        conn = sqlite3.connect("defensive.db")
-        cursor = conn.cursor()
+        return get_connection().execute("SELECT ID, FromClient, Type, Content FROM messages WHERE ToClient = ? ORDER BY ID" ,(ID,)).fetchall()
+    except sqlite3.Error as e:
+        raise RuntimeError(f"Database error: {e}")
 
-        cursor.execute("SELECT ID, FromClient, Type, Content FROM messages WHERE ToClient = ?" ,(ID,))
-        messages = cursor.fetchall()
+# Returns all the messages waiting for a client after afterID (the ones up to it are already queued on its connection).
+# Nothing is deleted here: deleteMessages does it once they were written to the client.
+def pendingMessages(ID: bytes, afterID: int = 0):
+    try:
+        return get_connection().execute("SELECT ID, FromClient, Type, Content FROM messages WHERE ToClient = ? AND ID > ? ORDER BY ID",
+                                        (ID, afterID)).fetchall()
+    except sqlite3.Error as e:
+        raise RuntimeError(f"Database error: {e}")
 
-        conn.close()
-        return messages
+# Returns one page of the oldest messages waiting for a client after afterID: up to maxCount messages and maxBytes
+# of records (at least one message, even if it is bigger), and if more messages are waiting after the page.
+# Like pendingMessages nothing is deleted, so the next page after deleteMessages starts where this one ended.
+def pendingMessagesPage(ID: bytes, maxCount: int, maxBytes: int, afterID: int = 0, recordHeaderSize: int = 25):
+    try:
+        conn = get_connection()
+        # First only sizes (from the index and row headers), so contents after the page are never loaded
+        sizes = conn.execute("SELECT ID, length(Content) FROM messages WHERE ToClient = ? AND ID > ? ORDER BY ID LIMIT ?",
+                             (ID, afterID, maxCount + 1)).fetchall()
+        lastID, total, count = afterID, 0, 0
+        for msgID, size in sizes[:maxCount]:
+            total += recordHeaderSize + (size or 0)
+            if count > 0 and total > maxBytes:
+                break
+            lastID, count = msgID, count + 1
+        more = count < len(sizes)
+
+        messages = []
+        if count:
+            messages = conn.execute("SELECT ID, FromClient, Type, Content FROM messages WHERE ToClient = ? AND ID > ? AND ID <= ? ORDER BY ID",
+                                    (ID, afterID, lastID)).fetchall()
+        return messages, more
     except sqlite3.Error as e:
         raise RuntimeError(f"Database error: {e}")
 
-    finally:
-        if conn:
-            conn.close()
+# Deletes the messages of a client up to lastID, once they were written to its connection
+def deleteMessages(ID: bytes, lastID: int):
+    try:
+        with get_connection() as conn:
+            conn.execute("DELETE FROM messages WHERE ToClient = ? AND ID <= ?", (ID, lastID))
+    except sqlite3.Error as e:
+        raise RuntimeError(f"Database error: {e}")
 
 def getAllUsers(ID: bytes) -> list[tuple[bytes,str]]:
     try:
-        conn = sqlite3.connect("defensive.db")
-        cursor = conn.cursor()
-
-        id_exists, _ = userCheck(ID) 
-        if not id_exists:
-            raise RuntimeError(f"Invalid user ID: {ID.hex()}")
-        
+        conn = get_connection()
         username = getUsername(ID)
-        cursor.execute("SELECT ID, UserName FROM clients WHERE ID != ? AND UserName != ?",(ID,username))
+        if username is None:
+            raise RuntimeError(f"Invalid user ID: {ID.hex()}")
 
-        users = cursor.fetchall()
-        conn.close()
-        return users;
+        return conn.execute("SELECT ID, UserName FROM clients WHERE ID != ? AND UserName != ?",(ID,username)).fetchall()
     except sqlite3.Error as e:
         raise RuntimeError(f"Database error: {e}")
 
-    finally:
-        if conn:
-            conn.close()
+# Returns the clients (except ID) that were added or changed after version sinceVersion, in version order,
+# and the current version (what the client sends next time). Version 0 returns everyone.
+def getUsersSince(ID: bytes, sinceVersion: int) -> tuple[list[tuple[bytes,str]], int]:
+    try:
+        conn = get_connection()
+        if getUsername(ID) is None:
+            raise RuntimeError(f"Invalid user ID: {ID.hex()}")
 
-# We check for ID / Username, so we know what prompt to send to user. 
+        users = conn.execute("SELECT ID, UserName FROM clients WHERE Version > ? AND ID != ? ORDER BY Version",
+                             (sinceVersion, ID)).fetchall()
+        version = conn.execute("SELECT COALESCE(MAX(Version), 0) FROM clients").fetchone()[0]
+        return users, version
+    except sqlite3.Error as e:
+        raise RuntimeError(f"Database error: {e}")
+
+# We check for ID / Username, so we know what prompt to send to user.
 # If its ID we need to recreate! Else we send general error.
 # We dont always check for username, some requests come without!
 def userCheck(ID: bytes, UserName : str = None) -> tuple[bool,bool | None]:
     try:
-        conn = sqlite3.connect("defensive.db")
-        cursor = conn.cursor()
-
-        cursor.execute("SELECT 1 FROM clients WHERE ID = ?", (ID,))
-        id_exists = cursor.fetchone() is not None  
+        conn = get_connection()
+        id_exists = conn.execute("SELECT 1 FROM clients WHERE ID = ?", (ID,)).fetchone() is not None
 
         if UserName is not None:
-            cursor.execute("SELECT 1 FROM clients WHERE UserName = ?", (UserName,))
-            username_exists = cursor.fetchone() is not None  
+            username_exists = conn.execute("SELECT 1 FROM clients WHERE UserName = ?", (UserName,)).fetchone() is not None
         else:
             username_exists = None
 
-        conn.close();
-
         return id_exists,username_exists;
 
     except sqlite3.Error as e:
         raise RuntimeError(f"Database error: {e}")
 
-    finally:
-        if conn:
-            conn.close()
-
+# Updates the last seen time, the update itself tells us if the ID exists (no separate lookup).
 def updateLastSeen(ID: bytes):
     try:
-        conn = sqlite3.connect("defensive.db")
-        cursor = conn.cursor()
-        
-        id_exists, _ = userCheck(ID) 
-        if not id_exists:
-            raise RuntimeError(f"Invalid user ID: {ID.hex()}")
-
         current_time = datetime.utcnow().strftime('%Y-%m-%d %H:%M:%S')
-        
+        with get_connection() as conn:
+            cursor = conn.execute("UPDATE clients SET LastSeen = ? WHERE ID = ?", (current_time, ID))
+            if cursor.rowcount == 0:
+                raise RuntimeError(f"Invalid user ID: {ID.hex()}")
 
-        cursor.execute("UPDATE clients SET LastSeen = ? WHERE ID = ?", (current_time, ID))
-
-        conn.commit()  # Save changes
         print(f"Updated LastSeen for Client ID: {ID.hex()}")
 
     except sqlite3.Error as e:
         raise RuntimeError(f"Database error: {e}")
-
-    finally:
-        if conn:
-            conn.close() 
@@ -4,6 +4,7 @@ import logger
 import uuid
 import database
 import pickle
+import wire
 from response import Response, ResponseOp  
 from datetime import datetime
 from enum import IntEnum
@@ -17,19 +18,83 @@ class RequestOp(IntEnum):
     REQ_PUBLIC_KEY = 602
     REQ_MESSAGE_TO_USER = 603
     REQ_AWAITING_MESSAGES = 604
+    REQ_SEND_BATCH = 605
+    REQ_AWAITING_MESSAGES_PAGE = 606
+    REQ_SUBSCRIBE = 607
+    REQ_USER_LIST_SINCE = 608
 # Message Type
 class MessageType(IntEnum):
     REQ_SYMMETRIC_KEY = 1
     SEND_SYMMETRIC_KEY = 2
     SEND_TEXT_MSG = 3
     SEND_FILE = 4
+    SEND_FILE_FRAMED = 5
+
+# Set in the type of a message whose content was deflated before encryption, stored and forwarded as is
+MESSAGE_COMPRESSED = 0x80
     
+# Connections that asked for their messages to be pushed (607), by client UUID, with the protocol version they speak
+subscribers: dict[bytes, tuple["Connection", int]] = {}
+
+# Removes the subscription of a connection (when it is closed)
+def unsubscribe(connection):
+    for client_id in [client_id for client_id, (subscriber, _) in subscribers.items() if subscriber is connection]:
+        del subscribers[client_id]
+
+# Queues a response carrying messages of a client. The messages stay in the database until the connection wrote all of it
+# (messagesWritten deletes them), meanwhile later reads on the connection start after them so they are not sent twice.
+# If the connection is dropped before, they are served again to the next pull (so a message may arrive twice).
+# Written only means the socket took the bytes: what is still in the socket buffers when the connection breaks is lost.
+def sendMessages(connection, client_id: bytes, messages, data: bytes):
+    if messages:
+        connection.queued_messages[client_id] = messages[-1][0]
+    connection.send(data)
+
+# Deletes the messages a connection finished writing
+def messagesWritten(connection):
+    written, connection.queued_messages = connection.queued_messages, {}
+    for client_id, lastID in written.items():
+        try:
+            database.deleteMessages(client_id, lastID)
+        except RuntimeError as e:
+            print(f"[Error] deleting messages of {logger.format_hex(client_id)}: {e}")
+
+# Pushes the messages waiting for a subscribed client, the same way a pull does (deleted once written to its connection).
+# While an earlier push is still being written they stay in the database, pushSubscribed sends them once it was.
+# If the subscriber can not be reached its connection is closed (which unsubscribes it), and the messages stay queued for a pull.
+def pushPending(client_id: bytes):
+    if client_id not in subscribers:
+        return
+    connection, version = subscribers[client_id]
+    if connection.outbox:
+        return
+    try:
+        messages = database.pendingMessages(client_id, connection.queued_messages.get(client_id, 0))
+        if not messages:
+            return
+        byte_msg = Request.packMessages(messages, version)
+        response = Response(
+            responseOp=ResponseOp.RESP_PUSHED_MESSAGES,
+            payloadSize=len(byte_msg),
+            version=version)
+        sendMessages(connection, client_id, messages, response.build_message(byte_msg))
+        print(f"Pushed {len(messages)} messages to {logger.format_hex(client_id)}")
+    except OSError as e:
+        print(f"[Error] pushing messages to {logger.format_hex(client_id)}: {e}")
+        connection.close()
+
+# Pushes what waited for the clients subscribed on a connection, once it wrote everything it had queued
+def pushSubscribed(connection):
+    for client_id in [client_id for client_id, (subscriber, _) in subscribers.items() if subscriber is connection]:
+        pushPending(client_id)
+
 class Request:
     HEADER_FORMAT = '16s B H I'
     HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
 
-    def __init__(self,socket):
-        self.socket = socket
+    def __init__(self, connection, data: bytes):
+        self.connection = connection  # Connection the request arrived on, responses are queued on it
+        self.data = memoryview(data)  # The whole request, header and payload (Connection buffers it until it arrived)
         self.username = None
         self.UUID = None
         self.version = None
@@ -38,6 +103,7 @@ class Request:
         self.payload_size = None
         self.payload = None
         self.hex_data = None    
+        self.received = 0           # Bytes of this request parsed so far (header included)
     
     # Parses the header message and inputs the data to respected holders
     def parse_header(self):
@@ -52,19 +118,13 @@ class Request:
             print(f"Error: {e}")
             self.payload_size = 0
 
-    # Helper function to receive exactly 'size' bytes
+    # Helper function to take exactly 'size' bytes of the request, in order
+    # The request arrived whole before it is parsed, so nothing waits on the socket here.
     def receive_all(self, size):
-        data = bytearray()
-        while len(data) < size:
-            try:
-                packet = self.socket.recv(size - len(data))
-                if not packet:
-                    raise ConnectionError("Connection closed prematurely by the server.")
-                data.extend(packet)
-                print(f"Received {len(data)}/{size} Bytes")
-            except ConnectionError as e:
-                print(f"Error: {e}")
-                return;
+        if self.received + size > len(self.data):
+            raise ValueError(f"Request is shorter than its fields ({len(self.data)} bytes)")
+        data = self.data[self.received:self.received + size].tobytes()
+        self.received += size
         return data 
 
     def __str__(self):
@@ -84,6 +144,8 @@ class Request:
     # Receives OpCode, but messagetype can be none
     def handle_request(self):
         try:    # We handle all errors from all requests in this try-catch, sending general error for everything.
+            if self.version not in (wire.VERSION_FIXED, wire.VERSION_COMPACT):
+                raise ValueError(f"Unsupported protocol version {self.version}")
             # Update the database each time we print the header. 
             match self.OpCode:
                 case RequestOp.REQ_REGISTER:
@@ -96,19 +158,28 @@ class Request:
                     self.messageToUserRequest()
                 case RequestOp.REQ_AWAITING_MESSAGES:
                     self.collectMsgsRequest()
+                case RequestOp.REQ_SEND_BATCH:
+                    self.batchMessageRequest()
+                case RequestOp.REQ_AWAITING_MESSAGES_PAGE:
+                    self.collectMsgsPageRequest()
+                case RequestOp.REQ_SUBSCRIBE:
+                    self.subscribeRequest()
+                case RequestOp.REQ_USER_LIST_SINCE:
+                    self.userlistSinceRequest()
+                case _:
+                    raise ValueError(f"Unknown request {self.OpCode}")
 
         # If we have an error from any case, we parse it for debugging & Send general error to user
         except Exception as e:
             print(f"[Error] parsing request {self.OpCode}: {e}")  
-            response = Response(ResponseOp.RESP_GENERAL_ERROR, 0)
-            self.socket.recv(4096) # We 'flush' the socket
-            self.socket.sendall(response.build_message())
+            response = Response(ResponseOp.RESP_GENERAL_ERROR, 0, version=self.version or wire.VERSION_FIXED)
+            self.connection.send(response.build_message())
             print(response)
             
     # Handles the registration of a new user 
     def registerRequest(self):
-        # Grabbing username
-        username = self.receive_all(255).decode('utf-8')
+        # Grabbing username. Names are stored padded to 255 bytes whatever version they were sent in, so they stay unique across versions.
+        username = wire.read_name(self.version, self.receive_all).decode('utf-8').ljust(wire.NAME_SIZE, '0')
         readable_name = username.rstrip('\x00').rstrip('0')
         
         #Creating random UUID
@@ -120,7 +191,7 @@ class Request:
         # if the ID exists, we keep creating a new one.
         if id_exists:
             rndUUID = uuid.uuid4().bytes
-            id_exists, username_exists = userCheck(rndUUID,username)
+            id_exists, username_exists = database.userCheck(rndUUID,username)
 
         # If username exists, we raise error to prompt for a new one!
         if username_exists:
@@ -134,10 +205,11 @@ class Request:
         response = Response(
             responseOp=ResponseOp.RESP_REGISTER_SUCCESSFULL,
             payloadSize=len(rndUUID),
-            clientID=rndUUID
+            clientID=rndUUID,
+            version=self.version
         )
         message = response.build_message()
-        self.socket.sendall(message)
+        self.connection.send(message)
         print(f"Registering:\n"
               f"Username: {readable_name}\n"
               f"UUID: {logger.format_hex(rndUUID)}\n"
@@ -161,14 +233,43 @@ class Request:
         user_dump = b""
         if user_list:
             user_dump = b"".join(
-                uuid + user.encode('utf-8').ljust(255, b'\x00')
+                uuid + wire.pack_name(self.version, user.encode('utf-8') if self.version < wire.VERSION_COMPACT
+                                      else user.rstrip('\x00').rstrip('0').encode('utf-8'), b'\x00')
                 for uuid, user in user_list)
 
         response = Response(
             responseOp=ResponseOp.RESP_USER_LIST,
-            payloadSize=len(user_dump))
+            payloadSize=len(user_dump),
+            version=self.version)
         message = response.build_message(user_dump)
-        self.socket.sendall(message)
+        self.connection.send(message)
+
+    # Handles a member list sync: only the users added or changed after the version the client already has.
+    # Payload: member list version of the client (8 bytes, 0 for the full list).
+    # Response payload: current version (8 bytes), user count (4 bytes), then per user UUID (16 bytes),
+    # name length (1 byte) and the name (without padding). In version 3 the version, count and name length are varints.
+    def userlistSinceRequest(self):
+        sinceVersion = wire.read_u64(self.version, self.receive_all)
+        database.updateLastSeen(self.UUID)
+
+        users, version = database.getUsersSince(self.UUID, sinceVersion)
+        print(f"Sending {len(users)} users changed after version {sinceVersion} to {logger.format_hex(self.UUID)}")
+
+        names = [user.rstrip('\x00').rstrip('0').encode('utf-8') for _, user in users]
+        if self.version < wire.VERSION_COMPACT:
+            user_delta = struct.pack("<Q I", version, len(users)) + b"".join(
+                uuid + struct.pack("B", len(name)) + name
+                for (uuid, _), name in zip(users, names))
+        else:
+            user_delta = wire.pack_u64(self.version, version) + wire.pack_u32(self.version, len(users)) + b"".join(
+                uuid + wire.pack_name(self.version, name, b'\x00')
+                for (uuid, _), name in zip(users, names))
+
+        response = Response(
+            responseOp=ResponseOp.RESP_USER_LIST_SINCE,
+            payloadSize=len(user_delta),
+            version=self.version)
+        self.connection.send(response.build_message(user_delta))
 
     # Handles the request for public key
     def publicKeyRequest(self):
@@ -192,18 +293,17 @@ class Request:
             responseOp=ResponseOp.RESP_PUBLIC_KEY,
             payloadSize=len(publicKey) + len(target_uuid),
             clientID=target_uuid,
-            publicKey=publicKey
+            publicKey=publicKey,
+            version=self.version
         )
         message = response.build_message()
-        self.socket.sendall(message)
+        self.connection.send(message)
 
     # Handles sending a message to a user 
     def messageToUserRequest(self):
-        # We get the "header" of the payload, and unpack the data of it.
-        PAYLOAD_HEADER_FORMAT = '=16s B I'
-        PAYLOAD_HEADER_SIZE = struct.calcsize(PAYLOAD_HEADER_FORMAT)
-        payload_header_data = self.receive_all(PAYLOAD_HEADER_SIZE)
-        target_UUID, msg_type, content_size = struct.unpack(PAYLOAD_HEADER_FORMAT, payload_header_data)
+        # We get the "header" of the payload (target UUID, type, content size), and unpack the data of it.
+        target_UUID, msg_type = struct.unpack("=16s B", self.receive_all(17))
+        content_size = wire.read_u32(self.version, self.receive_all)
         content = None
 
         # We check that target UUID exists, else we won't have a proper response! Raise error if it doesnt.
@@ -213,7 +313,7 @@ class Request:
         # Update last seen!
         database.updateLastSeen(self.UUID)
 
-        print(f"Message Header:\n{logger.format_hex(payload_header_data, 1)}")
+        print(f"Message Header:\n{logger.format_hex(target_UUID + struct.pack('B', msg_type), 1)} size {content_size}")
         print(f"Sending message to user {logger.format_hex(target_UUID)}")
 
         # Handle sending of symmetric key
@@ -223,15 +323,57 @@ class Request:
         # We send a message to target UUID, and for confirmation we get the specific ID from table.
         messageID = database.sendMessageToTarget(target_UUID,self.UUID,msg_type,content)
         # Building and sending the response
+        messageID = wire.pack_u32(self.version, struct.unpack("I", messageID)[0])
         response = Response(
             responseOp=ResponseOp.RESP_MSG_SENT_TO_USER,
             payloadSize=len(target_UUID) + len(messageID),
             clientID=target_UUID,
-            messageID=messageID
+            messageID=messageID,
+            version=self.version
         )
         message = response.build_message()
-        self.socket.sendall(message)
+        self.connection.send(message)
+
+        # If the target is listening, it gets the message right away
+        pushPending(target_UUID)
     
+    # Handles a batch of messages to many users in one request
+    # Payload: amount (4 bytes), a table of entry headers (target UUID, type, content size), and the contents in the same order.
+    # In version 3 the amount and the content sizes are varints.
+    def batchMessageRequest(self):
+        count = wire.read_u32(self.version, self.receive_all)
+        table = []
+        for i in range(count):
+            target_UUID, msg_type = struct.unpack("=16s B", self.receive_all(17))
+            table.append((target_UUID, msg_type, wire.read_u32(self.version, self.receive_all)))
+
+        # Read the contents in the order of the table
+        entries = []
+        for target_UUID, msg_type, content_size in table:
+            content = self.receive_all(content_size) if content_size else None
+            entries.append((target_UUID, msg_type, content))
+
+        # Update last seen!
+        database.updateLastSeen(self.UUID)
+
+        # All messages are stored in one transaction, if a target does not exist none of them are.
+        messageIDs = database.sendMessagesToTargets(self.UUID, entries)
+        print(f"Stored a batch of {count} messages from {logger.format_hex(self.UUID)}")
+
+        # Building and sending the response
+        ids_dump = wire.pack_u32(self.version, len(messageIDs)) + b"".join(
+            wire.pack_u32(self.version, struct.unpack("I", messageID)[0]) for messageID in messageIDs)
+        response = Response(
+            responseOp=ResponseOp.RESP_BATCH_SENT,
+            payloadSize=len(ids_dump),
+            version=self.version)
+        message = response.build_message(ids_dump)
+        self.connection.send(message)
+
+        # Targets that are listening get their messages right away
+        for target_UUID in dict.fromkeys(target for target, _, _ in entries):
+            pushPending(target_UUID)
+
     # Collets all the messages on the server for a specific user 
     def collectMsgsRequest(self):
         # We check that our UUID exists, else we won't have a proper response! Raise error if it doesnt.
@@ -241,32 +383,60 @@ class Request:
         # Update last seen!
         database.updateLastSeen(self.UUID)
         
-        messages = database.getAllMessages(self.UUID)
-        print(f"Messages Retreived: \n"
-              f"{messages}")
-            
-        if not messages:
-            byte_msg = b''
-        else:
-            # We parse into bytes
-            for msg_id, from_client, msg_type, content in messages:
-                content = content if content else b'' 
-                #We make sure the content is binary.
-                # We parse the messages according to header, since its different than the return from the database.
-                # We pay attention that we do not need to send as little endian, since this is payload. 
-                byte_msg = (
-                    from_client +                          
-                    struct.pack("I", msg_id) +            
-                    struct.pack("B", msg_type) +         
-                    struct.pack("I", len(content)) +      
-                    content)
+        # The messages are deleted once the response was written, see sendMessages
+        messages = database.pendingMessages(self.UUID, self.connection.queued_messages.get(self.UUID, 0))
+        print(f"Messages Retreived: {len(messages)}")
+        byte_msg = self.packMessages(messages, self.version)
         
         # Building and sending the response
         response = Response(
             responseOp=ResponseOp.RESP_AWAITING_MESSAGES,
-            payloadSize=len(byte_msg))
+            payloadSize=len(byte_msg),
+            version=self.version)
         message = response.build_message(byte_msg)
-        print(f"Message: \n{message}")
-        self.socket.sendall(message)
+        sendMessages(self.connection, self.UUID, messages, message)
+
+    # Collects one page of the messages waiting for a user
+    # Payload: last message ID received (4 bytes), max messages (4 bytes), max bytes (4 bytes), varints in version 3.
+    # The message ID is not used: served messages are deleted once written, so a page always starts at the oldest message
+    # still waiting (after the ones still being written on this connection).
+    # Response payload: 1 byte 'more messages waiting' flag, then the messages like in 604.
+    def collectMsgsPageRequest(self):
+        _, maxCount, maxBytes = (wire.read_u32(self.version, self.receive_all) for _ in range(3))
+        database.updateLastSeen(self.UUID)
+
+        messages, more = database.pendingMessagesPage(self.UUID, max(maxCount, 1), maxBytes,
+                                                      self.connection.queued_messages.get(self.UUID, 0))
+        print(f"Messages Retreived: {len(messages)}, more waiting: {more}")
+        byte_msg = struct.pack("B", more) + self.packMessages(messages, self.version)
+
+        response = Response(
+            responseOp=ResponseOp.RESP_AWAITING_MESSAGES_PAGE,
+            payloadSize=len(byte_msg),
+            version=self.version)
+        sendMessages(self.connection, self.UUID, messages, response.build_message(byte_msg))
+
+    # Subscribes the connection to its messages: from now on they are pushed (2108) as soon as they are stored.
+    # Messages that were already waiting are pushed right after the confirmation.
+    def subscribeRequest(self):
+        database.updateLastSeen(self.UUID)
+        subscribers[self.UUID] = (self.connection, self.version)
+        print(f"Subscribed {logger.format_hex(self.UUID)} to pushed messages")
 
+        response = Response(responseOp=ResponseOp.RESP_SUBSCRIBED, payloadSize=0, version=self.version)
+        self.connection.send(response.build_message())
+        pushPending(self.UUID)
 
+    # Packs messages from the database into the payload format, every message is appended after the previous one.
+    # We parse the messages according to header, since its different than the return from the database.
+    # We pay attention that we do not need to send as little endian, since this is payload. 
+    # In version 3 the message ID and the content size are varints.
+    @staticmethod
+    def packMessages(messages, version: int = wire.VERSION_FIXED) -> bytes:
+        return b"".join(
+            from_client +                          
+            wire.pack_u32(version, msg_id) +            
+            struct.pack("B", msg_type) +         
+            wire.pack_u32(version, len(content or b'')) +      
+            (content or b'')
+            for msg_id, from_client, msg_type, content in messages)
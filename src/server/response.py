@@ -10,14 +10,19 @@ class ResponseOp(IntEnum):
     RESP_PUBLIC_KEY = 2102
     RESP_MSG_SENT_TO_USER = 2103
     RESP_AWAITING_MESSAGES = 2104
+    RESP_BATCH_SENT = 2105
+    RESP_AWAITING_MESSAGES_PAGE = 2106
+    RESP_SUBSCRIBED = 2107
+    RESP_PUSHED_MESSAGES = 2108
+    RESP_USER_LIST_SINCE = 2109
     RESP_GENERAL_ERROR = 9000
 
 # Response class 
 class Response:
     RESPONSE_HEADER = "<B H I" 
 
-    def __init__(self, responseOp : ResponseOp, payloadSize, clientID = None, clientName = None, publicKey = None, messageID = None): 
-        self.version = 2                        # Always 2
+    def __init__(self, responseOp : ResponseOp, payloadSize, clientID = None, clientName = None, publicKey = None, messageID = None, version = 2): 
+        self.version = version                  # The version of the request (payload encoding)
         self.op = responseOp                    # 2 bytes
         self.payload_size = payloadSize         # 4 bytes
         self.clientID = clientID
@@ -45,10 +50,14 @@ class Response:
             elif self.op == ResponseOp.RESP_MSG_SENT_TO_USER and self.clientID:
                 return header + self.clientID + self.messageID
             
-            elif self.op == ResponseOp.RESP_AWAITING_MESSAGES and payload:
-                return header + payload
+            elif self.op == ResponseOp.RESP_AWAITING_MESSAGES:
+                return header + (payload or b'')
             
-            elif self.op == ResponseOp.RESP_GENERAL_ERROR:
+            elif self.op in (ResponseOp.RESP_BATCH_SENT, ResponseOp.RESP_AWAITING_MESSAGES_PAGE, ResponseOp.RESP_PUSHED_MESSAGES,
+                             ResponseOp.RESP_USER_LIST_SINCE):
+                return header + payload
+
+            elif self.op in (ResponseOp.RESP_GENERAL_ERROR, ResponseOp.RESP_SUBSCRIBED):
                 return header
             
         except Exception as e:
@@ -5,10 +5,13 @@ import os
 import database
 import request
 import struct
+import time
 from database import initialize_database 
-from request import Request  
+from request import Request, pushSubscribed
+from connection import Connection, connections
 
 sel = selectors.DefaultSelector()
+SELECT_TIMEOUT = 1          # Seconds between checks for stalled connections
 
 
 # Read the server port from myport.info
@@ -32,50 +35,68 @@ def start_server():
     server_socket.bind((HOST, PORT))
     server_socket.listen()
     server_socket.setblocking(False)
-    sel.register(server_socket, selectors.EVENT_READ, accept_client)
+    sel.register(server_socket, selectors.EVENT_READ, lambda mask: accept_client(server_socket))
     
     print(f"[LISTENING] Server is listening on Port {PORT}...")
     try:
         while True:
-            events = sel.select()
-            for key, _ in events:
+            events = sel.select(SELECT_TIMEOUT)
+            for key, mask in events:
                 callback = key.data
-                callback(key.fileobj)
+                callback(mask)
+            drop_stalled()
     except KeyboardInterrupt:
         print("\n[INFO] Server shutting down...")
     finally:
         sel.close()
+        database.close_connection()
 
 # Accepts clients and handles them in different selector 
 def accept_client(server_socket):
     client_socket, client_address = server_socket.accept()
     print(f"[NEW CONNECTION] {client_address} connected.")
-    client_socket.setblocking(False)
-    sel.register(client_socket, selectors.EVENT_READ, handle_client)
+    Connection(client_socket, sel, handle_client)
 
-# Main client-server function
-def handle_client(client_socket):
+# Main client-server function, writes what is queued for the client once it can take it,
+# and handles every request that arrived whole (a partial one waits in the connection)
+def handle_client(connection, mask):
+    if connection.closed:  # Closed by an earlier event of the same select (a failed push)
+        return
     try:
-        # Accept a new request 
-        request = Request(client_socket)
-        if request:
-            # If request is valid, print the info and handle it.
-            print(request)
-            request.handle_request()
+        if mask & selectors.EVENT_WRITE:
+            connection.flush()
+            if not connection.outbox:
+                pushSubscribed(connection)
+
+        if mask & selectors.EVENT_READ:
+            for data in connection.receive():
+                request = Request(connection, data)
+                # Print the info and handle it.
+                print(request)
+                request.handle_request()
         
     except ConnectionResetError as e:
         print(f"[DISCONNECTED] Client lost connection: {e}")
-        sel.unregister(client_socket)
+        connection.close()
 
     except Exception as e:
         print(f"[DISCONNECTED] Client lost connection.")
-        disconnect_client(client_socket)
+        disconnect_client(connection)
 
 # Formal disconnection
-def disconnect_client(client_socket):
-    print(f"[CONNECTION CLOSED] {client_socket.getpeername()} disconnected.")
-    sel.unregister(client_socket)
-    client_socket.close()
+def disconnect_client(connection):
+    try:
+        print(f"[CONNECTION CLOSED] {connection.socket.getpeername()} disconnected.")
+    except OSError:
+        print(f"[CONNECTION CLOSED] Client disconnected.")
+    connection.close()
+
+# Drops the connections that stopped half way through sending a request, or stopped reading what we send
+def drop_stalled():
+    now = time.monotonic()
+    for connection in [connection for connection in connections.values() if connection.stalled(now)]:
+        print(f"[TIMEOUT] A client stopped sending its request or reading what we send, dropping it.")
+        disconnect_client(connection)
 
 if __name__ == "__main__":
     start_server()
@@ -0,0 +1,66 @@
+import struct
+
+# Payload encodings, chosen by the version byte of the request header (the response answers in the same version).
+# Version 2: sizes, counts and IDs are 4 (or 8) bytes little endian, names are padded to 255 bytes.
+# Version 3: sizes, counts and IDs are LEB128 varints (7 bits per byte, the high bit says another byte follows),
+#            names are a varint length and the name.
+VERSION_FIXED = 2
+VERSION_COMPACT = 3
+NAME_SIZE = 255
+MAX_VARINT32 = 5
+
+# Packs a varint
+def pack_varint(value: int) -> bytes:
+    out = bytearray()
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+    return bytes(out)
+
+# Packs a size / count / ID: 4 bytes (version 2) or a varint (version 3)
+def pack_u32(version: int, value: int) -> bytes:
+    return struct.pack("<I", value) if version < VERSION_COMPACT else pack_varint(value)
+
+# Packs a version counter: 8 bytes (version 2) or a varint (version 3)
+def pack_u64(version: int, value: int) -> bytes:
+    return struct.pack("<Q", value) if version < VERSION_COMPACT else pack_varint(value)
+
+# Packs a name: padded with pad to 255 bytes (version 2) or its length and the name (version 3)
+def pack_name(version: int, name: bytes, pad: bytes) -> bytes:
+    if version < VERSION_COMPACT:
+        return name.ljust(NAME_SIZE, pad)
+    return pack_varint(len(name)) + name
+
+# Reads a varint with receive(size) -> bytes, at most maxSize bytes long
+def read_varint(receive, maxSize: int = MAX_VARINT32) -> int:
+    value = 0
+    for i in range(maxSize):
+        data = receive(1)
+        if not data:
+            raise ConnectionError("Connection closed in the middle of a field")
+        value |= (data[0] & 0x7F) << (7 * i)
+        if not data[0] & 0x80:
+            return value
+    raise ValueError("Invalid varint field")
+
+# Reads a size / count / ID in the encoding of version
+def read_u32(version: int, receive) -> int:
+    if version < VERSION_COMPACT:
+        return struct.unpack("<I", receive(4))[0]
+    return read_varint(receive)
+
+# Reads a version counter in the encoding of version
+def read_u64(version: int, receive) -> int:
+    if version < VERSION_COMPACT:
+        return struct.unpack("<Q", receive(8))[0]
+    return read_varint(receive, 10)
+
+# Reads a name as sent: 255 padded bytes (version 2), or a length and the name (version 3)
+def read_name(version: int, receive) -> bytes:
+    if version < VERSION_COMPACT:
+        return bytes(receive(NAME_SIZE))
+    size = read_varint(receive)
+    if size > NAME_SIZE:
+        raise ValueError("Name is longer than 255 bytes")
+    return bytes(receive(size))